@@ -1,6 +1,6 @@
-from videocore.assembler import qpu, sema_down, sema_up, wait_dma_store
-from videocore.driver import Driver
-import sys
+from videocore.assembler import qpu, assemble, sema_down, sema_up, wait_dma_store, wait_dma_load, mutex_acquire, mutex_release
+import argparse
+import struct
 
 # register usage
 
@@ -14,12 +14,27 @@ import sys
 # u7 : frame buffer base address
 # u8 : vpm write y config
 # u9 : vpm write uv config
-# u12: x tile count
-# u13: y tile count
-# u10: frame buffer width
-# u11: frame buffer height
-# u14: -
-# u15: -
+# u10: x tile count
+# u11: y tile count
+# u12: frame buffer width
+# u13: frame buffer height
+# u14: dma store y config
+# u15: dma store uv config
+# u16: dma load map config
+# u17: vpm read map config
+# u18: gain map base address
+# u19-u27: color matrix (row major)
+# u28-u30: color offset
+# u31: blend map base address (second coordinates)
+# u32: blend weight base address
+# u33-u40: transform (homography h00-h21, h22 = 1)
+# u41: doorbell address of the persistent mode, 0 to exit after the frame
+# u42: sequence number of this frame
+# u43: done flag address
+# u44: level table address of the mip variants
+# u45-u48: texture config 0-3 of the half size source
+# u49-u52: texture config 0-3 of the quarter size source
+# u53: stereo table address of the stereo variants
 
 # r0: temp
 # r1: temp
@@ -28,10 +43,10 @@ import sys
 # r4: tmu
 # r5: broadcast
 
-# ra0 : -
+# ra0 : odd thread flag
 # ra1 : thread index
 # ra2 : rgba texture config uniform base address
-# ra3 : remap address
+# ra3 : remap address (step)
 # ra4 : y address
 # ra5 : u address
 # ra6 : v address
@@ -41,33 +56,33 @@ import sys
 # ra10: y register
 # ra11: u register
 # ra12: v register
-# ra13: s coord
+# ra13: map owner countdown, 0 if this thread loaded the step being read
 # ra14: t coord
 # ra15: yuvx register
 # ra16: vpm write y(0,0) setup register
 # ra17: vpm write uv(0,0) setup register
 # ra18: 1/65535
-# ra19: -
-# ra20: -
-# ra21: -
-# ra22: -
-# ra23: -
-# ra24: -
-# ra25: -
-# ra26: -
-# ra27: -
-# ra28: -
-# ra29: -
-# ra30: -
-# ra31: -
-
-# rb0 : -
-# rb1 : -
-# rb2 : -
-# rb3 : -
-# rb4 : -
-# rb5 : -
-# rb6 : -
+# ra19: second yuvx register
+# ra20: vpm read map(0) setup register
+# ra21: gain map address (row of this thread)
+# ra22: gain (blend weight) byte shift
+# ra23: color offset y
+# ra24: color offset u
+# ra25: color offset v
+# ra26: color y temp
+# ra27: color u temp
+# ra28: gain (blend weight) register
+# ra29: blend map address (row of this thread)
+# ra30: blend weight address (row of this thread)
+# ra31: second st coord of the step after next
+
+# rb0 : transform h00 / level table address (mip)
+# rb1 : transform h01 / stereo table address (stereo)
+# rb2 : transform h02 / texture config address of the step (mip)
+# rb3 : transform h10 / s offset of the step (stereo)
+# rb4 : transform h11 / t offset of the step (stereo)
+# rb5 : transform h12
+# rb6 : transform h20
 # rb7 : x tile count
 # rb8 : y tile count
 # rb9 : remap address increment
@@ -75,29 +90,71 @@ import sys
 # rb11: u,v address increment (column)
 # rb12 : y address increment (row)
 # rb13 : u,v address increment (row)
-# rb14 : dma store stride for y
-# rb15 : dma store stride for u,v
-# rb16 : -
-# rb17 : -
-# rb18 : -
-# rb19 : -
-# rb20 : -
-# rb21 : -
-# rb22 : -
-# rb23 : -
-# rb24 : -
-# rb25 : -
-# rb26 : -
-# rb27 : -
-# rb28 : -
-# rb29 : -
-# rb30 : -
-# rb31 : -
+# rb14 : transform h21
+# rb15 : blend map word offset
+# rb16 : dma store y(0) setup register
+# rb17 : dma store uv(0) setup register
+# rb18 : gain scale
+# rb19 : vpm write uv slot offset
+# rb20 : dma load map(0) setup register
+# rb21 : color matrix m00
+# rb22 : color matrix m01
+# rb23 : color matrix m02
+# rb24 : color matrix m10
+# rb25 : color matrix m11
+# rb26 : color matrix m12
+# rb27 : color matrix m20
+# rb28 : color matrix m21
+# rb29 : color matrix m22
+# rb30 : gain (blend weight) word offset
+# rb31 : gain (blend weight) address increment
 
 # Semaphore index
 COMPLETED           = 0
-HALF_TILE_SYNC_PRE  = 1
-HALF_TILE_SYNC_POST = 2
+WAKE                = 1
+MAP_LOADED          = 2 # + slot, the map of the step is in the slot
+MAP_FREE            = 4 # + slot, the slot can take the map of the next step
+
+# first uniform of the persistent mode (read by finalize)
+PERSISTENT_UNIFORM  = 41
+# level table address of the mip variants (read by init)
+MIP_UNIFORM         = 44
+# stereo table address of the stereo variants (read by init)
+STEREO_UNIFORM      = 53
+# iterations of the delay loop between two reads of the doorbell
+POLL_DELAY          = 4096
+
+# VPM layout
+#
+# Every QPU owns its rows of the VPM and issues its own DMA stores, so there
+# is no barrier between QPUs while a frame is being processed.  Each region is
+# double-buffered: a half tile is written to one slot while the DMA store of
+# the previous half tile reads the other one.
+#
+#   rows  0-23 : y,  row = slot * 12 + thread
+#   rows 24-35 : uv, row = 24 + slot * 6 + thread / 2 (even threads only,
+#                u in columns 0-7, v in columns 8-15)
+#   row  36    : uv dummy row for odd threads
+#   rows 37-60 : map, row = 37 + slot * 12 + thread
+#
+# The map is streamed into the VPM two steps ahead of the coordinate reads, so
+# both TMUs are free for sampling the source: even steps are sampled by tmu0
+# and odd steps by tmu1, with one request in flight on each.  A step is 768
+# contiguous bytes of the map, and one QPU loads all of it with a single DMA
+# (the owner of step m is thread m % 12).  The owner waits for its load and
+# posts MAP_LOADED for all threads when it reads the step itself, and every
+# thread posts MAP_FREE when it has read its row, which the owner of the next
+# load of the slot waits for.
+VPM_Y_SLOT_ROWS   = 12
+VPM_UV_SLOT_ROWS  = 6
+VPM_MAP_BASE      = 37
+VPM_MAP_SLOT_ROWS = 12
+
+# gain map value of 1.0
+GAIN_MAP_ONE = 64
+
+def float_bits(f):
+    return struct.unpack('<I', struct.pack('<f', f))[0]
 
 def mask(idx):
     idxs = idx if isinstance(idx, list) else [idx]
@@ -125,7 +182,7 @@ def vpm_write_y_config(thread):
     return (stride<<12|horizontal<<11|laned<<10|size<<8|addr)
 
 def vpm_write_uv_config(thread):
-    stride = 24 if thread % 2 == 0 else 1 # Y += 6
+    stride = 2 # B += 2
     size = 0 # 8-bit
     laned = 0 # packed
     horizontal = 1 # horizontal
@@ -134,15 +191,61 @@ def vpm_write_uv_config(thread):
     addr = ((Y & 0x3f) << 2) | (B & 0x3)
     return (stride<<12|horizontal<<11|laned<<10|size<<8|addr)
 
+def dma_store_config(nrows, ncols, Y, X):
+    id = 2 # VDW basic setup
+    modew = 0 # 32-bit
+    horizontal = 1 # horizontal
+    laned = 0
+    addr = ((Y & 0x7f) << 4) | (X & 0xf)
+    return (id<<30|(nrows&0x7f)<<23|(ncols&0x7f)<<16|laned<<15|horizontal<<14|addr<<3|modew)
+
+def dma_store_y_config(thread):
+    return dma_store_config(1, 16, thread, 0)
+
+def dma_store_uv_config(thread):
+    return dma_store_config(1, 8, 24 + thread // 2, 0)
+
+def dma_load_config(nrows, ncols, Y, X):
+    id = 1 # VDR basic setup
+    modew = 0 # 32-bit
+    mpitch = 3 # 64 bytes
+    vpitch = 1 # Y += 1
+    vertical = 0 # horizontal
+    addr = ((Y & 0x3f) << 4) | (X & 0xf)
+    return (id<<31|modew<<28|mpitch<<24|(ncols&0xf)<<20|(nrows&0xf)<<16|vpitch<<12|vertical<<11|addr)
+
+def vpm_write_done_config():
+    stride = 1 # Y += 1
+    size = 2 # 32-bit
+    laned = 0 # packed
+    horizontal = 1 # horizontal
+    Y = 0 # y slot 0 of thread 0
+    return (stride<<12|horizontal<<11|laned<<10|size<<8|Y)
+
+def dma_load_map_config():
+    return dma_load_config(VPM_MAP_SLOT_ROWS, 16, VPM_MAP_BASE, 0)
+
+def vpm_read_map_config(thread):
+    num = 1 # 1 row
+    stride = 1 # Y += 1
+    size = 2 # 32-bit
+    laned = 0 # packed
+    horizontal = 1 # horizontal
+    Y = VPM_MAP_BASE + thread
+    addr = Y & 0x3f
+    return ((num&0xf)<<20|stride<<12|horizontal<<11|laned<<10|size<<8|addr)
+
 @qpu
-def remap(asm, n_threads):
-    init(asm, n_threads)
-    main_loop(asm, n_threads)
-    finalize(asm, n_threads)
+def remap(asm, n_threads, opts):
+    # the persistent mode restarts here for every frame
+    L.start
+    init(asm, n_threads, opts)
+    main_loop(asm, n_threads, opts)
+    finalize(asm, n_threads, opts)
 
 @qpu
-def init(asm, n_threads):
-    # disable tmu swap because we use tmu0: remap, tmu1: rgba
+def init(asm, n_threads, opts):
+    # disable tmu swap because tmu0 and tmu1 take even and odd steps
     mov(tmu_noswap, 1)
 
     # texture config uniforms base address
@@ -157,16 +260,11 @@ def init(asm, n_threads):
     # thread index
     mov(ra1, uniform)
 
-    # add rows to remap address
-    ldi(r0, 64)
-    imul24(r0, r0, ra1) # 1-row size (64byte) is multiplied by thread index
-    iadd(ra3, uniform, r0)
+    # remap address, the steps are loaded whole
+    mov(ra3, uniform)
 
-    # make slope to remap address register
-    for i in range(16):
-        ldi(r0, i*4)
-        ldi(null, mask(i), set_flags=True)
-        iadd(ra3, ra3, r0, cond='zs')
+    # the owner of step 0 is thread 0
+    mov(ra13, ra1)
 
     # y address
     mov(ra4, uniform)
@@ -189,6 +287,68 @@ def init(asm, n_threads):
     # frame height
     mov(r1, uniform)
 
+    # dma store y(0) setup register
+    mov(rb16, uniform)
+
+    # dma store uv(0) setup register
+    mov(rb17, uniform)
+
+    # dma load map(0) setup register
+    mov(rb20, uniform)
+
+    # vpm read map(0) setup register
+    mov(ra20, uniform)
+
+    if opts.gain_map:
+        # add rows to gain map address
+        ldi(r0, 16)
+        imul24(r0, r0, ra1) # 1-row size (16byte) is multiplied by thread index
+        iadd(ra21, uniform, r0)
+    elif opts.color_matrix or opts.blend or opts.transform:
+        # gain map base address (discard here)
+        mov(null, uniform)
+
+    if opts.color_matrix or opts.blend or opts.transform:
+        # color matrix (discarded if disabled)
+        for reg in [rb21, rb22, rb23, rb24, rb25, rb26, rb27, rb28, rb29]:
+            mov(reg if opts.color_matrix else null, uniform)
+        # color offset (discarded if disabled)
+        for reg in [ra23, ra24, ra25]:
+            mov(reg if opts.color_matrix else null, uniform)
+
+    if opts.blend:
+        # add rows to blend map address
+        ldi(r0, 64)
+        imul24(r0, r0, ra1) # 1-row size (64byte) is multiplied by thread index
+        iadd(ra29, uniform, r0)
+        # add rows to blend weight address
+        ldi(r0, 16)
+        imul24(r0, r0, ra1) # 1-row size (16byte) is multiplied by thread index
+        iadd(ra30, uniform, r0)
+    elif opts.transform:
+        # blend map, blend weight base address (discard here)
+        mov(null, uniform)
+        mov(null, uniform)
+
+    if opts.transform:
+        # transform
+        for reg in [rb0, rb1, rb2, rb3, rb4, rb5, rb6, rb14]:
+            mov(reg, uniform)
+
+    if opts.mip:
+        # level table address, after the uniforms of the persistent mode
+        ldi(r2, (MIP_UNIFORM - 1) * 4)
+        iadd(uniforms_address, ra2, r2)
+        nop(); nop()
+        mov(rb0, uniform)
+
+    if opts.stereo:
+        # stereo table address
+        ldi(r2, (STEREO_UNIFORM - 1) * 4)
+        iadd(uniforms_address, ra2, r2)
+        nop(); nop()
+        mov(rb1, uniform)
+
     # u address
     imul24(r2, r0, r1)
     iadd(ra5, ra4, r2)
@@ -197,6 +357,17 @@ def init(asm, n_threads):
     shr(r2, r2, 2)
     iadd(ra6, ra5, r2)
 
+    # add rows to y address
+    imul24(r2, r0, ra1) # 1-row size is multiplied by thread index
+    iadd(ra4, ra4, r2)
+
+    # add rows to u,v address
+    shr(r3, ra1, 1)
+    shr(r2, r0, 1)
+    imul24(r2, r2, r3) # 1-row size of u,v is multiplied by thread index / 2
+    iadd(ra5, ra5, r2)
+    iadd(ra6, ra6, r2)
+
     # y address increment (row)
     imul24(rb12, r0, (n_threads - 1))
 
@@ -204,61 +375,87 @@ def init(asm, n_threads):
     shr(r2, r0, 1)
     imul24(rb13, r2, (n_threads//2 - 1))
 
-    # dma store stride for y
-    ldi(r2, 64)
-    isub(r2, r0, r2)
-    mov(rb14, r2)
-
-    # dma store stride for u,v
-    shr(rb15, r2, 1)
-
     ldi(ra18, 0x37800080) # 1/65535
 
-    # init remap address increment
+    # init remap address increment (step)
     ldi(rb9, 64 * n_threads)
     # init y address increment (column)
     ldi(rb10, 64)
     # init uv address increment (column)
     ldi(rb11, 32)
 
-    # if main thread
-    mov(null, ra1, set_flags=True)  # thread index
-    jzc(L.init_end)
-    nop(); nop(); nop()
-
-    # setup dma store stride for v(1:0-3) (dummy)
-    setup_dma_store_stride(rb15)
-    # setup dma store v(1,0:3) (dummy)
-    setup_dma_store(mode='32bit horizontal', nrows=n_threads//2, ncols=8, X=8, Y=30)
-    # start store v(1,0:3) (dummy)
-    start_dma_store(ra6)
-
-    # endif
-    L.init_end
+    # odd thread flag
+    band(ra0, ra1, 1)
+
+    # vpm write uv slot offset (odd threads always write to the dummy row)
+    ldi(r0, VPM_UV_SLOT_ROWS * 4)
+    mov(rb19, 0)
+    mov(null, ra0, set_flags=True) # odd thread flag
+    mov(rb19, r0, cond='zs')
+
+    if opts.blend:
+        # each element reads its own word of the blend map
+        shl(rb15, element_number, 2)
+
+    if opts.gain_map or opts.blend:
+        # each element reads the word holding its gain (blend weight) byte
+        ldi(r1, 12)
+        band(rb30, element_number, r1)
+        band(r0, element_number, 3)
+        shl(ra22, r0, 3)
+        # init gain (blend weight) address increment
+        ldi(rb31, 16 * n_threads)
+    if opts.gain_map:
+        ldi(rb18, float_bits(255.0 / GAIN_MAP_ONE))
+    if opts.blend:
+        # fetch second coord of step 0,1
+        for slot in range(2):
+            fetch_blend_coord(asm, slot)
+
+    # load map of step 0,1 to slot 0,1, the slots are free
+    for slot in range(2):
+        if opts.stereo:
+            stereo_entry(asm, 1)
+        load_map(asm, n_threads, slot, opts, owner=slot, wait_free=False)
+
+    for slot in range(2):
+        # read coord of step 0,1 from slot 0,1
+        wait_map(asm, n_threads, slot)
+        nop(); nop(); nop()
+        mov(ra9, vpm)
+        sema_up(MAP_FREE + slot)
+
+        # load map of step 2,3 to slot 0,1
+        if opts.stereo:
+            stereo_entry(asm, 3)
+        load_map(asm, n_threads, slot, opts)
+        next_map_owner(asm, n_threads)
+        if opts.stereo:
+            stereo_offsets(asm)
+
+        set_texture_config(asm, opts)
 
-    # write remap addr to tmu0_s
-    mov(tmu0_s, ra3)
-    # increment remap addr
-    iadd(ra3, ra3, rb9)
-    # receive coord from tmu0
-    nop(sig='load tmu0')
-    # move coord to A-reg to unpack
-    mov(ra9, r4)   
+        itof(r3, ra9.unpack('16b')) # t coord
+        itof(r2, ra9.unpack('16a')) # s coord
+        if opts.stereo:
+            add_stereo_offsets(asm)
 
-    # set uniform_address to texture config base address
-    mov(uniforms_address, ra2) # uniforms can be read after 2 instructions
+        fmul(r3, r3, ra18) # t/=65535
+        fetch_texture(asm, slot, opts)
 
-    itof(r3, ra9.unpack('16b')) # t coord
-    itof(r2, ra9.unpack('16a')) # s coord
+        if opts.gain_map:
+            fetch_gain(asm, slot)
 
-    fmul(r3, r3, ra18) # t/=65535
-    fadd(tmu1_t, r3, 0.5).fmul(r2, r2, ra18) # t+=0.5, s/=65535
-    fadd(tmu1_s, r2, 0.5) # s+=0.5
+        if opts.blend:
+            # wait second coord of step 0,1
+            nop(sig='load tmu{}'.format(slot))
+            mov(ra31, r4)
+            fetch_blend(asm, slot, opts)
 
-    half_tile(asm, n_threads, store_index=1, increment_address=False)
+    half_tile(asm, n_threads, opts, store_index=1, store=False)
 
 @qpu
-def main_loop(asm, n_threads):
+def main_loop(asm, n_threads, opts):
     # init tile y loop counter
     mov(r0, rb8)
     mov(ra8, r0)
@@ -272,7 +469,7 @@ def main_loop(asm, n_threads):
     L.tile_x_loop
 
     # tile
-    tile(asm, n_threads)
+    tile(asm, n_threads, opts)
 
     # decrement tile x loop counter
     isub(r0, ra7, 1)
@@ -302,13 +499,30 @@ def main_loop(asm, n_threads):
     # --- end of tile y loop ---
 
 @qpu
-def finalize(asm, n_threads):
-    # wait tmu1
-    nop(sig='load tmu1')
+def finalize(asm, n_threads, opts):
+    # wait tmu0, tmu1
+    for tmu in range(2):
+        nop(sig='load tmu{}'.format(tmu))
+        if opts.gain_map:
+            nop(sig='load tmu{}'.format(tmu))
+        if opts.blend:
+            for i in range(3):
+                nop(sig='load tmu{}'.format(tmu))
+
+    # wait map
+    wait_dma_load()
 
     # wait dma store
     wait_dma_store()
 
+    # persistent mode uniforms, ra2 points to u1
+    ldi(r0, (PERSISTENT_UNIFORM - 1) * 4)
+    iadd(uniforms_address, ra2, r0)
+    nop(); nop()
+    mov(ra3, uniform) # doorbell address
+    mov(ra4, uniform) # sequence number
+    mov(ra5, uniform) # done flag address
+
     sema_up(COMPLETED)
 
     # if main thread
@@ -319,11 +533,79 @@ def finalize(asm, n_threads):
     for i in range(n_threads):
         sema_down(COMPLETED)
 
+    # persistent mode: the host polls the done flag instead
+    mov(null, ra3, set_flags=True) # doorbell address
+    jzc(L.fin_done)
+    nop(); nop(); nop()
+
     interrupt()
 
+    L.fin_done
+    mov(null, ra3, set_flags=True) # doorbell address
+    jzs(L.fin_end)
+    nop(); nop(); nop()
+
+    # write the sequence number to the done flag
+    ldi(vpmvcd_wr_setup, vpm_write_done_config())
+    mov(vpm, ra4)
+    mutex_acquire()
+    mov(vpmvcd_wr_setup, rb16) # dma store y(0) of thread 0 stores row 0
+    start_dma_store(ra5)
+    mutex_release()
+    wait_dma_store()
+
+    # poll the doorbell until the host rings it with the next sequence number
+    L.fin_poll
+    ldi(r1, POLL_DELAY)
+    L.fin_delay
+    isub(r1, r1, 1, set_flags=True)
+    jzc(L.fin_delay)
+    nop(); nop(); nop()
+
+    mutex_acquire()
+    ldi(vpmvcd_rd_setup, dma_load_config(1, 16, VPM_MAP_BASE, 0)) # row of thread 0 in map slot 0
+    start_dma_load(ra3)
+    mutex_release()
+    wait_dma_load()
+    mov(vpmvcd_rd_setup, ra20) # vpm read map(0) of this thread
+    nop(); nop(); nop()
+    mov(r0, vpm)
+    isub(null, r0, ra4, set_flags=True) # still the sequence number of this frame
+    jzs(L.fin_poll)
+    nop(); nop(); nop()
+
+    # wake the other threads
+    for i in range(n_threads - 1):
+        sema_up(WAKE)
+    jmp(L.fin_restart)
+    nop(); nop(); nop()
+
     # endif
     L.fin_end
 
+    mov(null, ra3, set_flags=True) # doorbell address
+    jzs(L.fin_exit)
+    nop(); nop(); nop()
+
+    sema_down(WAKE)
+
+    L.fin_restart
+
+    # the host has replaced the uniforms, a zero doorbell address ends the kernel
+    ldi(r0, (PERSISTENT_UNIFORM - 1) * 4)
+    iadd(uniforms_address, ra2, r0)
+    nop(); nop()
+    mov(null, uniform, set_flags=True) # doorbell address
+    jzs(L.fin_exit)
+    nop(); nop(); nop()
+
+    jmp(L.start)
+    isub(uniforms_address, ra2, 4) # restart from u0
+    nop()
+    nop()
+
+    L.fin_exit
+
     nop()
     nop()
     nop()
@@ -331,163 +613,713 @@ def finalize(asm, n_threads):
     # Finish the thread
     exit(interrupt=False)
 
+map_labels = 0
+
+def map_label():
+    global map_labels
+    map_labels += 1
+    return 'map{}'.format(map_labels)
+
+@qpu
+def load_map(asm, n_threads, slot, opts, owner=2, wait_free=True):
+    # loads the step 2 after the step being read, by its owner: the thread
+    # whose countdown is owner (2, or 0 and 1 for the first 2 steps)
+    label = map_label()
+    if opts.stereo:
+        # the offset of the step in the map is the next stereo table word,
+        # which every thread reads to keep its uniforms in order
+        iadd(r1, ra3, uniform)
+    isub(null, ra13, owner, set_flags=True)
+    jzc(L[label])
+    nop(); nop(); nop()
+
+    if wait_free:
+        # all threads have read their row of the step in the slot
+        for i in range(n_threads):
+            sema_down(MAP_FREE + slot)
+
+    # the dma load setup is shared by all QPUs
+    mutex_acquire()
+    ldi(r0, (slot * VPM_MAP_SLOT_ROWS) << 4)
+    iadd(vpmvcd_rd_setup, rb20, r0)
+    if opts.stereo:
+        start_dma_load(r1)
+    else:
+        start_dma_load(ra3)
+    mutex_release()
+
+    L[label]
+
+    if not opts.stereo:
+        # increment remap addr
+        iadd(ra3, ra3, rb9)
+
+@qpu
+def wait_map(asm, n_threads, slot):
+    # waits for the step in the slot and sets up the read of this thread's
+    # row, vpm can be read 3 instructions later
+    label = map_label()
+    mov(null, ra13, set_flags=True)
+    jzc(L[label])
+    nop(); nop(); nop()
+
+    # this thread loaded the step: wait for the dma and let all threads read it
+    wait_dma_load()
+    for i in range(n_threads):
+        sema_up(MAP_LOADED + slot)
+
+    L[label]
+
+    sema_down(MAP_LOADED + slot)
+    ldi(r0, slot * VPM_MAP_SLOT_ROWS)
+    iadd(vpmvcd_rd_setup, ra20, r0)
+
+@qpu
+def next_map_owner(asm, n_threads):
+    # counts down to 0 for the next step this thread loaded, modulo n_threads
+    isub(r0, ra13, 1, set_flags=True)
+    ldi(r1, n_threads - 1)
+    mov(r0, r1, cond='ns')
+    mov(ra13, r0)
+
+@qpu
+def stereo_entry(asm, words):
+    # the stereo table holds the map offsets of the first 2 steps, then for
+    # every step the map offset of the step loaded with it (2 ahead of it) and
+    # the s and t offsets of the step.  A compact stereo map holds the left eye only,
+    # the right eye steps point back into it and add the offsets of the eye.
+    mov(uniforms_address, rb1) # uniforms can be read after 2 instructions
+    ldi(r0, words * 4)
+    iadd(rb1, rb1, r0) # a small immediate would take the regfile B read
+
 @qpu
-def tile(asm, n_threads):
+def stereo_offsets(asm):
+    mov(rb3, uniform) # s offset of the step
+    mov(rb4, uniform) # t offset of the step
+
+@qpu
+def add_stereo_offsets(asm):
+    # in: t coord (r3), s coord (r2), in map units
+    fadd(r3, r3, rb4)
+    fadd(r2, r2, rb3)
+
+@qpu
+def fetch_gain(asm, tmu):
+    # general memory lookup of the gain words of the step
+    if tmu == 0:
+        iadd(tmu0_s, ra21, rb30)
+    else:
+        iadd(tmu1_s, ra21, rb30)
+    # increment gain map address
+    iadd(ra21, ra21, rb31)
+
+@qpu
+def fetch_blend_coord(asm, tmu):
+    # general memory lookup of the second coord of a step
+    if tmu == 0:
+        iadd(tmu0_s, ra29, rb15)
+    else:
+        iadd(tmu1_s, ra29, rb15)
+    # increment blend map address
+    iadd(ra29, ra29, rb9)
+
+@qpu
+def set_texture_config(asm, opts):
+    if opts.mip:
+        # the level table has a word per step: the offset of the texture
+        # config of its level from u1
+        mov(uniforms_address, rb0) # uniforms can be read after 2 instructions
+        ldi(r0, 4)
+        iadd(rb0, rb0, r0) # a small immediate would take the regfile B read
+        iadd(r0, ra2, uniform)
+        mov(uniforms_address, r0) # uniforms can be read after 2 instructions
+        if opts.blend:
+            mov(rb2, r0)
+    else:
+        # set uniform_address to texture config base address
+        mov(uniforms_address, ra2) # uniforms can be read after 2 instructions
+
+@qpu
+def fetch_texture(asm, tmu, opts):
+    # in: s coord (r2), t coord / 65535 (r3)
+    if opts.transform:
+        fadd(r3, r3, 0.5).fmul(r2, r2, ra18) # t+=0.5, s/=65535
+        fadd(r2, r2, 0.5) # s+=0.5
+
+        # w = 1 / (h20 s + h21 t + 1)
+        fmul(r0, r2, rb6)
+        fmul(r1, r3, rb14)
+        fadd(r0, r0, r1)
+        fadd(sfu_recip, r0, 1.0)
+
+        # s' = (h00 s + h01 t + h02) w
+        fmul(r0, r2, rb0)
+        fmul(r1, r3, rb1)
+        fadd(r0, r0, r1)
+        fadd(r0, r0, rb2)
+
+        # t' = (h10 s + h11 t + h12) w
+        fmul(r1, r2, rb3)
+        fmul(r2, r3, rb4)
+        fadd(r1, r1, r2)
+        fadd(r1, r1, rb5)
+        if tmu == 0:
+            fmul(tmu0_t, r1, r4)
+            fmul(tmu0_s, r0, r4)
+        else:
+            fmul(tmu1_t, r1, r4)
+            fmul(tmu1_s, r0, r4)
+    elif tmu == 0:
+        fadd(tmu0_t, r3, 0.5).fmul(r2, r2, ra18) # t+=0.5, s/=65535
+        fadd(tmu0_s, r2, 0.5) # s+=0.5
+    else:
+        fadd(tmu1_t, r3, 0.5).fmul(r2, r2, ra18) # t+=0.5, s/=65535
+        fadd(tmu1_s, r2, 0.5) # s+=0.5
+
+@qpu
+def fetch_blend(asm, tmu, opts):
+    # in: second st coord (ra31)
+
+    # set uniform_address to the texture config of the first sample
+    if opts.mip:
+        mov(uniforms_address, rb2) # uniforms can be read after 2 instructions
+    else:
+        mov(uniforms_address, ra2) # uniforms can be read after 2 instructions
+
+    itof(r3, ra31.unpack('16b')) # t coord
+    itof(r2, ra31.unpack('16a')) # s coord
+
+    fmul(r3, r3, ra18) # t/=65535
+    fetch_texture(asm, tmu, opts)
+
+    # blend weight words of the step
+    if tmu == 0:
+        iadd(tmu0_s, ra30, rb30)
+    else:
+        iadd(tmu1_s, ra30, rb30)
+    # increment blend weight address
+    iadd(ra30, ra30, rb31)
+
+    # second coord of the step after next
+    fetch_blend_coord(asm, tmu)
+
+@qpu
+def blend(asm):
+    # in: y (ra10), u (r2), v (r3), second yuvx (ra19), weight (ra28)
+    # out: y (ra10), u (r2), v (r3)
+    fmul(r1, ra28.unpack('8a'), 1.0) # weight
+
+    # y += (y2 - y) * weight
+    fmul(r0, ra19.unpack('8a'), 1.0) # Y2
+    fsub(r0, r0, ra10)
+    fmul(r0, r0, r1)
+    fadd(ra10, ra10, r0)
+
+    # u += (u2 - u) * weight
+    fmul(r0, ra19.unpack('8b'), 1.0) # U2
+    fsub(r0, r0, r2)
+    fmul(r0, r0, r1)
+    fadd(r2, r2, r0).fmul(r0, ra19.unpack('8c'), 1.0) # V2
+
+    # v += (v2 - v) * weight
+    fsub(r0, r0, r3)
+    fmul(r0, r0, r1)
+    fadd(r3, r3, r0)
+
+@qpu
+def color_matrix(asm):
+    # in: y (ra10), u (r2), v (r3), out: y (ra10), u (r2), v (r3)
+
+    # y = m00 y + m01 u + m02 v + o0
+    fmul(r0, ra10, rb21)
+    fmul(r1, r2, rb22)
+    fadd(r0, r0, r1).fmul(r1, r3, rb23)
+    fadd(r0, r0, r1)
+    fadd(ra26, r0, ra23)
+
+    # u = m10 y + m11 u + m12 v + o1
+    fmul(r0, ra10, rb24)
+    fmul(r1, r2, rb25)
+    fadd(r0, r0, r1).fmul(r1, r3, rb26)
+    fadd(r0, r0, r1)
+    fadd(ra27, r0, ra24)
+
+    # v = m20 y + m21 u + m22 v + o2
+    fmul(r0, ra10, rb27)
+    fmul(r1, r2, rb28)
+    fadd(r0, r0, r1).fmul(r1, r3, rb29)
+    fadd(r0, r0, r1)
+    fadd(r3, r0, ra25)
+
+    mov(ra10, ra26)
+    mov(r2, ra27)
+
+@qpu
+def tile(asm, n_threads, opts):
     for store_index in range(2):
-        half_tile(asm, n_threads, store_index)
+        half_tile(asm, n_threads, opts, store_index)
 
 @qpu
-def half_tile(asm, n_threads, store_index, increment_address=True):
+def half_tile(asm, n_threads, opts, store_index, store=True):
     si = store_index
     wi = 1 - store_index
     for t in range(4):
-        label = 's{}t{}i{}'.format(si,t,increment_address)
+        label = 's{}t{}'.format(si,t)
 
-        # wait yuvx from tmu1
-        nop(sig='load tmu1')
+        tmu = t % 2
+
+        # wait yuvx from tmu0 (even step) or tmu1 (odd step)
+        nop(sig='load tmu{}'.format(tmu))
         # move yuvx to A-reg to unpack
         mov(ra15, r4)
-        # write remap addr to tmu0_s
-        mov(tmu0_s, ra3)
 
-        fmul(r0, ra15.unpack('8a'), 1.0) # Y
-        mov(ra10, r0).fmul(r0, ra15.unpack('8b'), 1.0) # U
-        mov(r2, r0).fmul(r0, ra15.unpack('8c'), 1.0) # V
-        iadd(ra3, ra3, rb9).mov(r3, r0) # increment remap addr
-
-        mov(r0, ra11)
-        mov(r1, ra12)
-        for f in range(8):
-            # set flag f+8*(t%2)
-            ldi(null, mask(f+8*(t%2)), set_flags=True)
-            rotate(r0, r2, 16-(f+8*(t%2)), cond='zs')
-            rotate(r1, r3, 16-(f+8*(t%2)), cond='zs')
-
-        # receive coord from tmu0
-        nop(sig='load tmu0').mov(ra11, r0)
-        # move coord to A-reg to unpack
-        mov(ra9, r4)
+        if opts.gain_map:
+            # wait gain words and shift the gain byte of each element down
+            nop(sig='load tmu{}'.format(tmu))
+            shr(ra28, r4, ra22)
+
+        if opts.blend:
+            # wait second yuvx
+            nop(sig='load tmu{}'.format(tmu))
+            mov(ra19, r4)
+            # wait blend weight words and shift the weight byte of each element down
+            nop(sig='load tmu{}'.format(tmu))
+            shr(ra28, r4, ra22)
+            # wait second coord of the step after next
+            nop(sig='load tmu{}'.format(tmu))
+            mov(ra31, r4)
+
+        # wait map, slot tmu has the coord of the step after next
+        wait_map(asm, n_threads, tmu)
 
-        # set uniform_address to texture config base address
-        mov(uniforms_address, ra2) # uniforms can be read after 2 instructions
+        fmul(r0, ra15.unpack('8a'), 1.0) # Y
+        if opts.gain_map:
+            fmul(r1, ra28.unpack('8a'), rb18) # gain
+            fmul(r0, r0, r1) # Y *= gain
+        if opts.luma_only:
+            mov(ra10, r0)
+            if not opts.gain_map:
+                # vpm can be read 3 instructions after the read setup
+                nop()
+        else:
+            mov(ra10, r0).fmul(r0, ra15.unpack('8b'), 1.0) # U
+            mov(r2, r0).fmul(r0, ra15.unpack('8c'), 1.0) # V
+            mov(r3, r0)
+
+        if opts.blend:
+            blend(asm)
+
+        # read coord from vpm
+        mov(ra9, vpm)
+        sema_up(MAP_FREE + tmu)
+
+        # load map of 2 steps after the coord to slot tmu
+        if opts.stereo:
+            stereo_entry(asm, 3)
+        load_map(asm, n_threads, tmu, opts)
+        next_map_owner(asm, n_threads)
+        if opts.stereo:
+            stereo_offsets(asm)
+
+        if opts.color_matrix:
+            color_matrix(asm)
+
+        if not opts.luma_only:
+            mov(r0, ra11)
+            mov(r1, ra12)
+            for f in range(8):
+                # set flag f+8*(t%2)
+                ldi(null, mask(f+8*(t%2)), set_flags=True)
+                rotate(r0, r2, 16-(f+8*(t%2)), cond='zs')
+                rotate(r1, r3, 16-(f+8*(t%2)), cond='zs')
+
+            mov(ra11, r0)
+
+        set_texture_config(asm, opts)
 
         itof(r3, ra9.unpack('16b')) # t coord
         itof(r2, ra9.unpack('16a')) # s coord
+        if opts.stereo:
+            add_stereo_offsets(asm)
 
         ldi(r0, wi*n_threads*4 + t)
         iadd(vpmvcd_wr_setup, ra16, r0)
 
-        mov(ra12, r1).fmul(r3, r3, ra18) # t/=65535
-        fadd(tmu1_t, r3, 0.5).fmul(r2, r2, ra18) # t+=0.5, s/=65535
-        fadd(tmu1_s, r2, 0.5) # s+=0.5
-
-        # pack y to vpm
-        fmul(vpm, ra10, 1.0, pack='8a') # pack y
+        if opts.luma_only:
+            fmul(r3, r3, ra18) # t/=65535
+        else:
+            mov(ra12, r1).fmul(r3, r3, ra18) # t/=65535
+        fetch_texture(asm, tmu, opts)
 
-        if t % 2 == 1:
-            ldi(r2, wi*2 + t//2)
-            iadd(vpmvcd_wr_setup, ra17, r2)
-            # pack u to vpm
-            fmul(vpm, ra11, 1.0, pack='8a') # pack u
-            # pack v to vpm
-            fmul(vpm, ra12, 1.0, pack='8a') # pack v
+        if opts.gain_map:
+            fetch_gain(asm, tmu)
 
-        if t == 0:
-            # if main thread
-            mov(null, ra1, set_flags=True)  # thread index
-            jzc(L[label])
-            nop(); nop(); nop()
+        if opts.blend:
+            fetch_blend(asm, tmu, opts)
 
-            # wait store
+        if store and t == 0:
+            # the store of y(wi) issued in the previous half tile must be
+            # finished before this thread overwrites it
+            mutex_acquire()
             wait_dma_store()
 
-            # setup dma store stride for y(si:0-3)
-            setup_dma_store_stride(rb14)
-            # setup dma store y(si,0:3)
-            setup_dma_store(mode='32bit horizontal', nrows=n_threads, ncols=16, Y=si*12)
-            # start store y(si,0:3)
+            # store y(si) of this thread
+            ldi(r0, (si*VPM_Y_SLOT_ROWS) << 7)
+            iadd(vpmvcd_wr_setup, rb16, r0)
             start_dma_store(ra4)
 
-            if increment_address:
-                # increment y address
-                iadd(ra4, ra4, rb10) # += 64
+            mutex_release()
 
-            # endif
-            L[label]
-        elif t == 1:
-            # if main thread
-            mov(null, ra1, set_flags=True)  # thread index
+            # increment y address
+            iadd(ra4, ra4, rb10) # += 64
+        elif store and t in (1, 2) and not opts.luma_only:
+            # if even thread
+            mov(null, ra0, set_flags=True) # odd thread flag
             jzc(L[label])
             nop(); nop(); nop()
 
-            # wait store
+            mutex_acquire()
             wait_dma_store()
 
-            # setup dma store stride for u(si:0-3)
-            setup_dma_store_stride(rb15)
-            # setup dma store u(si,0:3)
-            setup_dma_store(mode='32bit horizontal', nrows=n_threads//2, ncols=8, X=si*8, Y=24)
-            # start store u(si,0:3)
-            start_dma_store(ra5)
+            # store u(si) or v(si) of this thread pair
+            ldi(r0, (si*VPM_UV_SLOT_ROWS) << 7 | (t-1)*8 << 3)
+            iadd(vpmvcd_wr_setup, rb17, r0)
+            if t == 1:
+                start_dma_store(ra5)
+            else:
+                start_dma_store(ra6)
+
+            mutex_release()
 
-            if increment_address:
+            if t == 1:
                 # increment u address
                 iadd(ra5, ra5, rb11) # += 32
+            else:
+                # increment v address
+                iadd(ra6, ra6, rb11) # += 32
 
             # endif
             L[label]
-        elif t == 2:
-            # if main thread
-            mov(null, ra1, set_flags=True)  # thread index
-            jzc(L[label])
-            nop(); nop(); nop()
 
-            # wait store
-            wait_dma_store()
+        # pack y to vpm
+        fmul(vpm, ra10, 1.0, pack='8a') # pack y
 
-            # setup dma store stride for v(si:0-3)
-            setup_dma_store_stride(rb15)
-            # setup dma store v(si,0:3)
-            setup_dma_store(mode='32bit horizontal', nrows=n_threads//2, ncols=8, X=si*8, Y=30)
-            # start store v(si,0:3)
-            start_dma_store(ra6)
+        if t % 2 == 1 and not opts.luma_only:
+            ldi(r2, t//2)
+            if wi == 1:
+                iadd(r2, r2, rb19) # vpm write uv slot offset
+            iadd(vpmvcd_wr_setup, ra17, r2)
+            # pack u to vpm
+            fmul(vpm, ra11, 1.0, pack='8a') # pack u
+            # pack v to vpm
+            fmul(vpm, ra12, 1.0, pack='8a') # pack v
 
-            if increment_address:
-                # increment v address
-                iadd(ra6, ra6, rb11) # += 32
+    # end of t loop
 
-            # endif
-            L[label]
-        elif t == 3:
-            sema_up(HALF_TILE_SYNC_PRE)
+# downsample kernel of the mip variants
+#
+# Generates the half and quarter size levels of the source in a launch before
+# the remap kernel.  Each lane makes a pair of level texels (Y U Y V) per step,
+# 32 texels of a level row for all 16 lanes.  A bilinear lookup at the corner
+# of 4 source texels returns their 2x2 box filter, so a half size texel takes
+# one lookup and a quarter size texel the average of 4.
+#
+# u0 : uniform base address
+# u1 : texture config 0
+# u2 : texture config 1
+# u3 : texture config 2
+# u4 : texture config 3
+# u5 : qpu id
+# u6 : vpm write level config
+# u7 : dma store level config
+# u8-u19 : half size level (see downsample_level)
+# u20-u31: quarter size level
+#
+# ra0 : texture config uniform base address
+# ra1 : thread index
+# ra2 : t coord of the row
+# ra3 : level address (step)
+# ra4 : level address (row)
+# ra5 : row count
+# ra6 : step count
+# ra7 : yuvx register
+# ra8 : y sum of the first texel
+# ra9 : y sum of the second texel
+# ra10: u sum
+# ra11: v sum
+# ra12: s coord of the first texel
+# ra13: s coord of the second texel
+#
+# rb0 : s coord of the first step
+# rb1 : s offset of the second texel
+# rb2 : s increment (step)
+# rb3 : s offset of the second tap
+# rb4 : t increment (row)
+# rb5 : t offset of the second tap
+# rb6 : level address increment (row)
+# rb7 : step count of a row
+# rb8 : vpm write level setup register
+# rb9 : dma store level setup register
+
+# first uniform of each level of the downsample kernel
+DOWNSAMPLE_LEVEL_UNIFORMS = [8, 20]
+
+def vpm_write_level_config(thread):
+    stride = 1 # Y += 1
+    size = 2 # 32-bit
+    laned = 0 # packed
+    horizontal = 1 # horizontal
+    Y = thread
+    return (stride<<12|horizontal<<11|laned<<10|size<<8|Y)
 
-            # if main thread
-            mov(null, ra1, set_flags=True)  # thread index
-            jzc(L[label])
-            nop(); nop(); nop()
+def dma_store_level_config(thread):
+    return dma_store_config(1, 16, thread, 0)
 
-            for i in range(n_threads):
-                sema_down(HALF_TILE_SYNC_PRE)
-            for i in range(n_threads):
-                sema_up(HALF_TILE_SYNC_POST)
+@qpu
+def downsample(asm, n_threads):
+    # tmu0 and tmu1 take even and odd lookups
+    mov(tmu_noswap, 1)
 
-            # endif
-            L[label]
+    # texture config uniforms base address
+    iadd(ra0, uniform, 4)
 
-            sema_down(HALF_TILE_SYNC_POST)
+    # texture config 0-3 (discard here)
+    mov(null, uniform)
+    mov(null, uniform)
+    mov(null, uniform)
+    mov(null, uniform)
 
-    # end of t loop
+    # thread index
+    mov(ra1, uniform)
 
-if __name__ == '__main__':
-    if len(sys.argv) != 2:
-        print('invalid argument')
-        sys.exit(1)
+    # vpm write level setup register
+    mov(rb8, uniform)
+
+    # dma store level setup register
+    mov(rb9, uniform)
+
+    for level in range(1, len(DOWNSAMPLE_LEVEL_UNIFORMS) + 1):
+        downsample_level(asm, level)
+
+    wait_dma_store()
+
+    sema_up(COMPLETED)
+
+    # if main thread
+    mov(null, ra1, set_flags=True) # thread index
+    jzc(L.end)
+    nop(); nop(); nop()
+
+    for i in range(n_threads):
+        sema_down(COMPLETED)
+
+    interrupt()
+
+    # endif
+    L.end
+
+    nop()
+    nop()
+    nop()
+
+    # Finish the thread
+    exit(interrupt=False)
+
+@qpu
+def downsample_level(asm, level):
+    # the rows of a level are taken by the QPUs in turn, the host gives each
+    # one its first row and row count
+    #
+    # +0 : s coord of the first tap of the first texel of lane 0 (float)
+    # +1 : s increment (lane)
+    # +2 : s offset of the second texel
+    # +3 : s increment (step)
+    # +4 : s offset of the second tap
+    # +5 : t coord of the first tap of the first row
+    # +6 : t increment (row)
+    # +7 : t offset of the second tap
+    # +8 : level address of the first row
+    # +9 : level address increment (row)
+    # +10: row count, 0 if the level is not used
+    # +11: step count of a row
+    taps = 1 << (level - 1) # per direction
+    lookups = [(k, a, b) for k in range(2) for b in range(taps) for a in range(taps)]
+    first = 'level{}'.format(level)
+
+    ldi(r0, (DOWNSAMPLE_LEVEL_UNIFORMS[level - 1] - 1) * 4)
+    iadd(uniforms_address, ra0, r0)
+    nop(); nop()
+
+    # s coord of the first step of each lane
+    mov(r1, uniform)
+    itof(r0, element_number)
+    fmul(r0, r0, uniform)
+    fadd(rb0, r0, r1)
+
+    mov(rb1, uniform)
+    mov(rb2, uniform)
+    mov(rb3, uniform)
+    mov(ra2, uniform)
+    mov(rb4, uniform)
+    mov(rb5, uniform)
+    mov(ra4, uniform)
+    mov(rb6, uniform)
+    mov(ra5, uniform, set_flags=True)
+    mov(rb7, uniform)
+    jzs(L[first + '_end'])
+    nop(); nop(); nop()
+
+    L[first + '_row']
+
+    mov(ra12, rb0)
+    mov(ra3, ra4)
+    mov(ra6, rb7)
+
+    L[first + '_step']
+
+    fadd(ra13, ra12, rb1)
+
+    for i in range(min(2, len(lookups))):
+        downsample_fetch(asm, i % 2, lookups[i])
+
+    for i, (k, a, b) in enumerate(lookups):
+        tmu = i % 2
+        nop(sig='load tmu{}'.format(tmu))
+        # move yuvx to A-reg to unpack
+        mov(ra7, r4)
+
+        # keep at most 2 lookups in flight on each tmu
+        if i + 2 < len(lookups):
+            downsample_fetch(asm, tmu, lookups[i + 2])
+        else:
+            nop()
+
+        y_sum = ra9 if k else ra8
+        fmul(r0, ra7.unpack('8a'), 1.0) # Y
+        if a == 0 and b == 0:
+            mov(y_sum, r0)
+        else:
+            fadd(y_sum, y_sum, r0)
+        fmul(r0, ra7.unpack('8b'), 1.0) # U
+        if i == 0:
+            mov(ra10, r0)
+        else:
+            fadd(ra10, ra10, r0)
+        fmul(r0, ra7.unpack('8c'), 1.0) # V
+        if i == 0:
+            mov(ra11, r0)
+        else:
+            fadd(ra11, ra11, r0)
+
+    # pack Y0 U Y1 V of the texel pair, rounded to 8 bits
+    ldi(r1, float_bits(255.0 / (taps * taps)))
+    fmul(r0, ra8, r1)
+    fadd(r0, r0, 0.5)
+    ftoi(r2, r0) # Y0
+    fmul(r0, ra9, r1)
+    fadd(r0, r0, 0.5)
+    ftoi(r0, r0)
+    ldi(r3, 16)
+    shl(r0, r0, r3)
+    bor(r2, r2, r0) # Y1
+    ldi(r1, float_bits(255.0 / (2 * taps * taps)))
+    fmul(r0, ra10, r1)
+    fadd(r0, r0, 0.5)
+    ftoi(r0, r0)
+    shl(r0, r0, 8)
+    bor(r2, r2, r0) # U
+    fmul(r0, ra11, r1)
+    fadd(r0, r0, 0.5)
+    ftoi(r0, r0)
+    ldi(r3, 24)
+    shl(r0, r0, r3)
+    bor(r2, r2, r0) # V
+
+    # the store of the previous step must be finished before this thread
+    # overwrites its vpm row
+    mutex_acquire()
+    wait_dma_store()
+    mov(vpmvcd_wr_setup, rb8)
+    nop()
+    mov(vpm, r2)
+    mov(vpmvcd_wr_setup, rb9)
+    start_dma_store(ra3)
+    mutex_release()
+
+    # next step
+    ldi(r0, 64)
+    iadd(ra3, ra3, r0)
+    fadd(ra12, ra12, rb2)
+    isub(ra6, ra6, 1, set_flags=True)
+    jzc(L[first + '_step'])
+    nop(); nop(); nop()
+
+    # next row
+    fadd(ra2, ra2, rb4)
+    iadd(ra4, ra4, rb6)
+    isub(ra5, ra5, 1, set_flags=True)
+    jzc(L[first + '_row'])
+    nop(); nop(); nop()
+
+    L[first + '_end']
+
+@qpu
+def downsample_fetch(asm, tmu, lookup):
+    # in: s coords (ra12, ra13), t coord (ra2)
+    k, a, b = lookup
+    s = ra13 if k else ra12
+
+    # set uniform_address to texture config base address
+    mov(uniforms_address, ra0) # uniforms can be read after 2 instructions
+    nop()
+    tmu_t = tmu1_t if tmu else tmu0_t
+    tmu_s = tmu1_s if tmu else tmu0_s
+    if b:
+        fadd(tmu_t, ra2, rb5)
     else:
-        output_filepath = sys.argv[1]
-        n_threads = 12
+        mov(tmu_t, ra2)
+    if a:
+        fadd(tmu_s, s, rb3)
+    else:
+        mov(tmu_s, s)
 
-        with Driver() as drv:
-            program = drv.program(remap, n_threads)
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument("output", type=str, help="output filename")
+    parser.add_argument("--gain-map", action="store_true", help="multiply luma by a per-pixel gain map")
+    parser.add_argument("--color-matrix", action="store_true", help="apply a 3x3 yuv color matrix with offsets")
+    parser.add_argument("--blend", action="store_true", help="blend a second sample per pixel by a weight map")
+    parser.add_argument("--transform", action="store_true", help="apply a per-frame homography to the map coordinates")
+    parser.add_argument("--luma-only", action="store_true", help="sample and store y only, the chroma planes are left untouched")
+    parser.add_argument("--mip", action="store_true", help="sample a half or quarter size source where a level table says so")
+    parser.add_argument("--stereo", action="store_true", help="read a compact stereo map through a table of step offsets")
+    parser.add_argument("--downsample", action="store_true", help="build the downsample kernel that generates the levels of --mip")
+    opts = parser.parse_args()
+
+    if opts.gain_map and opts.blend:
+        # the tmu fifo cannot hold the gain lookup on top of the blend lookups
+        parser.error("--gain-map cannot be combined with --blend")
+    if opts.luma_only and (opts.color_matrix or opts.blend):
+        # both mix chroma into luma
+        parser.error("--luma-only cannot be combined with --color-matrix or --blend")
+    if opts.mip and opts.transform:
+        # the levels are chosen for the map, not for the map moved by the homography
+        parser.error("--mip cannot be combined with --transform")
+
+    if opts.stereo and (opts.transform or opts.mip or opts.blend):
+        # they use the registers of the stereo table and offsets, and the
+        # blend map is not stereo
+        parser.error("--stereo cannot be combined with --transform, --mip or --blend")
+    if opts.downsample and any([opts.gain_map, opts.color_matrix, opts.blend, opts.transform, opts.luma_only, opts.mip, opts.stereo]):
+        parser.error("--downsample takes no other options")
+
+    n_threads = 12
+
+    # only the assembler is used, so the kernel can be built on any host
+    if opts.downsample:
+        code = assemble(downsample, n_threads)
+    else:
+        code = assemble(remap, n_threads, opts)
 
-            with open(output_filepath, "wb") as f:
-                f.write(program.code)
+    with open(opts.output, "wb") as f:
+        f.write(code)
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <interface/vcsm/user-vcsm.h>
+
+#include "blend.h"
+#include "map_util.h"
+
+// Pixels outside of the blocks get the coordinate of the first map and a zero
+// weight, so the second sample hits the texels the first one has already
+// brought into the TMU cache.
+bool blend_load_map(vcsm_util_buffer_t *coords, vcsm_util_buffer_t *weights, const vcsm_util_buffer_t *map, FILE *fp, int width, int height) {
+    bool result = false;
+    int header[3];
+    blend_block_t block;
+
+    if (fread(header, sizeof(int), 3, fp) != 3 || header[0] != width || header[1] != height) {
+        fprintf(stderr, "ERROR: blend map size does not match the map (%dx%d)\n", width, height);
+        return false;
+    }
+
+    uint32_t *dst_coords = (uint32_t *) vcsm_lock(coords->handle);
+    uint8_t *dst_weights = (uint8_t *) vcsm_lock(weights->handle);
+    const uint32_t *src = (const uint32_t *) vcsm_lock(map->handle);
+
+    memcpy(dst_coords, src, (size_t) width * height * sizeof(uint32_t));
+    memset(dst_weights, 0, (size_t) width * height);
+
+    for (int i = 0; i < header[2]; ++i) {
+        if (fread(&block, sizeof(block), 1, fp) != 1) {
+            fprintf(stderr, "ERROR: failed to read blend map file\n");
+            goto error;
+        }
+        if (block.x < 0 || block.x % MAP_STEP_WIDTH != 0 || block.x >= width || block.y < 0 || block.y >= height) {
+            fprintf(stderr, "ERROR: invalid blend block at (%d, %d)\n", block.x, block.y);
+            goto error;
+        }
+        const size_t index = map_index(block.x, block.y, width);
+        memcpy(dst_coords + index, block.coord, sizeof(block.coord));
+        memcpy(dst_weights + index, block.weight, sizeof(block.weight));
+    }
+    fprintf(stderr, "blend blocks: %d\n", header[2]);
+    result = true;
+
+error:
+    vcsm_unlock_ptr(map->usr_mem_ptr);
+    vcsm_unlock_ptr(weights->usr_mem_ptr);
+    vcsm_unlock_ptr(coords->usr_mem_ptr);
+    return result;
+}
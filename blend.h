@@ -0,0 +1,26 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vcsm_util.h"
+
+// The blend weight stores one byte per output pixel, 0 takes the first
+// sample only and BLEND_WEIGHT_ONE the second sample only.
+#define BLEND_WEIGHT_ONE 255
+
+// A blend map file has the same header as a map (width, height) and the
+// number of blocks, followed by the blocks of the overlap area.  Each block
+// covers MAP_STEP_WIDTH pixels of one row.
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t coord[16];   // second source coordinates, same encoding as the map
+    uint8_t weight[16];
+} blend_block_t;
+
+bool blend_load_map(vcsm_util_buffer_t *coords, vcsm_util_buffer_t *weights, const vcsm_util_buffer_t *map, FILE *fp, int width, int height);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <interface/vcsm/user-vcsm.h>
+
+#include "color.h"
+#include "map_util.h"
+
+bool color_parse_matrix(color_t *color, const char *arg) {
+    float values[12] = {0};
+    int n = 0;
+    const char *p = arg;
+    char *endptr;
+    while (n < 12) {
+        values[n++] = strtof(p, &endptr);
+        if (endptr == p)
+            return false;
+        if (*endptr == '\0')
+            break;
+        if (*endptr != ',')
+            return false;
+        p = endptr + 1;
+    }
+    // no values after the 12th
+    if (*endptr != '\0')
+        return false;
+    if (n != 9 && n != 12)
+        return false;
+
+    memcpy(color->matrix, values, sizeof(color->matrix));
+    memcpy(color->offset, values + 9, sizeof(color->offset));
+    color->matrix_enabled = true;
+    return true;
+}
+
+// Folds the chroma bias into the offsets, so that the matrix can be applied
+// to y, u, v in [0, 1] as they come out of the texture unit.
+void color_matrix_for_unorm(const color_t *color, float matrix[9], float offset[3]) {
+    memcpy(matrix, color->matrix, sizeof(color->matrix));
+    for (int i = 0; i < 3; ++i) {
+        offset[i] = color->offset[i] - 0.5f * (color->matrix[i*3+1] + color->matrix[i*3+2]);
+        if (i > 0)
+            offset[i] += 0.5f;
+    }
+}
+
+bool color_load_lut(color_t *color, const char *filename) {
+    bool result = false;
+    char line[256];
+    int size = 0;
+    int n = 0;
+    float *lut = NULL;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        float y, u, v;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+        if (sscanf(line, "LUT_3D_SIZE %d", &size) == 1) {
+            if (size < 2 || size > 65 || lut) {
+                fprintf(stderr, "ERROR: invalid LUT_3D_SIZE in %s\n", filename);
+                goto error;
+            }
+            lut = (float *) malloc(sizeof(float) * 3 * size * size * size);
+            continue;
+        }
+        if (sscanf(line, "%f %f %f", &y, &u, &v) != 3)
+            continue; // TITLE, DOMAIN_MIN, DOMAIN_MAX, ...
+        if (!lut || n >= size * size * size) {
+            fprintf(stderr, "ERROR: unexpected LUT entry in %s\n", filename);
+            goto error;
+        }
+        lut[n*3+0] = y;
+        lut[n*3+1] = u;
+        lut[n*3+2] = v;
+        n++;
+    }
+
+    if (!lut || n != size * size * size) {
+        fprintf(stderr, "ERROR: incomplete 3D LUT in %s\n", filename);
+        goto error;
+    }
+
+    color->lut_size = size;
+    color->lut = lut;
+    lut = NULL;
+    result = true;
+
+error:
+    free(lut);
+    fclose(fp);
+    return result;
+}
+
+void color_destroy(color_t *color) {
+    free(color->lut);
+    color->lut = NULL;
+    color->lut_size = 0;
+}
+
+// The file has the same header as a map (width, height) followed by one gain
+// byte per pixel in raster order.  It is stored in the map order so that the
+// kernel can fetch it along with the map.
+bool color_load_gain_map(vcsm_util_buffer_t *buffer, FILE *fp, int width, int height) {
+    bool result = false;
+    int header[2];
+    uint8_t *row = NULL;
+
+    if (fread(header, sizeof(int), 2, fp) != 2 || header[0] != width || header[1] != height) {
+        fprintf(stderr, "ERROR: gain map size does not match the map (%dx%d)\n", width, height);
+        return false;
+    }
+
+    row = (uint8_t *) malloc(width);
+    uint8_t *dst = (uint8_t *) vcsm_lock(buffer->handle);
+    for (int y = 0; y < height; ++y) {
+        if (fread(row, 1, width, fp) != (size_t) width) {
+            fprintf(stderr, "ERROR: failed to read gain map file\n");
+            goto error;
+        }
+        for (int x = 0; x < width; ++x) {
+            dst[map_index(x, y, width)] = row[x];
+        }
+    }
+    result = true;
+
+error:
+    vcsm_unlock_ptr(buffer->usr_mem_ptr);
+    free(row);
+    return result;
+}
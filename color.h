@@ -0,0 +1,30 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "vcsm_util.h"
+
+// The gain map stores one byte per output pixel, gain = value / GAIN_MAP_ONE.
+#define GAIN_MAP_ONE 64
+
+typedef struct {
+    // (y, u - 0.5, v - 0.5) -> matrix * (y, u - 0.5, v - 0.5) + offset
+    bool matrix_enabled;
+    float matrix[9];
+    float offset[3];
+
+    // lut_size^3 entries of (y, u, v), y is the fastest changing index
+    int lut_size;
+    float *lut;
+} color_t;
+
+bool color_parse_matrix(color_t *color, const char *arg);
+void color_matrix_for_unorm(const color_t *color, float matrix[9], float offset[3]);
+bool color_load_lut(color_t *color, const char *filename);
+void color_destroy(color_t *color);
+
+bool color_load_gain_map(vcsm_util_buffer_t *buffer, FILE *fp, int width, int height);
+
+#endif
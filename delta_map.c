@@ -0,0 +1,42 @@
+#include <stdio.h>
+
+#include "delta_map.h"
+
+// Reads the header that follows DELTA_MAP_MAGIC.
+bool delta_map_read_header(FILE *fp, delta_map_header_t *header) {
+    if (fread(header, sizeof(*header), 1, fp) != 1)
+        return false;
+    if (header->width <= 0 || header->height <= 0
+        || header->width % MAP_STEP_WIDTH != 0 || header->height % MAP_STEP_HEIGHT != 0
+        || header->num_blocks != (uint32_t) (header->width / MAP_STEP_WIDTH) * (header->height / MAP_STEP_HEIGHT)) {
+        fprintf(stderr, "ERROR: invalid delta map header\n");
+        return false;
+    }
+    return true;
+}
+
+// Size of the data that follows the header.
+size_t delta_map_data_size(const delta_map_header_t *header) {
+    return ((size_t) header->width + header->height) * sizeof(int16_t)
+        + header->num_blocks * sizeof(delta_map_block_t) + header->payload_size;
+}
+
+// Points delta into data, which holds delta_map_data_size() bytes, and checks
+// that every block lies within the payload.
+bool delta_map_init(delta_map_t *delta, const delta_map_header_t *header, const void *data) {
+    delta->header = *header;
+    delta->identity_s = (const int16_t *) data;
+    delta->identity_t = delta->identity_s + header->width;
+    delta->blocks = (const delta_map_block_t *) (delta->identity_t + header->height);
+    delta->payload = (const uint8_t *) (delta->blocks + header->num_blocks);
+
+    for (uint32_t i = 0; i < header->num_blocks; ++i) {
+        const delta_map_block_t *block = &delta->blocks[i];
+        const size_t size = DELTA_MAP_BLOCK_SIZE * ((block->flags & DELTA_MAP_FULL) ? sizeof(uint32_t) : 2);
+        if (block->offset % sizeof(uint32_t) != 0 || (size_t) block->offset + size > header->payload_size) {
+            fprintf(stderr, "ERROR: block %u of the delta map is out of range\n", i);
+            return false;
+        }
+    }
+    return true;
+}
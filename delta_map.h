@@ -0,0 +1,65 @@
+#ifndef DELTA_MAP_H
+#define DELTA_MAP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "map_util.h"
+
+// A delta map stores each entry as signed 8-bit s and t displacements from a
+// per-block base, on top of the identity mapping.  The blocks are the
+// MAP_STEP_WIDTH x MAP_STEP_HEIGHT steps of the map order.  Blocks whose
+// displacements do not fit keep their full entries.
+//
+// The file starts with DELTA_MAP_MAGIC and delta_map_header_t, followed by
+// the data: the identity s of every column and t of every row (int16), the
+// blocks, and the payload they point into.
+#define DELTA_MAP_MAGIC       0x41544c44 // "DLTA"
+#define DELTA_MAP_FULL        (1 << 0)
+#define DELTA_MAP_BLOCK_SIZE  (MAP_STEP_WIDTH * MAP_STEP_HEIGHT)
+
+typedef struct {
+    int32_t width;
+    int32_t height;
+    int32_t image_width;
+    int32_t image_height;
+    uint32_t num_blocks;
+    uint32_t payload_size;
+} delta_map_header_t;
+
+typedef struct {
+    int16_t base_s;
+    int16_t base_t;
+    uint8_t shift;          // of the s (low nibble) and t (high nibble) displacements
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t offset;        // into the payload: 2 bytes (s, t) or 4 bytes (full entry) per pixel
+} delta_map_block_t;
+
+typedef struct {
+    delta_map_header_t header;
+    const int16_t *identity_s;
+    const int16_t *identity_t;
+    const delta_map_block_t *blocks;
+    const uint8_t *payload;
+} delta_map_t;
+
+bool delta_map_read_header(FILE *fp, delta_map_header_t *header);
+size_t delta_map_data_size(const delta_map_header_t *header);
+bool delta_map_init(delta_map_t *delta, const delta_map_header_t *header, const void *data);
+
+// The entry of pixel (x, y), whose index in map order is i.
+static inline uint32_t delta_map_entry(const delta_map_t *delta, int x, int y, size_t i) {
+    const delta_map_block_t *block = &delta->blocks[i / DELTA_MAP_BLOCK_SIZE];
+    const size_t j = i % DELTA_MAP_BLOCK_SIZE;
+    if (block->flags & DELTA_MAP_FULL)
+        return ((const uint32_t *) (delta->payload + block->offset))[j];
+    const int8_t *d = (const int8_t *) (delta->payload + block->offset) + j * 2;
+    const int32_t s = delta->identity_s[x] + block->base_s + d[0] * (1 << (block->shift & 0xf));
+    const int32_t t = delta->identity_t[y] + block->base_t + d[1] * (1 << (block->shift >> 4));
+    return ((uint32_t) (uint16_t) clamp_entry(t) << 16) | (uint16_t) clamp_entry(s);
+}
+
+#endif
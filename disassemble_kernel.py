@@ -0,0 +1,332 @@
+import argparse
+import struct
+
+# VideoCore IV QPU disassembler and static cost report.
+# It only decodes the binary, so it runs on any host.
+
+SIGNALS = ['bkpt', '', 'thrsw', 'thrend', 'sbwait', 'sbdone', 'lthrsw', 'loadcv',
+           'loadc', 'ldcend', 'load tmu0', 'load tmu1', 'loadam', '', 'ldi', 'bra']
+
+ADD_OPS = {0: 'nop', 1: 'fadd', 2: 'fsub', 3: 'fmin', 4: 'fmax', 5: 'fminabs', 6: 'fmaxabs',
+           7: 'ftoi', 8: 'itof', 12: 'iadd', 13: 'isub', 14: 'shr', 15: 'asr', 16: 'ror',
+           17: 'shl', 18: 'imin', 19: 'imax', 20: 'band', 21: 'bor', 22: 'bxor', 23: 'bnot',
+           24: 'clz', 30: 'v8adds', 31: 'v8subs'}
+
+MUL_OPS = ['nop', 'fmul', 'imul24', 'v8muld', 'v8min', 'v8max', 'v8adds', 'v8subs']
+
+CONDS = ['never', '', 'zs', 'zc', 'ns', 'nc', 'cs', 'cc']
+
+BRANCH_CONDS = ['all_zs', 'all_zc', 'any_zs', 'any_zc', 'all_ns', 'all_nc', 'any_ns', 'any_nc',
+                'all_cs', 'all_cc', 'any_cs', 'any_cc', '?', '?', '?', 'always']
+
+UNPACKS = ['', '16a', '16b', '8d rep', '8a', '8b', '8c', '8d']
+
+PACKS = ['', '16a', '16b', '8888', '8a', '8b', '8c', '8d',
+         '32 sat', '16a sat', '16b sat', '8888 sat', '8a sat', '8b sat', '8c sat', '8d sat']
+
+# write addresses 32-63, (file A name, file B name)
+WRITE_REGS = {
+    32: ('r0', 'r0'), 33: ('r1', 'r1'), 34: ('r2', 'r2'), 35: ('r3', 'r3'),
+    36: ('tmu_noswap', 'tmu_noswap'), 37: ('r5quad', 'r5rep'), 38: ('host_interrupt', 'host_interrupt'),
+    39: ('null', 'null'), 40: ('uniforms_address', 'uniforms_address'),
+    48: ('vpm', 'vpm'), 49: ('vpmvcd_rd_setup', 'vpmvcd_wr_setup'),
+    50: ('vpm_ld_addr', 'vpm_st_addr'), 51: ('mutex_release', 'mutex_release'),
+    52: ('sfu_recip', 'sfu_recip'), 53: ('sfu_recipsqrt', 'sfu_recipsqrt'),
+    54: ('sfu_exp', 'sfu_exp'), 55: ('sfu_log', 'sfu_log'),
+    56: ('tmu0_s', 'tmu0_s'), 57: ('tmu0_t', 'tmu0_t'), 58: ('tmu0_r', 'tmu0_r'), 59: ('tmu0_b', 'tmu0_b'),
+    60: ('tmu1_s', 'tmu1_s'), 61: ('tmu1_t', 'tmu1_t'), 62: ('tmu1_r', 'tmu1_r'), 63: ('tmu1_b', 'tmu1_b'),
+}
+
+# read addresses 32-63, (file A name, file B name)
+READ_REGS = {
+    32: ('uniform', 'uniform'), 35: ('varying', 'varying'), 38: ('element_number', 'qpu_number'),
+    39: ('null', 'null'), 42: ('x_pixel_coord', 'y_pixel_coord'), 43: ('ms_flags', 'rev_flag'),
+    48: ('vpm', 'vpm'), 49: ('vpm_ld_busy', 'vpm_st_busy'), 50: ('vpm_ld_wait', 'vpm_st_wait'),
+    51: ('mutex_acquire', 'mutex_acquire'),
+}
+
+
+def bits(word, hi, lo):
+    return (word >> lo) & ((1 << (hi - lo + 1)) - 1)
+
+
+def write_name(addr, file_b):
+    if addr < 32:
+        return '{}{}'.format('rb' if file_b else 'ra', addr)
+    return WRITE_REGS.get(addr, ('w{}'.format(addr),) * 2)[file_b]
+
+
+def read_name(addr, file_b):
+    if addr < 32:
+        return '{}{}'.format('rb' if file_b else 'ra', addr)
+    return READ_REGS.get(addr, ('r{}'.format(addr),) * 2)[file_b]
+
+
+def small_immediate(value):
+    if value < 16:
+        return str(value)
+    if value < 32:
+        return str(value - 32)
+    if value < 40:
+        return '{:.1f}'.format(float(1 << (value - 32)))
+    if value < 48:
+        return '1/{}'.format(1 << (48 - value))
+    return None
+
+
+class Instruction(object):
+    def __init__(self, index, word):
+        self.index = index
+        self.word = word
+        self.sig = bits(word, 63, 60)
+        self.reads = []
+        self.writes = []
+        self.target = None
+        self.text = self.decode()
+
+    def decode(self):
+        w = self.word
+        sig = self.sig
+        ws = bits(w, 44, 44)
+        waddr_add = bits(w, 43, 38)
+        waddr_mul = bits(w, 37, 32)
+        sf = bits(w, 45, 45)
+
+        if sig == 15:
+            # branch
+            cond = BRANCH_CONDS[bits(w, 55, 52)]
+            rel = bits(w, 51, 51)
+            imm = struct.unpack('<i', struct.pack('<I', bits(w, 31, 0)))[0]
+            if rel:
+                # relative to the instruction after the 3 delay slots
+                self.target = self.index + 4 + imm // 8
+            else:
+                self.target = None
+            dst = [write_name(waddr_add, ws), write_name(waddr_mul, not ws)]
+            self.writes = [d for d in dst if d != 'null']
+            return 'bra.{} {}'.format(cond, 'L{}'.format(self.target) if self.target is not None else hex(imm))
+
+        cond_add = bits(w, 51, 49)
+        cond_mul = bits(w, 48, 46)
+        pack = bits(w, 55, 52)
+        suffix = '.sf' if sf else ''
+
+        if sig == 14:
+            if bits(w, 59, 57) == 4:
+                # semaphore
+                sem = bits(w, 3, 0)
+                op = 'sema_down' if bits(w, 4, 4) else 'sema_up'
+                return '{} {}'.format(op, sem)
+            imm = bits(w, 31, 0)
+            parts = []
+            for waddr, cond, file_b in ((waddr_add, cond_add, ws), (waddr_mul, cond_mul, not ws)):
+                if waddr == 39 or cond == 0:
+                    continue
+                dst = write_name(waddr, file_b)
+                self.writes.append(dst)
+                parts.append('ldi{}{} {}, {:#x}'.format(
+                    '.' + CONDS[cond] if CONDS[cond] else '', suffix, dst, imm))
+            return '; '.join(parts) if parts else 'ldi null, {:#x}'.format(imm)
+
+        raddr_a = bits(w, 23, 18)
+        raddr_b = bits(w, 17, 12)
+        op_add = bits(w, 28, 24)
+        op_mul = bits(w, 31, 29)
+        unpack = bits(w, 59, 57)
+        pm = bits(w, 56, 56)
+
+        def operand(mux, mul_alu):
+            if mux < 6:
+                name = 'r{}'.format(mux)
+            elif mux == 6:
+                name = read_name(raddr_a, False)
+                self.reads.append(name)
+                if unpack and not pm:
+                    name += '.unpack({})'.format(UNPACKS[unpack])
+            elif sig == 13:
+                imm = small_immediate(raddr_b)
+                name = imm if imm is not None else 'imm{}'.format(raddr_b)
+            else:
+                name = read_name(raddr_b, True)
+                self.reads.append(name)
+            if mux == 4 and unpack and pm:
+                name += '.unpack({})'.format(UNPACKS[unpack])
+            return name
+
+        parts = []
+        if op_add != 0 and cond_add != 0:
+            dst = write_name(waddr_add, ws)
+            self.writes.append(dst)
+            a = operand(bits(w, 11, 9), False)
+            b = operand(bits(w, 8, 6), False)
+            name = ADD_OPS.get(op_add, 'add{}'.format(op_add))
+            if not ws and not pm and pack:
+                dst += '.pack({})'.format(PACKS[pack])
+            if name in ('ftoi', 'itof', 'bnot', 'clz'):
+                args = '{}, {}'.format(dst, a)
+            elif name == 'bor' and bits(w, 11, 9) == bits(w, 8, 6):
+                # mov is encoded as bor with the same operands
+                name = 'mov'
+                args = '{}, {}'.format(dst, a)
+            else:
+                args = '{}, {}, {}'.format(dst, a, b)
+            parts.append('{}{}{} {}'.format(name, '.' + CONDS[cond_add] if CONDS[cond_add] else '', suffix, args))
+        if op_mul != 0 and cond_mul != 0:
+            dst = write_name(waddr_mul, not ws)
+            self.writes.append(dst)
+            a = operand(bits(w, 5, 3), True)
+            b = operand(bits(w, 2, 0), True)
+            if pm and pack:
+                dst += '.pack({})'.format(PACKS[pack])
+            rot = ''
+            if sig == 13 and raddr_b >= 48:
+                rot = ' rotate {}'.format('r5' if raddr_b == 48 else raddr_b - 48)
+            name = MUL_OPS[op_mul]
+            if name == 'v8min' and bits(w, 5, 3) == bits(w, 2, 0):
+                # mov on the mul ALU is encoded as v8min with the same operands
+                args = '{}, {}'.format(dst, a)
+                name = 'mov'
+            else:
+                args = '{}, {}, {}'.format(dst, a, b)
+            parts.append('{}{} {}{}'.format(
+                name, '.' + CONDS[cond_mul] if CONDS[cond_mul] else '', args, rot))
+        if not parts:
+            # reads without ALU operation still have side effects (e.g. waits)
+            for addr, file_b in ((raddr_a, False), (raddr_b, True)):
+                if file_b and sig == 13:
+                    continue
+                name = read_name(addr, file_b)
+                if name != 'null':
+                    self.reads.append(name)
+            parts.append('nop' + (' ' + ', '.join(self.reads) if self.reads else ''))
+        text = '; '.join(parts)
+        if SIGNALS[sig] and sig not in (13, 14, 15):
+            text += ' [{}]'.format(SIGNALS[sig])
+        return text
+
+
+def decode(code):
+    return [Instruction(i, word) for i, (word,) in enumerate(struct.iter_unpack('<Q', code))]
+
+
+def count_ops(insns):
+    counts = {
+        'instructions': len(insns),
+        'tmu requests': 0,
+        'tmu loads': 0,
+        'vpm reads': 0,
+        'vpm writes': 0,
+        'vpm setups': 0,
+        'dma starts': 0,
+        'dma waits': 0,
+        'mutex': 0,
+        'semaphore': 0,
+        'sfu': 0,
+        'branches': 0,
+        'nops': 0,
+    }
+    for insn in insns:
+        writes = insn.writes
+        # a register address is read once per instruction even if both operands use it
+        reads = list(set(insn.reads))
+        counts['tmu requests'] += sum(1 for w in writes if w in ('tmu0_s', 'tmu1_s'))
+        counts['tmu loads'] += insn.sig in (10, 11)
+        counts['vpm reads'] += reads.count('vpm')
+        counts['vpm writes'] += writes.count('vpm')
+        counts['vpm setups'] += sum(1 for w in writes if w in ('vpmvcd_rd_setup', 'vpmvcd_wr_setup'))
+        counts['dma starts'] += sum(1 for w in writes if w in ('vpm_ld_addr', 'vpm_st_addr'))
+        counts['dma waits'] += sum(1 for r in reads if r in ('vpm_ld_wait', 'vpm_st_wait'))
+        counts['mutex'] += reads.count('mutex_acquire')
+        counts['semaphore'] += insn.text.startswith('sema_')
+        counts['sfu'] += sum(1 for w in writes if w.startswith('sfu_'))
+        counts['branches'] += insn.sig == 15
+        counts['nops'] += insn.text == 'nop'
+    return counts
+
+
+def find_tile_loop(insns):
+    # the innermost backward branch around texture fetches encloses the tile
+    # loop, the delay loops of the doorbell poll fetch nothing
+    loops = [(insn.index - insn.target, insn.target, insn.index + 4) for insn in insns
+             if insn.sig == 15 and insn.target is not None and insn.target <= insn.index
+             and count_ops(insns[insn.target:insn.index + 4])['tmu requests'] > 0]
+    if not loops:
+        return None
+    _, begin, end = min(loops)
+    return begin, end
+
+
+def report(code, n_threads, tile_width, qpu_cycles_per_insn, tmu_cycles_per_request):
+    insns = decode(code)
+    total = count_ops(insns)
+    loop = find_tile_loop(insns)
+    tile = count_ops(insns[loop[0]:loop[1]]) if loop else None
+    result = {'total': total, 'tile': tile}
+    if tile:
+        # each QPU produces one row of tile_width pixels per tile, all QPUs run in parallel
+        pixels = tile_width * n_threads
+        alu = tile['instructions'] * qpu_cycles_per_insn / float(pixels)
+        # the 2 TMUs of each of the 3 slices are shared by its 4 QPUs
+        tmu = tile['tmu requests'] * tmu_cycles_per_request * n_threads / 6.0 / pixels
+        result['cycles per pixel'] = {'alu': alu, 'tmu': tmu, 'estimate': max(alu, tmu)}
+    return result
+
+
+def print_report(name, result, baseline=None, fp=None):
+    lines = ['{}:'.format(name)]
+
+    def row(label, value, base):
+        if base is None:
+            return '  {:<16} {:>10}'.format(label, value if isinstance(value, int) else '{:.3f}'.format(value))
+        delta = value - base
+        if isinstance(value, int):
+            return '  {:<16} {:>10} {:>+8}'.format(label, value, delta)
+        return '  {:<16} {:>10.3f} {:>+8.3f}'.format(label, value, delta)
+
+    for section in ('total', 'tile'):
+        if result.get(section) is None:
+            continue
+        lines.append(' {}{}'.format(section, ' (per tile, per QPU)' if section == 'tile' else ''))
+        for key, value in result[section].items():
+            base = baseline[section][key] if baseline and baseline.get(section) else None
+            lines.append(row(key, value, base))
+    if 'cycles per pixel' in result:
+        lines.append(' cycles per output pixel (static estimate, no stalls)')
+        for key, value in result['cycles per pixel'].items():
+            base = baseline['cycles per pixel'][key] if baseline and 'cycles per pixel' in baseline else None
+            lines.append(row(key, value, base))
+    print('\n'.join(lines), file=fp)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument("input", type=str, help="kernel binary")
+    parser.add_argument("--report", action="store_true", help="print the static cost report instead of the disassembly")
+    parser.add_argument("--compare", type=str, help="kernel binary to report the cost delta against")
+    parser.add_argument("--output", type=str, help="output filename (default: stdout)")
+    parser.add_argument("--threads", type=int, default=12, help="number of QPUs")
+    parser.add_argument("--tile-width", type=int, default=128, help="output pixels per QPU per tile")
+    parser.add_argument("--cycles-per-instruction", type=float, default=4.0, help="QPU cycles per instruction")
+    parser.add_argument("--cycles-per-tmu-request", type=float, default=4.0, help="TMU cycles per 16-element request")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        code = f.read()
+
+    fp = open(args.output, "w") if args.output else None
+    if args.report or args.compare:
+        params = (args.threads, args.tile_width, args.cycles_per_instruction, args.cycles_per_tmu_request)
+        baseline = None
+        if args.compare:
+            with open(args.compare, "rb") as f:
+                baseline = report(f.read(), *params)
+        print_report(args.input, report(code, *params), baseline, fp)
+    else:
+        insns = decode(code)
+        labels = set(insn.target for insn in insns if insn.target is not None)
+        for insn in insns:
+            if insn.index in labels:
+                print('L{}:'.format(insn.index), file=fp)
+            print('{:5d}: {:016x}  {}'.format(insn.index, insn.word, insn.text), file=fp)
+    if fp:
+        fp.close()
@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#include "governor.h"
+
+// the average remap time has to be over/under these fractions of the budget
+#define OVERRUN_RATIO     0.9
+#define HEADROOM_RATIO    0.6
+// for this many frames in a row
+#define OVERRUN_FRAMES    8
+#define HEADROOM_FRAMES   60
+#define MAX_RESTORE_FRAMES (HEADROOM_FRAMES * 16)
+// weight of the newest frame in the moving average
+#define AVERAGE_WEIGHT    0.125
+
+void governor_init(governor_t *governor, int framerate, bool has_fallback_map) {
+    governor->enabled = true;
+    governor->has_fallback_map = has_fallback_map;
+    governor->budget_ms = 1000.0 / framerate;
+    governor->average_ms = 0;
+    governor->level = GOVERNOR_FULL;
+    governor->over_frames = 0;
+    governor->under_frames = 0;
+    governor->restore_frames = HEADROOM_FRAMES;
+    governor->level_frames = 0;
+    governor->stepped_up = false;
+    governor->frame_count = 0;
+}
+
+// Called for every camera frame, drops every other frame at the half rate so
+// that the cadence stays steady.
+bool governor_skip_frame(governor_t *governor) {
+    ++governor->frame_count;
+    return governor->enabled && governor->level >= GOVERNOR_HALF_RATE && (governor->frame_count & 1);
+}
+
+static governor_level_t next_level(const governor_t *governor, governor_level_t level, int step) {
+    level += step;
+    if (level == GOVERNOR_FALLBACK_MAP && !governor->has_fallback_map)
+        level += step;
+    return level;
+}
+
+// Returns true if the level has changed.
+bool governor_update(governor_t *governor, double remap_ms) {
+    if (!governor->enabled)
+        return false;
+
+    if (governor->average_ms == 0)
+        governor->average_ms = remap_ms;
+    else
+        governor->average_ms += (remap_ms - governor->average_ms) * AVERAGE_WEIGHT;
+    ++governor->level_frames;
+
+    // the budget stays the full rate interval, the half rate only hides overruns
+    if (governor->average_ms > governor->budget_ms * OVERRUN_RATIO) {
+        ++governor->over_frames;
+        governor->under_frames = 0;
+    } else if (governor->average_ms < governor->budget_ms * HEADROOM_RATIO) {
+        ++governor->under_frames;
+        governor->over_frames = 0;
+    } else {
+        governor->over_frames = 0;
+        governor->under_frames = 0;
+    }
+
+    if (governor->over_frames >= OVERRUN_FRAMES && governor->level < GOVERNOR_HALF_RATE) {
+        // stepping up did not last, wait longer before the next try
+        if (governor->stepped_up && governor->level_frames < governor->restore_frames && governor->restore_frames < MAX_RESTORE_FRAMES)
+            governor->restore_frames *= 2;
+        governor->level = next_level(governor, governor->level, 1);
+        governor->stepped_up = false;
+    } else if (governor->under_frames >= governor->restore_frames && governor->level > GOVERNOR_FULL) {
+        governor->level = next_level(governor, governor->level, -1);
+        governor->stepped_up = true;
+    } else {
+        return false;
+    }
+
+    governor->over_frames = 0;
+    governor->under_frames = 0;
+    governor->level_frames = 0;
+    return true;
+}
+
+const char *governor_level_name(governor_level_t level) {
+    static const char *names[] = {"full", "nearest", "fallback map", "half rate"};
+    return names[level];
+}
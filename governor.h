@@ -0,0 +1,38 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+
+// Quality levels, from the best to the cheapest.  Each level keeps the
+// savings of the levels before it.
+typedef enum {
+    GOVERNOR_FULL,          // bilinear sampling of the map
+    GOVERNOR_NEAREST,       // nearest sampling
+    GOVERNOR_FALLBACK_MAP,  // the cheaper pre-generated map (if given)
+    GOVERNOR_HALF_RATE,     // every other frame is dropped
+    GOVERNOR_NUM_LEVELS,
+} governor_level_t;
+
+// Measures the remap time of every frame against the frame interval and
+// steps the quality down on sustained overruns and back up when there is
+// headroom again.
+typedef struct {
+    bool enabled;
+    bool has_fallback_map;
+    double budget_ms;           // frame interval at the full rate
+    double average_ms;          // moving average of the remap time
+    governor_level_t level;
+    unsigned int over_frames;
+    unsigned int under_frames;
+    unsigned int restore_frames; // frames of headroom needed to step up
+    unsigned int level_frames;   // frames since the last change
+    bool stepped_up;             // the last change was a step up
+    unsigned int frame_count;
+} governor_t;
+
+void governor_init(governor_t *governor, int framerate, bool has_fallback_map);
+bool governor_skip_frame(governor_t *governor);
+bool governor_update(governor_t *governor, double remap_ms);
+const char *governor_level_name(governor_level_t level);
+
+#endif
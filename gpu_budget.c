@@ -0,0 +1,41 @@
+#include <string.h>
+
+#include "gpu_budget.h"
+
+void gpu_budget_reset(gpu_budget_t *budget) {
+    memset(budget, 0, sizeof(*budget));
+}
+
+void gpu_budget_add(gpu_budget_t *budget, const char *name, int count, size_t size) {
+    if (budget->num_items == GPU_BUDGET_MAX_ITEMS || count == 0)
+        return;
+    gpu_budget_item_t *item = &budget->items[budget->num_items++];
+    item->name = name;
+    item->count = count;
+    item->size = (size + GPU_BUDGET_PAGE_SIZE - 1) / GPU_BUDGET_PAGE_SIZE * GPU_BUDGET_PAGE_SIZE;
+}
+
+size_t gpu_budget_total(const gpu_budget_t *budget) {
+    size_t total = 0;
+    for (int i = 0; i < budget->num_items; ++i)
+        total += budget->items[i].size * budget->items[i].count;
+    return total;
+}
+
+// One line per allocation and the total, compared with the limit unless it
+// is 0.
+void gpu_budget_print(FILE *fp, const gpu_budget_t *budget, size_t limit) {
+    fprintf(fp, "GPU memory:\n");
+    for (int i = 0; i < budget->num_items; ++i) {
+        const gpu_budget_item_t *item = &budget->items[i];
+        if (item->count > 1)
+            fprintf(fp, "  %s: %d x %.1f KB\n", item->name, item->count, item->size / 1024.0);
+        else
+            fprintf(fp, "  %s: %.1f KB\n", item->name, item->size / 1024.0);
+    }
+    const size_t total = gpu_budget_total(budget);
+    if (limit > 0)
+        fprintf(fp, "  total: %.1f MB of %.1f MB\n", total / 1048576.0, limit / 1048576.0);
+    else
+        fprintf(fp, "  total: %.1f MB\n", total / 1048576.0);
+}
@@ -0,0 +1,29 @@
+#ifndef GPU_BUDGET_H
+#define GPU_BUDGET_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define GPU_BUDGET_MAX_ITEMS 16
+// the relocatable heap of the firmware hands out whole pages
+#define GPU_BUDGET_PAGE_SIZE 4096
+
+typedef struct {
+    const char *name;
+    int count;
+    size_t size;            // of one buffer, rounded up to whole pages
+} gpu_budget_item_t;
+
+// The GPU memory that a configuration allocates, listed before anything is
+// allocated, so that it can be checked against the gpu_mem split.
+typedef struct {
+    gpu_budget_item_t items[GPU_BUDGET_MAX_ITEMS];
+    int num_items;
+} gpu_budget_t;
+
+void gpu_budget_reset(gpu_budget_t *budget);
+void gpu_budget_add(gpu_budget_t *budget, const char *name, int count, size_t size);
+size_t gpu_budget_total(const gpu_budget_t *budget);
+void gpu_budget_print(FILE *fp, const gpu_budget_t *budget, size_t limit);
+
+#endif
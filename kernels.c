@@ -0,0 +1,81 @@
+#include <stddef.h>
+
+#include "kernels.h"
+#include "kernel.h"
+#include "kernel_gain.h"
+#include "kernel_matrix.h"
+#include "kernel_gain_matrix.h"
+#include "kernel_blend.h"
+#include "kernel_blend_matrix.h"
+#include "kernel_transform.h"
+#include "kernel_gain_transform.h"
+#include "kernel_matrix_transform.h"
+#include "kernel_gain_matrix_transform.h"
+#include "kernel_blend_transform.h"
+#include "kernel_blend_matrix_transform.h"
+#include "kernel_luma.h"
+#include "kernel_gain_luma.h"
+#include "kernel_luma_transform.h"
+#include "kernel_gain_luma_transform.h"
+#include "kernel_mip.h"
+#include "kernel_gain_mip.h"
+#include "kernel_matrix_mip.h"
+#include "kernel_gain_matrix_mip.h"
+#include "kernel_blend_mip.h"
+#include "kernel_blend_matrix_mip.h"
+#include "kernel_luma_mip.h"
+#include "kernel_gain_luma_mip.h"
+#include "kernel_stereo.h"
+#include "kernel_gain_stereo.h"
+#include "kernel_matrix_stereo.h"
+#include "kernel_gain_matrix_stereo.h"
+#include "kernel_luma_stereo.h"
+#include "kernel_gain_luma_stereo.h"
+#include "kernel_downsample.h"
+
+static const kernel_t kernels[] = {
+    {0, kernel_bin, &kernel_bin_len},
+    {KERNEL_GAIN_MAP, kernel_gain_bin, &kernel_gain_bin_len},
+    {KERNEL_COLOR_MATRIX, kernel_matrix_bin, &kernel_matrix_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_COLOR_MATRIX, kernel_gain_matrix_bin, &kernel_gain_matrix_bin_len},
+    {KERNEL_BLEND, kernel_blend_bin, &kernel_blend_bin_len},
+    {KERNEL_BLEND | KERNEL_COLOR_MATRIX, kernel_blend_matrix_bin, &kernel_blend_matrix_bin_len},
+    {KERNEL_TRANSFORM, kernel_transform_bin, &kernel_transform_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_TRANSFORM, kernel_gain_transform_bin, &kernel_gain_transform_bin_len},
+    {KERNEL_COLOR_MATRIX | KERNEL_TRANSFORM, kernel_matrix_transform_bin, &kernel_matrix_transform_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_COLOR_MATRIX | KERNEL_TRANSFORM, kernel_gain_matrix_transform_bin, &kernel_gain_matrix_transform_bin_len},
+    {KERNEL_BLEND | KERNEL_TRANSFORM, kernel_blend_transform_bin, &kernel_blend_transform_bin_len},
+    {KERNEL_BLEND | KERNEL_COLOR_MATRIX | KERNEL_TRANSFORM, kernel_blend_matrix_transform_bin, &kernel_blend_matrix_transform_bin_len},
+    {KERNEL_LUMA_ONLY, kernel_luma_bin, &kernel_luma_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_LUMA_ONLY, kernel_gain_luma_bin, &kernel_gain_luma_bin_len},
+    {KERNEL_LUMA_ONLY | KERNEL_TRANSFORM, kernel_luma_transform_bin, &kernel_luma_transform_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_LUMA_ONLY | KERNEL_TRANSFORM, kernel_gain_luma_transform_bin, &kernel_gain_luma_transform_bin_len},
+    {KERNEL_MIP, kernel_mip_bin, &kernel_mip_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_MIP, kernel_gain_mip_bin, &kernel_gain_mip_bin_len},
+    {KERNEL_COLOR_MATRIX | KERNEL_MIP, kernel_matrix_mip_bin, &kernel_matrix_mip_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_COLOR_MATRIX | KERNEL_MIP, kernel_gain_matrix_mip_bin, &kernel_gain_matrix_mip_bin_len},
+    {KERNEL_BLEND | KERNEL_MIP, kernel_blend_mip_bin, &kernel_blend_mip_bin_len},
+    {KERNEL_BLEND | KERNEL_COLOR_MATRIX | KERNEL_MIP, kernel_blend_matrix_mip_bin, &kernel_blend_matrix_mip_bin_len},
+    {KERNEL_LUMA_ONLY | KERNEL_MIP, kernel_luma_mip_bin, &kernel_luma_mip_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_LUMA_ONLY | KERNEL_MIP, kernel_gain_luma_mip_bin, &kernel_gain_luma_mip_bin_len},
+    {KERNEL_STEREO, kernel_stereo_bin, &kernel_stereo_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_STEREO, kernel_gain_stereo_bin, &kernel_gain_stereo_bin_len},
+    {KERNEL_COLOR_MATRIX | KERNEL_STEREO, kernel_matrix_stereo_bin, &kernel_matrix_stereo_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_COLOR_MATRIX | KERNEL_STEREO, kernel_gain_matrix_stereo_bin, &kernel_gain_matrix_stereo_bin_len},
+    {KERNEL_LUMA_ONLY | KERNEL_STEREO, kernel_luma_stereo_bin, &kernel_luma_stereo_bin_len},
+    {KERNEL_GAIN_MAP | KERNEL_LUMA_ONLY | KERNEL_STEREO, kernel_gain_luma_stereo_bin, &kernel_gain_luma_stereo_bin_len},
+};
+
+const kernel_t *kernel_find(unsigned int features) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (kernels[i].features == features)
+            return &kernels[i];
+    }
+    return NULL;
+}
+
+static const kernel_t downsample = {0, kernel_downsample_bin, &kernel_downsample_bin_len};
+
+const kernel_t *kernel_downsample(void) {
+    return &downsample;
+}
@@ -0,0 +1,25 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// optional stages compiled into the kernel variants
+#define KERNEL_GAIN_MAP     (1 << 0)
+#define KERNEL_COLOR_MATRIX (1 << 1)
+#define KERNEL_BLEND        (1 << 2)
+#define KERNEL_TRANSFORM    (1 << 3)
+#define KERNEL_LUMA_ONLY    (1 << 4)
+#define KERNEL_MIP          (1 << 5)
+#define KERNEL_STEREO       (1 << 6)
+
+typedef struct {
+    unsigned int features;
+    unsigned char *code;
+    unsigned int *code_len;
+} kernel_t;
+
+// The variant with exactly these stages, NULL if there is none.
+const kernel_t *kernel_find(unsigned int features);
+
+// The kernel that generates the smaller source levels of the mip variants.
+const kernel_t *kernel_downsample(void);
+
+#endif
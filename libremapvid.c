@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <interface/vcsm/user-vcsm.h>
+
+#include "libremapvid.h"
+#include "vcsm_util.h"
+#include "mailbox.h"
+#include "color.h"
+#include "blend.h"
+#include "map_file.h"
+#include "kernels.h"
+#include "remap_cpu.h"
+#include "remap_qpu.h"
+
+struct remapvid_engine {
+    remapvid_backend_t backend;
+    unsigned int features;
+    remapvid_info_t info;
+    int mb;
+
+    vcsm_util_buffer_t map;
+    map_format_t map_format;
+    vcsm_util_buffer_t gain_map;
+    vcsm_util_buffer_t blend_map;
+    vcsm_util_buffer_t blend_weights;
+    color_t color;
+
+    remap_cpu_t cpu;
+    remap_qpu_t qpu;
+
+    remapvid_callback_t callback;
+    void *userdata;
+    remapvid_stats_t stats;
+    double total_ms;
+};
+
+static uint32_t next_pow2(uint32_t x) {
+    x--;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x + 1;
+}
+
+// Buffers that only the ARM reads are cached on the ARM side.
+static bool create_buffer(const remapvid_engine_t *engine, vcsm_util_buffer_t *buffer, size_t size) {
+    if (engine->backend == REMAPVID_BACKEND_CPU)
+        return vcsm_util_buffer_create_cached(buffer, size);
+    return vcsm_util_buffer_create(buffer, size);
+}
+
+static FILE *open_file(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+    return fp;
+}
+
+static bool load_maps(remapvid_engine_t *engine, const remapvid_config_t *config) {
+    bool result = false;
+    FILE *map_file = NULL, *gain_map_file = NULL, *blend_map_file = NULL;
+    remapvid_info_t *info = &engine->info;
+    const bool compact = engine->backend == REMAPVID_BACKEND_CPU;
+
+    map_file = open_file(config->map_filename);
+    if (!map_file)
+        goto error;
+    int header[4];
+    if (!map_file_read_header(map_file, header, &engine->map_format)) {
+        fprintf(stderr, "ERROR: failed to read map file\n");
+        goto error;
+    }
+    info->output_width = header[0];
+    info->output_height = header[1];
+    info->input_width = header[2];
+    info->input_height = header[3];
+
+    // the kernel would stream the expanded map, which defeats the delta map
+    if (engine->map_format.is_delta && !compact) {
+        fprintf(stderr, "ERROR: delta maps need the cpu backend\n");
+        goto error;
+    }
+
+    if (info->output_width % 128 != 0 || info->output_width > 1920) {
+        fprintf(stderr, "ERROR: map width must be multiple of 128 and below 1920\n");
+        goto error;
+    }
+    if (info->output_height % 12 != 0 || info->output_height > 1080) {
+        fprintf(stderr, "ERROR: map height must be multiple of 12 and below 1080\n");
+        goto error;
+    }
+
+    info->input_buffer_width = next_pow2(info->input_width);
+    info->input_buffer_height = info->input_height;
+    info->input_size = (size_t) info->input_buffer_width * info->input_buffer_height * 2;
+    info->output_buffer_width = info->output_width;
+    info->output_buffer_height = (info->output_height + 15) & ~15;
+    info->output_size = (size_t) info->output_buffer_width * info->output_buffer_height * 3 / 2;
+
+    size_t map_size = map_file_stored_size(&engine->map_format, info->output_width, info->output_height, compact);
+    if (!create_buffer(engine, &engine->map, map_size + MAP_PADDING)
+        || !map_file_load(&engine->map, map_file, &engine->map_format, info->output_width, info->output_height, compact))
+        goto error;
+
+    const size_t num_pixels = (size_t) info->output_width * info->output_height;
+    if (config->gain_map_filename) {
+        gain_map_file = open_file(config->gain_map_filename);
+        if (!gain_map_file
+            || !create_buffer(engine, &engine->gain_map, num_pixels + GAIN_MAP_PADDING)
+            || !color_load_gain_map(&engine->gain_map, gain_map_file, info->output_width, info->output_height))
+            goto error;
+    }
+
+    if (config->blend_map_filename) {
+        if (engine->map_format.is_stereo || engine->map_format.is_delta) {
+            fprintf(stderr, "ERROR: a blend map cannot be combined with a stereo or delta map\n");
+            goto error;
+        }
+        blend_map_file = open_file(config->blend_map_filename);
+        if (!blend_map_file
+            || !create_buffer(engine, &engine->blend_map, num_pixels * sizeof(unsigned int) + MAP_PADDING)
+            || !create_buffer(engine, &engine->blend_weights, num_pixels + GAIN_MAP_PADDING)
+            || !blend_load_map(&engine->blend_map, &engine->blend_weights, &engine->map, blend_map_file, info->output_width, info->output_height))
+            goto error;
+    }
+
+    result = true;
+
+error:
+    if (map_file)
+        fclose(map_file);
+    if (gain_map_file)
+        fclose(gain_map_file);
+    if (blend_map_file)
+        fclose(blend_map_file);
+    return result;
+}
+
+static bool setup_cpu(remapvid_engine_t *engine, bool nearest) {
+    remap_cpu_t *cpu = &engine->cpu;
+    const remapvid_info_t *info = &engine->info;
+
+    cpu->src_width = info->input_buffer_width;
+    cpu->src_height = info->input_buffer_height;
+    cpu->src_format = REMAP_CPU_YUYV;
+    cpu->dst_width = info->output_width;
+    cpu->dst_height = info->output_height;
+    cpu->dst_buffer_width = info->output_buffer_width;
+    cpu->dst_buffer_height = info->output_buffer_height;
+    cpu->map = (const uint32_t *) engine->map.usr_mem_ptr;
+    cpu->stereo = engine->map_format.is_stereo ? &engine->map_format.stereo : NULL;
+    cpu->delta = engine->map_format.is_delta ? &engine->map_format.delta : NULL;
+    if (engine->features & KERNEL_GAIN_MAP)
+        cpu->gain_map = (const uint8_t *) engine->gain_map.usr_mem_ptr;
+    if (engine->features & KERNEL_BLEND) {
+        cpu->blend_map = (const uint32_t *) engine->blend_map.usr_mem_ptr;
+        cpu->blend_weights = (const uint8_t *) engine->blend_weights.usr_mem_ptr;
+    }
+    cpu->color = &engine->color;
+    cpu->nearest = nearest;
+    cpu->luma_only = (engine->features & KERNEL_LUMA_ONLY) != 0;
+    remap_cpu_init(cpu);
+
+    vcsm_lock(engine->map.handle);
+    if (engine->features & KERNEL_BLEND) {
+        vcsm_lock(engine->blend_map.handle);
+        vcsm_lock(engine->blend_weights.handle);
+    }
+    bool result = remap_cpu_prepare(cpu);
+    if (engine->features & KERNEL_BLEND) {
+        vcsm_unlock_ptr(engine->blend_weights.usr_mem_ptr);
+        vcsm_unlock_ptr(engine->blend_map.usr_mem_ptr);
+    }
+    vcsm_unlock_ptr(engine->map.usr_mem_ptr);
+    return result;
+}
+
+static bool setup_qpu(remapvid_engine_t *engine, bool nearest) {
+    remap_qpu_t *qpu = &engine->qpu;
+    const remapvid_info_t *info = &engine->info;
+
+    const kernel_t *kernel = kernel_find(engine->features);
+    if (!kernel) {
+        fprintf(stderr, "ERROR: the qpu backend cannot combine a gain map and a blend map, or luma only with a color matrix and a blend map\n");
+        return false;
+    }
+    qpu->src_width = info->input_buffer_width;
+    qpu->src_height = info->input_buffer_height;
+    qpu->dst_width = info->output_width;
+    qpu->dst_height = info->output_height;
+    qpu->dst_buffer_width = info->output_buffer_width;
+    qpu->dst_buffer_height = info->output_buffer_height;
+    qpu->map = engine->map.vc_mem_addr;
+    qpu->gain_map = engine->gain_map.vc_mem_addr;
+    qpu->blend_map = engine->blend_map.vc_mem_addr;
+    qpu->blend_weights = engine->blend_weights.vc_mem_addr;
+    qpu->color = &engine->color;
+    qpu->nearest = nearest;
+    return remap_qpu_init(qpu, engine->mb, NUM_QPUS, kernel);
+}
+
+void remapvid_config_init(remapvid_config_t *config) {
+    memset(config, 0x0, sizeof(remapvid_config_t));
+    config->backend = REMAPVID_BACKEND_QPU;
+}
+
+remapvid_engine_t *remapvid_create(const remapvid_config_t *config) {
+    if (!config->map_filename) {
+        fprintf(stderr, "ERROR: no map file\n");
+        return NULL;
+    }
+    remapvid_engine_t *engine = calloc(1, sizeof(remapvid_engine_t));
+    if (!engine)
+        return NULL;
+    engine->backend = config->backend;
+    engine->mb = -1;
+
+    // the vcsm client is reference counted, every engine holds one reference
+    if (vcsm_init() != 0) {
+        fprintf(stderr, "ERROR: failed to initialize vcsm\n");
+        free(engine);
+        return NULL;
+    }
+    if (engine->backend == REMAPVID_BACKEND_QPU) {
+        engine->mb = mbox_open();
+        if (engine->mb < 0) {
+            fprintf(stderr, "ERROR: failed to open the mailbox\n");
+            goto error;
+        }
+    }
+
+    if (config->gain_map_filename)
+        engine->features |= KERNEL_GAIN_MAP;
+    if (config->blend_map_filename)
+        engine->features |= KERNEL_BLEND;
+    if (config->color_matrix) {
+        if (!color_parse_matrix(&engine->color, config->color_matrix))
+            goto error;
+        engine->features |= KERNEL_COLOR_MATRIX;
+    }
+    if (config->luma_only)
+        engine->features |= KERNEL_LUMA_ONLY;
+
+    if (!load_maps(engine, config))
+        goto error;
+
+    if (engine->backend == REMAPVID_BACKEND_CPU) {
+        if (!setup_cpu(engine, config->nearest))
+            goto error;
+    } else if (!setup_qpu(engine, config->nearest)) {
+        goto error;
+    }
+    return engine;
+
+error:
+    remapvid_destroy(engine);
+    return NULL;
+}
+
+void remapvid_destroy(remapvid_engine_t *engine) {
+    if (!engine)
+        return;
+    remap_cpu_destroy(&engine->cpu);
+    remap_qpu_destroy(&engine->qpu);
+    color_destroy(&engine->color);
+    vcsm_util_buffer_destroy(&engine->blend_weights);
+    vcsm_util_buffer_destroy(&engine->blend_map);
+    vcsm_util_buffer_destroy(&engine->gain_map);
+    vcsm_util_buffer_destroy(&engine->map);
+    if (engine->mb >= 0)
+        mbox_close(engine->mb);
+    vcsm_exit();
+    free(engine);
+}
+
+void remapvid_get_info(const remapvid_engine_t *engine, remapvid_info_t *info) {
+    *info = engine->info;
+}
+
+void remapvid_set_callback(remapvid_engine_t *engine, remapvid_callback_t callback, void *userdata) {
+    engine->callback = callback;
+    engine->userdata = userdata;
+}
+
+// Remaps one frame and calls the callback before returning.
+bool remapvid_submit(remapvid_engine_t *engine, const uint8_t *input, uint8_t *output, int64_t pts) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    bool success = true;
+    if (engine->backend == REMAPVID_BACKEND_CPU) {
+        vcsm_lock(engine->map.handle);
+        if (engine->features & KERNEL_GAIN_MAP)
+            vcsm_lock(engine->gain_map.handle);
+        if (engine->features & KERNEL_BLEND) {
+            vcsm_lock(engine->blend_map.handle);
+            vcsm_lock(engine->blend_weights.handle);
+        }
+        remap_cpu_process(&engine->cpu, input, output);
+        if (engine->features & KERNEL_BLEND) {
+            vcsm_unlock_ptr(engine->blend_weights.usr_mem_ptr);
+            vcsm_unlock_ptr(engine->blend_map.usr_mem_ptr);
+        }
+        if (engine->features & KERNEL_GAIN_MAP)
+            vcsm_unlock_ptr(engine->gain_map.usr_mem_ptr);
+        vcsm_unlock_ptr(engine->map.usr_mem_ptr);
+    } else {
+        success = remap_qpu_process(&engine->qpu, input, output);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    remapvid_stats_t *stats = &engine->stats;
+    if (success) {
+        stats->frames++;
+        stats->last_ms = ms;
+        if (ms > stats->max_ms)
+            stats->max_ms = ms;
+        engine->total_ms += ms;
+        stats->average_ms = engine->total_ms / stats->frames;
+    } else {
+        stats->failures++;
+    }
+
+    if (engine->callback)
+        engine->callback(engine, output, pts, success, engine->userdata);
+    return success;
+}
+
+void remapvid_get_stats(const remapvid_engine_t *engine, remapvid_stats_t *stats) {
+    *stats = engine->stats;
+}
+
+bool remapvid_buffer_alloc(remapvid_engine_t *engine, remapvid_buffer_t *buffer, size_t size) {
+    vcsm_util_buffer_t vcsm_buffer = {0};
+    memset(buffer, 0x0, sizeof(remapvid_buffer_t));
+    if (!create_buffer(engine, &vcsm_buffer, size))
+        return false;
+    // locked until remapvid_buffer_free(), the address is only valid while locked
+    buffer->data = vcsm_lock(vcsm_buffer.handle);
+    if (!buffer->data) {
+        fprintf(stderr, "ERROR: failed to lock frame buffer\n");
+        vcsm_util_buffer_destroy(&vcsm_buffer);
+        return false;
+    }
+    buffer->size = size;
+    buffer->handle = vcsm_buffer.handle;
+    return true;
+}
+
+void remapvid_buffer_free(remapvid_engine_t *engine, remapvid_buffer_t *buffer) {
+    (void) engine;
+    vcsm_util_buffer_t vcsm_buffer = {.handle = buffer->handle};
+    if (buffer->data)
+        vcsm_unlock_ptr(buffer->data);
+    vcsm_util_buffer_destroy(&vcsm_buffer);
+    buffer->data = NULL;
+    buffer->handle = 0;
+}
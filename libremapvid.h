@@ -0,0 +1,81 @@
+#ifndef LIBREMAPVID_H
+#define LIBREMAPVID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REMAPVID_API __attribute__((visibility("default")))
+
+// Remaps frames in the process of the caller.  An engine holds its own
+// mailbox, maps and kernel, so several engines can run side by side, each
+// used by one thread at a time.  Frames come in as YUYV and go out as I420,
+// in the layout that remapvid_get_info() reports.
+typedef struct remapvid_engine remapvid_engine_t;
+
+typedef enum {
+    REMAPVID_BACKEND_QPU,
+    REMAPVID_BACKEND_CPU,
+} remapvid_backend_t;
+
+typedef struct {
+    remapvid_backend_t backend;
+    const char *map_filename;
+    const char *gain_map_filename;  // NULL if disabled
+    const char *blend_map_filename; // NULL if disabled
+    const char *color_matrix;       // "m00,...,m22[,o0,o1,o2]" as --color-matrix, NULL if disabled
+    bool luma_only;                 // writes neutral chroma
+    bool nearest;                   // nearest instead of bilinear sampling
+} remapvid_config_t;
+
+typedef struct {
+    int input_width;                // of the camera frames the map was made for
+    int input_height;
+    int input_buffer_width;         // power of 2, 2 bytes per texel
+    int input_buffer_height;
+    size_t input_size;
+    int output_width;
+    int output_height;
+    int output_buffer_width;
+    int output_buffer_height;       // aligned to 16, the chroma planes follow the luma plane
+    size_t output_size;
+} remapvid_info_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t failures;
+    double last_ms;
+    double average_ms;
+    double max_ms;
+} remapvid_stats_t;
+
+// Frame memory that both backends can read and write.  The qpu backend only
+// accepts these buffers (or other GPU memory), the cpu backend any memory.
+typedef struct {
+    void *data;                     // stays locked and mapped until remapvid_buffer_free()
+    size_t size;
+    unsigned int handle;
+} remapvid_buffer_t;
+
+// Called with the output of every submitted frame.
+typedef void (*remapvid_callback_t)(remapvid_engine_t *engine, uint8_t *output, int64_t pts, bool success, void *userdata);
+
+REMAPVID_API void remapvid_config_init(remapvid_config_t *config);
+REMAPVID_API remapvid_engine_t *remapvid_create(const remapvid_config_t *config);
+REMAPVID_API void remapvid_destroy(remapvid_engine_t *engine);
+REMAPVID_API void remapvid_get_info(const remapvid_engine_t *engine, remapvid_info_t *info);
+REMAPVID_API void remapvid_set_callback(remapvid_engine_t *engine, remapvid_callback_t callback, void *userdata);
+REMAPVID_API bool remapvid_submit(remapvid_engine_t *engine, const uint8_t *input, uint8_t *output, int64_t pts);
+REMAPVID_API void remapvid_get_stats(const remapvid_engine_t *engine, remapvid_stats_t *stats);
+REMAPVID_API bool remapvid_buffer_alloc(remapvid_engine_t *engine, remapvid_buffer_t *buffer, size_t size);
+REMAPVID_API void remapvid_buffer_free(remapvid_engine_t *engine, remapvid_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
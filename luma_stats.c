@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "luma_stats.h"
+
+bool luma_stats_init(luma_stats_t *stats, int width, int height) {
+    memset(stats, 0, sizeof(*stats));
+    stats->width = width;
+    stats->height = height;
+    stats->region_x = (uint8_t *) malloc(width);
+    stats->region_y = (uint8_t *) malloc(height);
+    if (!stats->region_x || !stats->region_y) {
+        fprintf(stderr, "ERROR: failed to allocate luma statistics\n");
+        luma_stats_destroy(stats);
+        return false;
+    }
+    for (int x = 0; x < width; ++x)
+        stats->region_x[x] = (uint8_t) (x * LUMA_STATS_GRID / width);
+    for (int y = 0; y < height; ++y)
+        stats->region_y[y] = (uint8_t) (y * LUMA_STATS_GRID / height * LUMA_STATS_GRID);
+    return true;
+}
+
+void luma_stats_destroy(luma_stats_t *stats) {
+    free(stats->region_x);
+    free(stats->region_y);
+    stats->region_x = NULL;
+    stats->region_y = NULL;
+}
+
+void luma_stats_reset(luma_stats_t *stats) {
+    memset(stats->histogram, 0, sizeof(stats->histogram));
+    stats->below = 0;
+    stats->above = 0;
+    memset(stats->region_sum, 0, sizeof(stats->region_sum));
+    memset(stats->region_count, 0, sizeof(stats->region_count));
+}
+
+// One line per frame: the PTS, the mean luma, the number of samples below
+// and above the video range, the histogram and the mean luma of every region
+// (row major).
+bool luma_stats_write(FILE *fp, int64_t pts, const luma_stats_t *stats) {
+    uint64_t sum = 0, count = 0;
+    for (int i = 0; i < LUMA_STATS_GRID * LUMA_STATS_GRID; ++i) {
+        sum += stats->region_sum[i];
+        count += stats->region_count[i];
+    }
+    fprintf(fp, "%" PRId64 " %.2f %u %u", pts, count ? (double) sum / count : 0.0, stats->below, stats->above);
+    for (int i = 0; i < LUMA_STATS_BINS; ++i)
+        fprintf(fp, " %u", stats->histogram[i]);
+    for (int i = 0; i < LUMA_STATS_GRID * LUMA_STATS_GRID; ++i)
+        fprintf(fp, " %.1f", stats->region_count[i] ? (double) stats->region_sum[i] / stats->region_count[i] : 0.0);
+    fputc('\n', fp);
+    return fflush(fp) == 0;
+}
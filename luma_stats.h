@@ -0,0 +1,42 @@
+#ifndef LUMA_STATS_H
+#define LUMA_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LUMA_STATS_BINS   64
+#define LUMA_STATS_GRID   8     // regions per row and per column
+#define LUMA_STATS_MIN    16    // video range, samples outside of it are counted
+#define LUMA_STATS_MAX    235
+
+// Statistics of the output luma of one frame, which the cpu backend adds
+// every sample to while remapping.
+typedef struct {
+    uint32_t histogram[LUMA_STATS_BINS];
+    uint32_t below;
+    uint32_t above;
+    uint64_t region_sum[LUMA_STATS_GRID * LUMA_STATS_GRID];
+    uint32_t region_count[LUMA_STATS_GRID * LUMA_STATS_GRID];
+
+    int width;
+    int height;
+    uint8_t *region_x;      // region column of every output column
+    uint8_t *region_y;      // first region of every output row
+} luma_stats_t;
+
+bool luma_stats_init(luma_stats_t *stats, int width, int height);
+void luma_stats_destroy(luma_stats_t *stats);
+void luma_stats_reset(luma_stats_t *stats);
+bool luma_stats_write(FILE *fp, int64_t pts, const luma_stats_t *stats);
+
+static inline void luma_stats_add(luma_stats_t *stats, int x, int y, int luma) {
+    const int region = stats->region_y[y] + stats->region_x[x];
+    ++stats->histogram[luma * LUMA_STATS_BINS / 256];
+    stats->below += luma < LUMA_STATS_MIN;
+    stats->above += luma > LUMA_STATS_MAX;
+    stats->region_sum[region] += luma;
+    ++stats->region_count[region];
+}
+
+#endif
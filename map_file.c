@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <interface/vcsm/user-vcsm.h>
+
+#include "map_file.h"
+
+// Reads the header of a map file, which may be a stereo or a delta map:
+// map width, map height, image width, image height.
+bool map_file_read_header(FILE *fp, int header[4], map_format_t *format) {
+    int32_t magic;
+    format->is_stereo = false;
+    format->is_delta = false;
+    if (fread(&magic, sizeof(magic), 1, fp) != 1)
+        return false;
+    if (magic == DELTA_MAP_MAGIC) {
+        delta_map_header_t *delta = &format->delta.header;
+        if (!delta_map_read_header(fp, delta))
+            return false;
+        header[0] = delta->width;
+        header[1] = delta->height;
+        header[2] = delta->image_width;
+        header[3] = delta->image_height;
+        format->is_delta = true;
+        return true;
+    }
+    if (magic != STEREO_MAP_MAGIC) {
+        header[0] = magic;
+        return fread(header + 1, sizeof(int), 3, fp) == 3;
+    }
+    stereo_map_header_t *stereo = &format->stereo;
+    if (fread(stereo, sizeof(*stereo), 1, fp) != 1)
+        return false;
+    if (stereo->width % (2 * MAP_STEP_WIDTH) != 0) {
+        fprintf(stderr, "ERROR: the width of each eye of a stereo map must be a multiple of %d\n", MAP_STEP_WIDTH);
+        return false;
+    }
+    header[0] = stereo->width;
+    header[1] = stereo->height;
+    header[2] = stereo->image_width;
+    header[3] = stereo->image_height;
+    format->is_stereo = true;
+    return true;
+}
+
+// Size of a map as it is kept in memory.  Compact maps keep only the left eye
+// of a stereo map and the deltas of a delta map, which only the cpu backend
+// decodes.  Otherwise a stereo map is expanded to both eyes.
+size_t map_file_stored_size(const map_format_t *format, int width, int height, bool compact) {
+    const size_t map_size = (size_t) width * height * sizeof(unsigned int);
+    if (!compact)
+        return map_size;
+    if (format->is_delta)
+        return delta_map_data_size(&format->delta.header);
+    return format->is_stereo ? map_size / 2 : map_size;
+}
+
+static bool load_delta_map(vcsm_util_buffer_t *map, FILE *fp, map_format_t *format, bool compact) {
+    if (!compact) {
+        fprintf(stderr, "ERROR: delta maps need the cpu backend\n");
+        return false;
+    }
+    return vcsm_util_buffer_load_from_file(map, fp, delta_map_data_size(&format->delta.header))
+        && delta_map_init(&format->delta, &format->delta.header, map->usr_mem_ptr);
+}
+
+// Reads the entries that follow the header into a buffer of
+// map_file_stored_size() bytes.
+bool map_file_load(vcsm_util_buffer_t *map, FILE *fp, map_format_t *format, int width, int height, bool compact) {
+    if (format->is_delta)
+        return load_delta_map(map, fp, format, compact);
+    if (!format->is_stereo || compact)
+        return vcsm_util_buffer_load_from_file(map, fp, map_file_stored_size(format, width, height, compact));
+
+    const stereo_map_header_t *stereo = &format->stereo;
+    const int half = width / 2;
+    const size_t eye_size = (size_t) half * height * sizeof(uint32_t);
+    uint32_t *eye = (uint32_t *) malloc(eye_size);
+    if (!eye || fread(eye, 1, eye_size, fp) != eye_size) {
+        fprintf(stderr, "ERROR: failed to read map file\n");
+        free(eye);
+        return false;
+    }
+    uint32_t *entries = (uint32_t *) vcsm_lock(map->handle);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < half; ++x) {
+            entries[map_index(x, y, width)] = eye[map_index(x, y, half)];
+            entries[map_index(half + x, y, width)] = stereo_map_right_entry(stereo, eye[map_index(stereo_map_column(stereo, x), y, half)]);
+        }
+    }
+    vcsm_unlock_ptr(entries);
+    free(eye);
+    return true;
+}
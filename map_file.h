@@ -0,0 +1,23 @@
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "vcsm_util.h"
+#include "map_util.h"
+#include "delta_map.h"
+
+// how a map file stores its entries
+typedef struct {
+    bool is_stereo;
+    stereo_map_header_t stereo;
+    bool is_delta;
+    delta_map_t delta;      // decoded on the fly by the cpu backend
+} map_format_t;
+
+bool map_file_read_header(FILE *fp, int header[4], map_format_t *format);
+size_t map_file_stored_size(const map_format_t *format, int width, int height, bool compact);
+bool map_file_load(vcsm_util_buffer_t *map, FILE *fp, map_format_t *format, int width, int height, bool compact);
+
+#endif
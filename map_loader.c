@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "map_loader.h"
+#include "map_util.h"
+
+#define MAX_LOADER_THREADS 16
+
+// OpenCV INTER_BITS: the interpolation table index is (fy << 5) | fx
+#define INTER_BITS 5
+
+typedef struct {
+    void *data;
+    int width;
+    int height;
+} map_array_t;
+
+typedef struct {
+    const map_source_t *source;
+    const float *map_x;
+    const float *map_y;
+    const int16_t *map_xy;
+    const uint16_t *map_frac;
+    uint32_t *entries;
+    int first_row;          // in tile rows
+    int end_row;
+} loader_job_t;
+
+static bool has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int next_pow2(int x) {
+    int p = 1;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+// Reads the header of a .npy file, leaves fp at the start of the data.
+static bool read_npy_header(FILE *fp, const char *filename, const char *descr, int components, int *width, int *height) {
+    unsigned char preamble[12];
+    char header[1024];
+    size_t header_len;
+
+    if (fread(preamble, 1, 10, fp) != 10 || memcmp(preamble, "\x93NUMPY", 6) != 0) {
+        fprintf(stderr, "ERROR: %s is not a .npy file\n", filename);
+        return false;
+    }
+    if (preamble[6] == 1) {
+        header_len = preamble[8] | (preamble[9] << 8);
+    } else {
+        if (fread(preamble + 10, 1, 2, fp) != 2) {
+            fprintf(stderr, "ERROR: %s is not a .npy file\n", filename);
+            return false;
+        }
+        header_len = preamble[8] | (preamble[9] << 8) | (preamble[10] << 16) | ((size_t) preamble[11] << 24);
+    }
+    if (header_len >= sizeof(header) || fread(header, 1, header_len, fp) != header_len) {
+        fprintf(stderr, "ERROR: invalid .npy header in %s\n", filename);
+        return false;
+    }
+    header[header_len] = '\0';
+
+    char expected[32];
+    snprintf(expected, sizeof(expected), "'descr': '%s'", descr);
+    if (strstr(header, expected) == NULL || strstr(header, "'fortran_order': False") == NULL) {
+        fprintf(stderr, "ERROR: %s must be a C-ordered array of %s\n", filename, descr);
+        return false;
+    }
+
+    const char *p = strstr(header, "'shape': (");
+    long shape[3] = {0, 0, 1};
+    int ndim = 0;
+    if (p) {
+        p += strlen("'shape': (");
+        char *end;
+        while (ndim < 3 && (shape[ndim] = strtol(p, &end, 10), end != p)) {
+            ++ndim;
+            p = end;
+            while (*p == ',' || *p == ' ')
+                ++p;
+        }
+    }
+    if ((components == 1 && ndim != 2) || (components > 1 && (ndim != 3 || shape[2] != components))) {
+        fprintf(stderr, "ERROR: unexpected shape of %s\n", filename);
+        return false;
+    }
+    *height = (int) shape[0];
+    *width = (int) shape[1];
+    return true;
+}
+
+static bool probe_array(const char *filename, const char *descr, int components, int *width, int *height) {
+    if (!has_suffix(filename, ".npy"))
+        return true;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+        return false;
+    }
+    int w, h;
+    bool result = read_npy_header(fp, filename, descr, components, &w, &h);
+    fclose(fp);
+    if (!result)
+        return false;
+    if ((*width && *width != w) || (*height && *height != h)) {
+        fprintf(stderr, "ERROR: %s is %dx%d, expected %dx%d\n", filename, w, h, *width, *height);
+        return false;
+    }
+    *width = w;
+    *height = h;
+    return true;
+}
+
+static void *read_array(const char *filename, const char *descr, int components, size_t element_size, int width, int height) {
+    const size_t size = (size_t) width * height * components * element_size;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+        return NULL;
+    }
+    int w = width, h = height;
+    void *data = NULL;
+    if (has_suffix(filename, ".npy") && !read_npy_header(fp, filename, descr, components, &w, &h))
+        goto error;
+    data = malloc(size);
+    if (!data || fread(data, 1, size, fp) != size) {
+        fprintf(stderr, "ERROR: failed to read %s\n", filename);
+        free(data);
+        data = NULL;
+    }
+
+error:
+    fclose(fp);
+    return data;
+}
+
+// Fills in the map and image size from the .npy headers.
+bool map_loader_probe(map_source_t *source) {
+    if (source->map_y) {
+        if (!probe_array(source->map_x, "<f4", 1, &source->width, &source->height)
+            || !probe_array(source->map_y, "<f4", 1, &source->width, &source->height))
+            return false;
+    } else {
+        if (!probe_array(source->map_x, "<i2", 2, &source->width, &source->height))
+            return false;
+        if (source->map_frac && !probe_array(source->map_frac, "<u2", 1, &source->width, &source->height))
+            return false;
+    }
+    if (source->width <= 0 || source->height <= 0) {
+        fprintf(stderr, "ERROR: the size of raw map files has to be given\n");
+        return false;
+    }
+    if (source->width % MAP_STEP_WIDTH != 0 || source->height % MAP_STEP_HEIGHT != 0) {
+        fprintf(stderr, "ERROR: map size must be a multiple of %dx%d\n", MAP_STEP_WIDTH, MAP_STEP_HEIGHT);
+        return false;
+    }
+    if (source->image_width == 0)
+        source->image_width = source->width;
+    if (source->image_height == 0)
+        source->image_height = source->height;
+    return true;
+}
+
+// same rounding as convert_maps.py, but clamped instead of wrapped
+static inline uint16_t quantize(float v) {
+    float q = (v - 0.5f) * 65535.0f;
+    if (q < -32768.0f)
+        q = -32768.0f;
+    if (q > 32767.0f)
+        q = 32767.0f;
+    return (uint16_t) (int16_t) (int) q;
+}
+
+static void *convert_rows(void *arg) {
+    const loader_job_t *job = (const loader_job_t *) arg;
+    const map_source_t *source = job->source;
+    const int width = source->width;
+    const float scale_x = (float) (next_pow2(source->image_width) - 1);
+    const float scale_y = (float) (source->image_height - 1);
+
+    for (int y = job->first_row * MAP_STEP_HEIGHT; y < job->end_row * MAP_STEP_HEIGHT; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t src = (size_t) y * width + x;
+            float sx, sy;
+            if (job->map_y) {
+                sx = job->map_x[src];
+                sy = job->map_y[src];
+            } else {
+                sx = job->map_xy[src * 2];
+                sy = job->map_xy[src * 2 + 1];
+                if (job->map_frac) {
+                    const int frac = job->map_frac[src];
+                    sx += (frac & ((1 << INTER_BITS) - 1)) / (float) (1 << INTER_BITS);
+                    sy += ((frac >> INTER_BITS) & ((1 << INTER_BITS) - 1)) / (float) (1 << INTER_BITS);
+                }
+            }
+            job->entries[map_index(x, y, width)] = ((uint32_t) quantize(sy / scale_y) << 16) | quantize(sx / scale_x);
+        }
+    }
+    return NULL;
+}
+
+// Quantizes and retiles the source matrices into entries, which has room
+// for width * height entries, on all cores.
+bool map_loader_convert(const map_source_t *source, uint32_t *entries) {
+    const int width = source->width, height = source->height;
+    bool result = false;
+    loader_job_t jobs[MAX_LOADER_THREADS];
+    pthread_t threads[MAX_LOADER_THREADS];
+    loader_job_t common = {.source = source, .entries = entries};
+
+    if (source->map_y) {
+        common.map_x = (const float *) read_array(source->map_x, "<f4", 1, sizeof(float), width, height);
+        common.map_y = (const float *) read_array(source->map_y, "<f4", 1, sizeof(float), width, height);
+        if (!common.map_x || !common.map_y)
+            goto error;
+    } else {
+        common.map_xy = (const int16_t *) read_array(source->map_x, "<i2", 2, sizeof(int16_t), width, height);
+        if (!common.map_xy)
+            goto error;
+        if (source->map_frac) {
+            common.map_frac = (const uint16_t *) read_array(source->map_frac, "<u2", 1, sizeof(uint16_t), width, height);
+            if (!common.map_frac)
+                goto error;
+        }
+    }
+
+    const int tile_rows = height / MAP_STEP_HEIGHT;
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads > MAX_LOADER_THREADS)
+        num_threads = MAX_LOADER_THREADS;
+    if (num_threads > tile_rows)
+        num_threads = tile_rows;
+
+    for (int i = 0; i < num_threads; ++i) {
+        jobs[i] = common;
+        jobs[i].first_row = tile_rows * i / num_threads;
+        jobs[i].end_row = tile_rows * (i + 1) / num_threads;
+    }
+    int started = 1;
+    for (int i = 1; i < num_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, convert_rows, &jobs[i]) != 0)
+            break;
+        started = i + 1;
+    }
+    // the calling thread takes the first share, and those of threads that could not be started
+    convert_rows(&jobs[0]);
+    for (int i = started; i < num_threads; ++i)
+        convert_rows(&jobs[i]);
+    for (int i = 1; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    result = true;
+
+error:
+    free((void *) common.map_x);
+    free((void *) common.map_y);
+    free((void *) common.map_xy);
+    free((void *) common.map_frac);
+    return result;
+}
+
+// Writes a map file that can be passed to --map.
+bool map_loader_write(const char *filename, const map_source_t *source, const uint32_t *entries) {
+    const int header[4] = {source->width, source->height, source->image_width, source->image_height};
+    const size_t count = (size_t) source->width * source->height;
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+        return false;
+    }
+    bool result = fwrite(header, sizeof(int), 4, fp) == 4 && fwrite(entries, sizeof(uint32_t), count, fp) == count;
+    if (fclose(fp) != 0)
+        result = false;
+    if (!result) {
+        fprintf(stderr, "ERROR: failed to write %s\n", filename);
+        unlink(filename);
+    }
+    return result;
+}
+
+static bool is_newer(const struct stat *cache, const char *filename) {
+    struct stat st;
+    return filename == NULL || (stat(filename, &st) == 0 && st.st_mtime <= cache->st_mtime);
+}
+
+// A cached map is used if it is not older than any of the sources and has the
+// same size.
+bool map_loader_cache_is_fresh(const char *filename, const map_source_t *source) {
+    struct stat st;
+    int header[4];
+
+    if (stat(filename, &st) != 0)
+        return false;
+    if (!is_newer(&st, source->map_x) || !is_newer(&st, source->map_y) || !is_newer(&st, source->map_frac))
+        return false;
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+    bool fresh = fread(header, sizeof(int), 4, fp) == 4 && header[0] == source->width && header[1] == source->height
+        && header[2] == source->image_width && header[3] == source->image_height
+        && (size_t) st.st_size == sizeof(header) + (size_t) source->width * source->height * sizeof(uint32_t);
+    fclose(fp);
+    return fresh;
+}
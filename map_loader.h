@@ -0,0 +1,29 @@
+#ifndef MAP_LOADER_H
+#define MAP_LOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Builds a map directly from OpenCV remap matrices, the same way
+// tools/convert_maps.py does:
+//  - map_x and map_y: CV_32FC1 source positions, raw float32 or .npy, or
+//  - map_x alone: CV_16SC2 integer positions (raw int16 pairs or .npy of
+//    shape (h, w, 2)), plus the CV_16UC1 interpolation table indices of
+//    cv::convertMaps in map_frac if given.
+// Raw files need width and height; .npy files carry their shape.
+typedef struct {
+    const char *map_x;
+    const char *map_y;      // NULL for CV_16SC2
+    const char *map_frac;   // optional with CV_16SC2
+    int width;
+    int height;
+    int image_width;        // 0: same as the map
+    int image_height;
+} map_source_t;
+
+bool map_loader_probe(map_source_t *source);
+bool map_loader_convert(const map_source_t *source, uint32_t *entries);
+bool map_loader_write(const char *filename, const map_source_t *source, const uint32_t *entries);
+bool map_loader_cache_is_fresh(const char *filename, const map_source_t *source);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MAP_UTIL_H
+#define MAP_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The map is stored in the order the kernel consumes it: for every tile row
+// of MAP_STEP_HEIGHT rows, for every step of MAP_STEP_WIDTH pixels, the
+// MAP_STEP_WIDTH entries of each of the rows (one row per QPU).
+#define MAP_STEP_WIDTH   16
+#define MAP_STEP_HEIGHT  12
+
+static inline size_t map_index(int x, int y, int width) {
+    size_t step = (size_t) (y / MAP_STEP_HEIGHT) * (width / MAP_STEP_WIDTH) + x / MAP_STEP_WIDTH;
+    return (step * MAP_STEP_HEIGHT + y % MAP_STEP_HEIGHT) * MAP_STEP_WIDTH + x % MAP_STEP_WIDTH;
+}
+
+// A map entry packs the signed 16-bit s (low) and t (high) coordinates,
+// normalized so that -32767..32767 covers the whole texture.
+static inline int16_t map_entry_s(uint32_t entry) {
+    return (int16_t) (entry & 0xffff);
+}
+
+static inline int16_t map_entry_t(uint32_t entry) {
+    return (int16_t) (entry >> 16);
+}
+
+// A stereo map file stores the map of the left eye only.  It starts with
+// STEREO_MAP_MAGIC, followed by stereo_map_header_t and the left eye map of
+// width / 2 x height entries (in map order for that width).  The right eye
+// uses the same map, read from right to left if mirrored, with the offset
+// added to its coordinates (mirrored s becomes offset_s - s).
+#define STEREO_MAP_MAGIC  0x4f455453 // "STEO"
+#define STEREO_MAP_MIRROR (1 << 0)
+
+typedef struct {
+    int32_t width;          // of the whole output, both eyes
+    int32_t height;
+    int32_t image_width;
+    int32_t image_height;
+    int32_t flags;
+    int32_t offset_s;       // in map units
+    int32_t offset_t;
+} stereo_map_header_t;
+
+static inline int16_t clamp_entry(int32_t v) {
+    return (int16_t) (v < -32768 ? -32768 : (v > 32767 ? 32767 : v));
+}
+
+// x is the output column within the right eye.
+static inline int stereo_map_column(const stereo_map_header_t *stereo, int x) {
+    return (stereo->flags & STEREO_MAP_MIRROR) ? stereo->width / 2 - 1 - x : x;
+}
+
+static inline uint32_t stereo_map_right_entry(const stereo_map_header_t *stereo, uint32_t entry) {
+    const int32_t s = (stereo->flags & STEREO_MAP_MIRROR) ? stereo->offset_s - map_entry_s(entry) : stereo->offset_s + map_entry_s(entry);
+    const int32_t t = stereo->offset_t + map_entry_t(entry);
+    return ((uint32_t) (uint16_t) clamp_entry(t) << 16) | (uint16_t) clamp_entry(s);
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mip.h"
+#include "map_util.h"
+
+// Bytes of level 1 (half size) or 2 (quarter size) of a width x height source.
+size_t mip_level_size(int level, int width, int height) {
+    return (size_t) (width >> level) * (height >> level) * 2;
+}
+
+bool mip_source_init(mip_source_t *mip, int num_levels, int width, int height) {
+    memset(mip, 0, sizeof(*mip));
+    mip->width = width;
+    mip->height = height;
+    mip->num_levels = num_levels;
+    mip->num_used = num_levels;
+
+    // a step of the downsample kernel makes 32 texels of a level row
+    if ((width >> num_levels) % 32 != 0) {
+        fprintf(stderr, "ERROR: the source is too narrow for %d mip levels\n", num_levels);
+        return false;
+    }
+
+    // only the QPUs write and read the levels
+    for (int i = 0; i < num_levels; ++i) {
+        if (!vcsm_util_buffer_create(&mip->levels[i], mip_level_size(i + 1, width, height))) {
+            mip_source_destroy(mip);
+            return false;
+        }
+    }
+    return true;
+}
+
+void mip_source_destroy(mip_source_t *mip) {
+    for (int i = 0; i < mip->num_levels; ++i)
+        vcsm_util_buffer_destroy(&mip->levels[i]);
+}
+
+// The level that the step of MAP_STEP_WIDTH x MAP_STEP_HEIGHT pixels at (x, y)
+// samples: the smallest one that still has a texel for every output pixel of
+// the step.  The footprint of a pixel is the longer of the source distances
+// to its right and lower neighbours, from the plain map of the kernel.
+int mip_step_level(const uint32_t *map, int x, int y, int width, int height, int src_width, int src_height, int max_level) {
+    // source texels per map unit, squared
+    const float scale_s = (float) src_width * src_width / (65535.0f * 65535.0f);
+    const float scale_t = (float) src_height * src_height / (65535.0f * 65535.0f);
+    int level = max_level;
+    for (int j = 0; j < MAP_STEP_HEIGHT && level > 0; ++j) {
+        // the last row and column of the frame have no neighbours
+        const bool has_below = y + j + 1 < height;
+        for (int i = 0; i < MAP_STEP_WIDTH && level > 0; ++i) {
+            const bool has_right = x + i + 1 < width;
+            const uint32_t entry = map[map_index(x + i, y + j, width)];
+            float footprint = 0.0f;
+            if (has_right) {
+                const uint32_t right = map[map_index(x + i + 1, y + j, width)];
+                const float ds = map_entry_s(right) - map_entry_s(entry);
+                const float dt = map_entry_t(right) - map_entry_t(entry);
+                footprint = ds * ds * scale_s + dt * dt * scale_t;
+            }
+            if (has_below) {
+                const uint32_t below = map[map_index(x + i, y + j + 1, width)];
+                const float ds = map_entry_s(below) - map_entry_s(entry);
+                const float dt = map_entry_t(below) - map_entry_t(entry);
+                const float d = ds * ds * scale_s + dt * dt * scale_t;
+                if (d > footprint)
+                    footprint = d;
+            }
+            if (!has_right && !has_below)
+                continue;
+            // squared footprints of 2 and 4 texels select the half and the quarter size
+            const int pixel_level = footprint >= 16.0f ? 2 : (footprint >= 4.0f ? 1 : 0);
+            if (pixel_level < level)
+                level = pixel_level;
+        }
+    }
+    return level;
+}
@@ -0,0 +1,30 @@
+#ifndef MIP_H
+#define MIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vcsm_util.h"
+
+#define MIP_MAX_LEVELS 2
+
+// Half and quarter size copies of the YUYV source, which the parts of a map
+// that shrink the source sample instead of the full resolution.  Each level
+// is the box filter of the source texels it covers, with the power of 2
+// stride of a texture, and is generated on the QPUs for every frame (see
+// remap_qpu_downsample()).
+typedef struct {
+    vcsm_util_buffer_t levels[MIP_MAX_LEVELS];
+    int width;              // of the source texture (power of 2)
+    int height;
+    int num_levels;
+    int num_used;           // only the levels that a level table refers to are generated
+} mip_source_t;
+
+size_t mip_level_size(int level, int width, int height);
+bool mip_source_init(mip_source_t *mip, int num_levels, int width, int height);
+void mip_source_destroy(mip_source_t *mip);
+int mip_step_level(const uint32_t *map, int x, int y, int width, int height, int src_width, int src_height, int max_level);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "motion.h"
+
+static bool parse_line(const motion_t *motion, const char *line, motion_entry_t *entry) {
+    float v[9];
+    char *endptr;
+    int n = 0;
+
+    entry->pts = strtoll(line, &endptr, 10);
+    if (endptr == line)
+        return false;
+    const char *p = endptr;
+    while (n < 9) {
+        v[n] = strtof(p, &endptr);
+        if (endptr == p)
+            break;
+        p = endptr;
+        ++n;
+    }
+
+    const float cx = motion->src_width * 0.5f;
+    const float cy = motion->src_height * 0.5f;
+    float a = 1.0f, b = 0.0f;
+    switch (n) {
+    case 9:
+        memcpy(entry->h, v, sizeof(entry->h));
+        return true;
+    case 4:
+        a = v[3] * cosf(v[2] * (float) M_PI / 180.0f);
+        b = v[3] * sinf(v[2] * (float) M_PI / 180.0f);
+        // fall through
+    case 2:
+        // p' = s R (p - c) + c + d
+        entry->h[0] = a;  entry->h[1] = -b; entry->h[2] = cx + v[0] - a * cx + b * cy;
+        entry->h[3] = b;  entry->h[4] = a;  entry->h[5] = cy + v[1] - b * cx - a * cy;
+        entry->h[6] = 0;  entry->h[7] = 0;  entry->h[8] = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool append(motion_t *motion, const motion_entry_t *entry) {
+    pthread_mutex_lock(&motion->mutex);
+    if (motion->closed) {
+        pthread_mutex_unlock(&motion->mutex);
+        return true;
+    }
+    if (motion->num_entries == motion->capacity) {
+        size_t capacity = motion->capacity ? motion->capacity * 2 : 256;
+        motion_entry_t *entries = (motion_entry_t *) realloc(motion->entries, capacity * sizeof(motion_entry_t));
+        if (!entries) {
+            pthread_mutex_unlock(&motion->mutex);
+            fprintf(stderr, "ERROR: failed to allocate motion entries\n");
+            return false;
+        }
+        motion->entries = entries;
+        motion->capacity = capacity;
+    }
+    motion->entries[motion->num_entries++] = *entry;
+    pthread_mutex_unlock(&motion->mutex);
+    return true;
+}
+
+static bool read_lines(motion_t *motion) {
+    char line[512];
+    int line_number = 0;
+    motion_entry_t entry;
+    bool has_entry = false;
+    int64_t last_pts = 0;
+
+    while (fgets(line, sizeof(line), motion->fp)) {
+        ++line_number;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+        if (!parse_line(motion, line, &entry)) {
+            fprintf(stderr, "ERROR: invalid motion entry at line %d\n", line_number);
+            return false;
+        }
+        // motion_lookup searches the entries by pts
+        if (has_entry && entry.pts < last_pts) {
+            fprintf(stderr, "ERROR: motion entry at line %d is before the previous one\n", line_number);
+            return false;
+        }
+        if (!append(motion, &entry))
+            return false;
+        has_entry = true;
+        last_pts = entry.pts;
+    }
+    return true;
+}
+
+static void *stream_thread(void *arg) {
+    read_lines((motion_t *) arg);
+    return NULL;
+}
+
+bool motion_open(motion_t *motion, const char *filename, int src_width, int src_height, int tex_width, int tex_height) {
+    motion->src_width = src_width;
+    motion->src_height = src_height;
+    motion->tex_width = tex_width;
+    motion->tex_height = tex_height;
+    motion->stream = strcmp(filename, "-") == 0;
+    pthread_mutex_init(&motion->mutex, NULL);
+
+    if (motion->stream) {
+        // entries keep coming while frames are processed
+        motion->fp = stdin;
+        if (pthread_create(&motion->thread, NULL, stream_thread, motion) != 0) {
+            fprintf(stderr, "ERROR: failed to create motion thread\n");
+            motion->fp = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    motion->fp = fopen(filename, "r");
+    if (!motion->fp) {
+        fprintf(stderr, "ERROR: failed to open file %s\n", filename);
+        return false;
+    }
+    bool result = read_lines(motion);
+    fclose(motion->fp);
+    motion->fp = NULL;
+    if (result)
+        fprintf(stderr, "motion entries: %zu\n", motion->num_entries);
+    return result;
+}
+
+// Converts the homography from source pixels to texture coordinates
+// (H' = S^-1 H S, S = diag(tex_width, tex_height, 1)) and normalizes h22 to 1.
+static void to_params(const motion_t *motion, const float h[9], float params[MOTION_NUM_PARAMS]) {
+    const float w = (float) motion->tex_width;
+    const float t = (float) motion->tex_height;
+    const float n[9] = {
+        h[0],         h[1] * t / w, h[2] / w,
+        h[3] * w / t, h[4],         h[5] / t,
+        h[6] * w,     h[7] * t,     h[8],
+    };
+    for (int i = 0; i < MOTION_NUM_PARAMS; ++i) {
+        params[i] = n[i] / n[8];
+    }
+}
+
+void motion_lookup(motion_t *motion, int64_t pts, float params[MOTION_NUM_PARAMS]) {
+    static const float identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+    if (!motion->has_first_pts) {
+        motion->first_pts = pts;
+        motion->has_first_pts = true;
+    }
+    pts -= motion->first_pts;
+
+    pthread_mutex_lock(&motion->mutex);
+    // last entry whose pts is not after the frame
+    size_t lo = 0, hi = motion->num_entries;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (motion->entries[mid].pts <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    to_params(motion, lo > 0 ? motion->entries[lo - 1].h : identity, params);
+    if (motion->stream && lo > 1) {
+        // older entries will not be used again
+        memmove(motion->entries, motion->entries + lo - 1, (motion->num_entries - lo + 1) * sizeof(motion_entry_t));
+        motion->num_entries -= lo - 1;
+    }
+    pthread_mutex_unlock(&motion->mutex);
+}
+
+void motion_close(motion_t *motion) {
+    if (motion->stream && motion->fp) {
+        // the reader is blocked on stdin, do not wait for it
+        pthread_detach(motion->thread);
+    }
+    pthread_mutex_lock(&motion->mutex);
+    motion->closed = true;
+    free(motion->entries);
+    motion->entries = NULL;
+    motion->num_entries = 0;
+    motion->capacity = 0;
+    pthread_mutex_unlock(&motion->mutex);
+}
@@ -0,0 +1,48 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Number of transform parameters passed to the kernel: a homography in
+// texture coordinates normalized so that h22 = 1.
+#define MOTION_NUM_PARAMS 8
+
+typedef struct {
+    int64_t pts;    // microseconds from the first frame
+    float h[9];     // homography in source pixels, row major
+} motion_entry_t;
+
+// Per-frame transforms applied on top of the map.  Each line of the motion
+// file (or stream) is a PTS followed by 2 (dx dy), 4 (dx dy angle scale,
+// about the source center) or 9 (homography) values.  The transform maps the
+// source position given by the map to the position actually sampled, in
+// source pixels.  A frame uses the last entry whose PTS is not after the
+// frame.
+typedef struct {
+    FILE *fp;
+    bool stream;
+    bool closed;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    motion_entry_t *entries;
+    size_t num_entries;
+    size_t capacity;
+
+    int src_width;          // camera width
+    int src_height;
+    int tex_width;          // texture width (power of 2)
+    int tex_height;
+
+    bool has_first_pts;
+    int64_t first_pts;
+} motion_t;
+
+bool motion_open(motion_t *motion, const char *filename, int src_width, int src_height, int tex_width, int tex_height);
+void motion_lookup(motion_t *motion, int64_t pts, float params[MOTION_NUM_PARAMS]);
+void motion_close(motion_t *motion);
+
+#endif
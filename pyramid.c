@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pyramid.h"
+
+typedef struct {
+    const uint8_t *data;
+    int stride;
+    int width;
+    int height;
+    int rows;               // rows that are finished
+} plane_t;
+
+bool pyramid_init(pyramid_t *pyramid, int num_levels, int width, int height) {
+    memset(pyramid, 0, sizeof(*pyramid));
+    pyramid->width = width;
+    pyramid->height = height;
+    pyramid->num_levels = num_levels;
+
+    int w = width, h = height, cw = (width + 1) / 2, ch = (height + 1) / 2;
+    for (int i = 0; i < num_levels; ++i) {
+        pyramid_level_t *level = &pyramid->levels[i];
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        cw = (cw + 1) / 2;
+        ch = (ch + 1) / 2;
+        level->width = w;
+        level->height = h;
+        level->chroma_width = cw;
+        level->chroma_height = ch;
+        level->data = (uint8_t *) malloc((size_t) w * h + (size_t) cw * ch * 2);
+        if (!level->data) {
+            fprintf(stderr, "ERROR: failed to allocate pyramid level %d\n", i + 1);
+            pyramid_destroy(pyramid);
+            return false;
+        }
+    }
+    return true;
+}
+
+void pyramid_destroy(pyramid_t *pyramid) {
+    for (int i = 0; i < pyramid->num_levels; ++i) {
+        free(pyramid->levels[i].data);
+        pyramid->levels[i].data = NULL;
+    }
+}
+
+void pyramid_begin(pyramid_t *pyramid) {
+    for (int i = 0; i < pyramid->num_levels; ++i) {
+        pyramid->levels[i].rows = 0;
+        pyramid->levels[i].chroma_rows = 0;
+    }
+}
+
+// Box filters the rows of dst from first_row on whose 2 source rows are
+// finished, and returns the new number of finished rows of dst.
+static int downsample(const plane_t *src, uint8_t *dst, int dst_width, int dst_height, int first_row) {
+    const int end_row = src->rows == src->height ? dst_height : src->rows / 2;
+    for (int y = first_row; y < end_row; ++y) {
+        const uint8_t *row0 = src->data + (size_t) (y * 2) * src->stride;
+        const uint8_t *row1 = y * 2 + 1 < src->height ? row0 + src->stride : row0;
+        uint8_t *out = dst + (size_t) y * dst_width;
+        const int pairs = src->width / 2;
+        for (int x = 0; x < pairs; ++x)
+            out[x] = (uint8_t) ((row0[x * 2] + row0[x * 2 + 1] + row1[x * 2] + row1[x * 2 + 1] + 2) >> 2);
+        if (pairs < dst_width)
+            out[pairs] = (uint8_t) ((row0[pairs * 2] + row1[pairs * 2] + 1) >> 1);
+    }
+    return end_row > first_row ? end_row : first_row;
+}
+
+// Fills in whatever the first rows of the frame (I420 with the given stride
+// and buffer height) make available.  rows = height finishes the frame.
+void pyramid_update(pyramid_t *pyramid, const uint8_t *frame, int stride, int buffer_height, int rows) {
+    const int chroma_stride = stride / 2;
+    const uint8_t *u = frame + (size_t) stride * buffer_height;
+    const uint8_t *v = u + (size_t) chroma_stride * (buffer_height / 2);
+    plane_t y_src = {frame, stride, pyramid->width, pyramid->height, rows};
+    plane_t u_src = {u, chroma_stride, (pyramid->width + 1) / 2, (pyramid->height + 1) / 2,
+        rows == pyramid->height ? (pyramid->height + 1) / 2 : rows / 2};
+    plane_t v_src = u_src;
+    v_src.data = v;
+
+    for (int i = 0; i < pyramid->num_levels; ++i) {
+        pyramid_level_t *level = &pyramid->levels[i];
+        uint8_t *y_dst = level->data;
+        uint8_t *u_dst = y_dst + (size_t) level->width * level->height;
+        uint8_t *v_dst = u_dst + (size_t) level->chroma_width * level->chroma_height;
+
+        level->rows = downsample(&y_src, y_dst, level->width, level->height, level->rows);
+        const int chroma_rows = level->chroma_rows;
+        downsample(&u_src, u_dst, level->chroma_width, level->chroma_height, chroma_rows);
+        level->chroma_rows = downsample(&v_src, v_dst, level->chroma_width, level->chroma_height, chroma_rows);
+
+        // the next level reads this one
+        y_src = (plane_t) {y_dst, level->width, level->width, level->height, level->rows};
+        u_src = (plane_t) {u_dst, level->chroma_width, level->chroma_width, level->chroma_height, level->chroma_rows};
+        v_src = u_src;
+        v_src.data = v_dst;
+    }
+}
+
+// Writes every level that has a sink as a raw I420 frame.
+bool pyramid_write(const pyramid_t *pyramid) {
+    bool result = true;
+    for (int i = 0; i < pyramid->num_levels; ++i) {
+        const pyramid_level_t *level = &pyramid->levels[i];
+        if (!level->sink)
+            continue;
+        const size_t size = (size_t) level->width * level->height + (size_t) level->chroma_width * level->chroma_height * 2;
+        if (fwrite(level->data, 1, size, level->sink) != size || fflush(level->sink) != 0)
+            result = false;
+    }
+    return result;
+}
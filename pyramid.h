@@ -0,0 +1,38 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PYRAMID_MAX_LEVELS 2
+
+// Half and quarter size copies of the output frame.  Each level is the 2x2
+// box filter of the one above it, and is kept as tightly packed I420.
+typedef struct {
+    uint8_t *data;
+    int width;
+    int height;
+    int chroma_width;
+    int chroma_height;
+    int rows;               // luma rows done in the current frame
+    int chroma_rows;
+    FILE *sink;             // NULL if the level is only needed for the next one
+} pyramid_level_t;
+
+// The levels are filled as the rows of the frame are finished, so the cpu
+// backend can downsample each tile row while it is still in the cache.
+typedef struct {
+    int width;
+    int height;
+    int num_levels;
+    pyramid_level_t levels[PYRAMID_MAX_LEVELS];
+} pyramid_t;
+
+bool pyramid_init(pyramid_t *pyramid, int num_levels, int width, int height);
+void pyramid_destroy(pyramid_t *pyramid);
+void pyramid_begin(pyramid_t *pyramid);
+void pyramid_update(pyramid_t *pyramid, const uint8_t *frame, int stride, int buffer_height, int rows);
+bool pyramid_write(const pyramid_t *pyramid);
+
+#endif
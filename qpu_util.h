@@ -1,6 +1,9 @@
 #ifndef QPU_UTIL_H
 #define QPU_UTIL_H
 
+#define VPM_MAP_BASE 37
+#define VPM_MAP_SLOT_ROWS 12
+
 unsigned int texture_config_0(unsigned int base, unsigned int flipy, unsigned int ttype) {
     unsigned int cswiz = 0;
     unsigned int cmmode = 0;
@@ -26,7 +29,7 @@ unsigned int vpm_write_y_config(unsigned int thread) {
 }
 
 unsigned int vpm_write_uv_config(unsigned int thread) {
-    unsigned int stride = thread % 2 == 0 ? 24 : 1; // Y += 6
+    unsigned int stride = 2; // B += 2
     unsigned int size = 0; // 8-bit
     unsigned int laned = 0; // packed
     unsigned int horizontal = 1; // horizontal
@@ -36,4 +39,60 @@ unsigned int vpm_write_uv_config(unsigned int thread) {
     return (stride<<12|horizontal<<11|laned<<10|size<<8|addr);
 }
 
+unsigned int dma_store_config(unsigned int nrows, unsigned int ncols, unsigned int Y, unsigned int X) {
+    unsigned int id = 2; // VDW basic setup
+    unsigned int modew = 0; // 32-bit
+    unsigned int horizontal = 1; // horizontal
+    unsigned int laned = 0;
+    unsigned int addr = ((Y & 0x7f) << 4) | (X & 0xf);
+    return (id<<30|(nrows&0x7f)<<23|(ncols&0x7f)<<16|laned<<15|horizontal<<14|addr<<3|modew);
+}
+
+unsigned int dma_store_y_config(unsigned int thread) {
+    return dma_store_config(1, 16, thread, 0);
+}
+
+unsigned int dma_store_uv_config(unsigned int thread) {
+    return dma_store_config(1, 8, 24 + thread / 2, 0);
+}
+
+unsigned int dma_load_config(unsigned int nrows, unsigned int ncols, unsigned int Y, unsigned int X) {
+    unsigned int id = 1; // VDR basic setup
+    unsigned int modew = 0; // 32-bit
+    unsigned int mpitch = 3; // 64 bytes
+    unsigned int vpitch = 1; // Y += 1
+    unsigned int vertical = 0; // horizontal
+    unsigned int addr = ((Y & 0x3f) << 4) | (X & 0xf);
+    return (id<<31|modew<<28|mpitch<<24|(ncols&0xf)<<20|(nrows&0xf)<<16|vpitch<<12|vertical<<11|addr);
+}
+
+// a whole step of the map, loaded by one QPU for all of them
+unsigned int dma_load_map_config(void) {
+    return dma_load_config(VPM_MAP_SLOT_ROWS, 16, VPM_MAP_BASE, 0);
+}
+
+unsigned int vpm_read_map_config(unsigned int thread) {
+    unsigned int num = 1; // 1 row
+    unsigned int stride = 1; // Y += 1
+    unsigned int size = 2; // 32-bit
+    unsigned int laned = 0; // packed
+    unsigned int horizontal = 1; // horizontal
+    unsigned int Y = VPM_MAP_BASE + thread;
+    unsigned int addr = Y & 0x3f;
+    return ((num&0xf)<<20|stride<<12|horizontal<<11|laned<<10|size<<8|addr);
+}
+
+unsigned int vpm_write_level_config(unsigned int thread) {
+    unsigned int stride = 1; // Y += 1
+    unsigned int size = 2; // 32-bit
+    unsigned int laned = 0; // packed
+    unsigned int horizontal = 1; // horizontal
+    unsigned int Y = thread;
+    return (stride<<12|horizontal<<11|laned<<10|size<<8|Y);
+}
+
+unsigned int dma_store_level_config(unsigned int thread) {
+    return dma_store_config(1, 16, thread, 0);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "remap_cpu.h"
+#include "map_util.h"
+
+void remap_cpu_init(remap_cpu_t *cpu) {
+    // texel = s * size - 0.5 (in 1/256 texels)
+    cpu->scale_s = 256.0f * cpu->src_width;
+    cpu->offset_s = -128.0f;
+    cpu->scale_t = 256.0f * cpu->src_height;
+    cpu->offset_t = -128.0f;
+}
+
+static inline int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline int min_int(int a, int b) {
+    return a < b ? a : b;
+}
+
+static inline int max_int(int a, int b) {
+    return a > b ? a : b;
+}
+
+static inline int lerp2(int a, int b, int c, int d, int wx, int wy) {
+    int top = a * (256 - wx) + b * wx;
+    int bottom = c * (256 - wx) + d * wx;
+    return (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
+}
+
+// the part of the source that sample() reads from: the whole frame or a
+// staged block of it
+typedef struct {
+    const uint8_t *data;    // YUYV or the luma plane
+    int x;
+    int y;
+    int stride;
+    const uint8_t *u;       // planar sources only
+    const uint8_t *v;
+    int chroma_x;
+    int chroma_y;
+    int chroma_stride;
+    int chroma_step;        // 2 if U and V are interleaved
+} source_t;
+
+// Returns the top-left texel of the bilinear lookup in 1/256 texels.
+static inline void texel_position(const remap_cpu_t *cpu, uint32_t entry, int *fx, int *fy) {
+    float s = map_entry_s(entry) * (1.0f / 65535.0f) + 0.5f;
+    float t = map_entry_t(entry) * (1.0f / 65535.0f) + 0.5f;
+    if (cpu->transform) {
+        const float *h = cpu->transform;
+        const float w = 1.0f / (h[6] * s + h[7] * t + 1.0f);
+        const float s2 = (h[0] * s + h[1] * t + h[2]) * w;
+        t = (h[3] * s + h[4] * t + h[5]) * w;
+        s = s2;
+    }
+    *fx = (int) floorf(s * cpu->scale_s + cpu->offset_s);
+    *fy = (int) floorf(t * cpu->scale_t + cpu->offset_t);
+    if (cpu->nearest) {
+        // the texel the coordinate falls in, without weights
+        *fx = (*fx + 128) & ~0xff;
+        *fy = (*fy + 128) & ~0xff;
+    }
+}
+
+static inline int chroma_width(const remap_cpu_t *cpu) {
+    return cpu->src_width / 2;
+}
+
+static inline int chroma_height(const remap_cpu_t *cpu) {
+    return (cpu->src_height + 1) / 2;
+}
+
+// The chroma planes have half the resolution of luma, so a chroma texel
+// center lies between two luma texel centers.
+static inline void sample_chroma(const remap_cpu_t *cpu, const source_t *src, int fx, int fy, int yuv[3]) {
+    int cx = (fx - 128) >> 1;
+    int cy = (fy - 128) >> 1;
+    if (cpu->nearest) {
+        cx = (fx >> 9) << 8;
+        cy = (fy >> 9) << 8;
+    }
+    int wx = cx & 0xff;
+    int wy = cy & 0xff;
+    const int step = src->chroma_step;
+    int x0 = (clamp_int(cx >> 8, 0, chroma_width(cpu) - 1) - src->chroma_x) * step;
+    int x1 = (clamp_int((cx >> 8) + 1, 0, chroma_width(cpu) - 1) - src->chroma_x) * step;
+    int y0 = clamp_int(cy >> 8, 0, chroma_height(cpu) - 1) - src->chroma_y;
+    int y1 = clamp_int((cy >> 8) + 1, 0, chroma_height(cpu) - 1) - src->chroma_y;
+    if (cpu->nearest) {
+        // the neighbour has no weight and may lie outside of the staged block
+        x1 = x0;
+        y1 = y0;
+    }
+    const uint8_t *u0 = src->u + (size_t) y0 * src->chroma_stride;
+    const uint8_t *u1 = src->u + (size_t) y1 * src->chroma_stride;
+    const uint8_t *v0 = src->v + (size_t) y0 * src->chroma_stride;
+    const uint8_t *v1 = src->v + (size_t) y1 * src->chroma_stride;
+
+    yuv[1] = lerp2(u0[x0], u0[x1], u1[x0], u1[x1], wx, wy);
+    yuv[2] = lerp2(v0[x0], v0[x1], v1[x0], v1[x1], wx, wy);
+}
+
+static inline void sample(const remap_cpu_t *cpu, const source_t *src, uint32_t entry, bool chroma, int yuv[3]) {
+    int fx, fy;
+    texel_position(cpu, entry, &fx, &fy);
+    int wx = fx & 0xff;
+    int wy = fy & 0xff;
+    int x0 = clamp_int(fx >> 8, 0, cpu->src_width - 1) - src->x;
+    int x1 = clamp_int((fx >> 8) + 1, 0, cpu->src_width - 1) - src->x;
+    int y0 = clamp_int(fy >> 8, 0, cpu->src_height - 1) - src->y;
+    int y1 = clamp_int((fy >> 8) + 1, 0, cpu->src_height - 1) - src->y;
+    if (cpu->nearest) {
+        // the neighbour has no weight and may lie outside of the staged block
+        x1 = x0;
+        y1 = y0;
+    }
+    const uint8_t *row0 = src->data + (size_t) y0 * src->stride;
+    const uint8_t *row1 = src->data + (size_t) y1 * src->stride;
+
+    if (cpu->src_format != REMAP_CPU_YUYV) {
+        yuv[0] = lerp2(row0[x0], row0[x1], row1[x0], row1[x1], wx, wy);
+        if (chroma)
+            sample_chroma(cpu, src, fx, fy, yuv);
+        return;
+    }
+
+    yuv[0] = lerp2(row0[x0*2], row0[x1*2], row1[x0*2], row1[x1*2], wx, wy);
+    if (chroma) {
+        int u0 = (x0 & ~1) * 2 + 1;
+        int u1 = (x1 & ~1) * 2 + 1;
+        yuv[1] = lerp2(row0[u0], row0[u1], row1[u0], row1[u1], wx, wy);
+        yuv[2] = lerp2(row0[u0+2], row0[u1+2], row1[u0+2], row1[u1+2], wx, wy);
+    }
+}
+
+static inline int to_byte(float v) {
+    return clamp_int((int) (v * 255.0f + 0.5f), 0, 255);
+}
+
+static void apply_lut(const color_t *color, int yuv[3]) {
+    const int n = color->lut_size;
+    float f[3];
+    int i0[3], i1[3];
+    float w[3];
+    for (int c = 0; c < 3; ++c) {
+        f[c] = yuv[c] * (n - 1) / 255.0f;
+        i0[c] = clamp_int((int) f[c], 0, n - 2);
+        i1[c] = i0[c] + 1;
+        w[c] = f[c] - i0[c];
+    }
+    for (int c = 0; c < 3; ++c) {
+        float v = 0.0f;
+        for (int k = 0; k < 8; ++k) {
+            int iy = (k & 1) ? i1[0] : i0[0];
+            int iu = (k & 2) ? i1[1] : i0[1];
+            int iv = (k & 4) ? i1[2] : i0[2];
+            float wk = ((k & 1) ? w[0] : 1.0f - w[0]) * ((k & 2) ? w[1] : 1.0f - w[1]) * ((k & 4) ? w[2] : 1.0f - w[2]);
+            v += wk * color->lut[((iv * n + iu) * n + iy) * 3 + c];
+        }
+        yuv[c] = to_byte(v);
+    }
+}
+
+static void apply_color(const remap_cpu_t *cpu, const float matrix[9], const float offset[3], int yuv[3]) {
+    const color_t *color = cpu->color;
+    if (color->matrix_enabled) {
+        float y = yuv[0] / 255.0f, u = yuv[1] / 255.0f, v = yuv[2] / 255.0f;
+        for (int c = 0; c < 3; ++c) {
+            yuv[c] = to_byte(matrix[c*3+0] * y + matrix[c*3+1] * u + matrix[c*3+2] * v + offset[c]);
+        }
+    }
+    if (color->lut_size > 0) {
+        apply_lut(color, yuv);
+    }
+}
+
+// The map entry of output pixel (x, y), whose index in map order is i.
+static inline uint32_t map_entry(const remap_cpu_t *cpu, int x, int y, size_t i) {
+    if (cpu->delta)
+        return delta_map_entry(cpu->delta, x, y, i);
+    if (!cpu->stereo)
+        return cpu->map[i];
+    const int half = cpu->dst_width / 2;
+    if (x < half)
+        return cpu->map[map_index(x, y, half)];
+    return stereo_map_right_entry(cpu->stereo, cpu->map[map_index(stereo_map_column(cpu->stereo, x - half), y, half)]);
+}
+
+static void extend_box(const remap_cpu_t *cpu, uint32_t entry, int box[4]) {
+    int fx, fy;
+    texel_position(cpu, entry, &fx, &fy);
+    box[0] = min_int(box[0], clamp_int(fx >> 8, 0, cpu->src_width - 1));
+    box[1] = min_int(box[1], clamp_int(fy >> 8, 0, cpu->src_height - 1));
+    box[2] = max_int(box[2], clamp_int((fx >> 8) + 1, 0, cpu->src_width - 1));
+    box[3] = max_int(box[3], clamp_int((fy >> 8) + 1, 0, cpu->src_height - 1));
+}
+
+// The chroma texels that the bilinear lookups of a luma block read from.
+static void chroma_box(const remap_cpu_t *cpu, const remap_cpu_block_t *block, int box[4]) {
+    box[0] = max_int(block->x / 2 - 1, 0);
+    box[1] = max_int(block->y / 2 - 1, 0);
+    box[2] = min_int((block->x + block->width - 1) / 2 + 1, chroma_width(cpu) - 1);
+    box[3] = min_int((block->y + block->height - 1) / 2 + 1, chroma_height(cpu) - 1);
+}
+
+// Bytes that the staged copy of a block takes.
+static size_t staged_size(const remap_cpu_t *cpu, const remap_cpu_block_t *block) {
+    if (cpu->src_format == REMAP_CPU_YUYV)
+        return (size_t) block->width * block->height * 2;
+    int box[4];
+    chroma_box(cpu, block, box);
+    return (size_t) block->width * block->height + (size_t) (box[2] - box[0] + 1) * (box[3] - box[1] + 1) * 2;
+}
+
+static int num_tiles(const remap_cpu_t *cpu) {
+    const int tiles_x = (cpu->dst_width + REMAP_CPU_TILE_WIDTH - 1) / REMAP_CPU_TILE_WIDTH;
+    return tiles_x * (cpu->dst_height / MAP_STEP_HEIGHT);
+}
+
+// Computes the source bounding box of every tile from the map (and the blend
+// map).  Has to be called again whenever the map or the filter changes.  A
+// per-frame transform moves the boxes, so the tiles then gather directly.
+bool remap_cpu_prepare(remap_cpu_t *cpu) {
+    if (cpu->transform) {
+        remap_cpu_destroy(cpu);
+        return true;
+    }
+    if (!cpu->blocks) {
+        cpu->blocks = (remap_cpu_block_t *) malloc(num_tiles(cpu) * sizeof(remap_cpu_block_t));
+        cpu->staging = (uint8_t *) malloc(REMAP_CPU_STAGING_BYTES);
+        if (!cpu->blocks || !cpu->staging) {
+            fprintf(stderr, "ERROR: failed to allocate staging buffers\n");
+            remap_cpu_destroy(cpu);
+            return false;
+        }
+    }
+
+    remap_cpu_block_t *block = cpu->blocks;
+    unsigned int staged = 0;
+    for (int ty = 0; ty < cpu->dst_height; ty += MAP_STEP_HEIGHT) {
+        for (int tx = 0; tx < cpu->dst_width; tx += REMAP_CPU_TILE_WIDTH, ++block) {
+            int box[4] = {cpu->src_width, cpu->src_height, 0, 0};
+            for (int y = ty; y < ty + MAP_STEP_HEIGHT; ++y) {
+                for (int x = tx; x < min_int(tx + REMAP_CPU_TILE_WIDTH, cpu->dst_width); ++x) {
+                    const size_t i = map_index(x, y, cpu->dst_width);
+                    extend_box(cpu, map_entry(cpu, x, y, i), box);
+                    if (cpu->blend_map && cpu->blend_weights[i] > 0)
+                        extend_box(cpu, cpu->blend_map[i], box);
+                }
+            }
+            // whole YUYV pairs, for the chroma of either texel
+            box[0] &= ~1;
+            box[2] |= 1;
+            block->x = box[0];
+            block->y = box[1];
+            block->width = box[2] - box[0] + 1;
+            block->height = box[3] - box[1] + 1;
+            if (staged_size(cpu, block) <= REMAP_CPU_STAGING_BYTES) {
+                ++staged;
+            } else {
+                block->width = 0;
+                block->height = 0;
+            }
+        }
+    }
+    fprintf(stderr, "cpu: %u of %d tiles gather from a staged block\n", staged, num_tiles(cpu));
+    return true;
+}
+
+void remap_cpu_destroy(remap_cpu_t *cpu) {
+    free(cpu->blocks);
+    free(cpu->staging);
+    cpu->blocks = NULL;
+    cpu->staging = NULL;
+}
+
+static void copy_rows(uint8_t *dst, const uint8_t *src, int src_stride, int rows, size_t row_bytes) {
+    for (int y = 0; y < rows; ++y)
+        memcpy(dst + y * row_bytes, src + (size_t) y * src_stride, row_bytes);
+}
+
+// Copies the source block of the tile to the staging buffer, or leaves the
+// tile gathering from the frame if it has none.
+static void stage(const remap_cpu_t *cpu, const remap_cpu_block_t *block, const uint8_t *src, source_t *source) {
+    const bool planar = cpu->src_format != REMAP_CPU_YUYV;
+    const int bytes_per_texel = planar ? 1 : 2;
+    memset(source, 0, sizeof(*source));
+    source->data = src;
+    source->stride = cpu->src_width * bytes_per_texel;
+    if (planar) {
+        const uint8_t *chroma = src + (size_t) source->stride * cpu->src_plane_height;
+        source->chroma_stride = cpu->src_format == REMAP_CPU_NV12 ? source->stride : source->stride / 2;
+        source->chroma_step = cpu->src_format == REMAP_CPU_NV12 ? 2 : 1;
+        source->u = chroma;
+        source->v = cpu->src_format == REMAP_CPU_NV12 ? chroma + 1 : chroma + (size_t) source->chroma_stride * (cpu->src_plane_height / 2);
+    }
+    if (!block || block->width == 0)
+        return;
+
+    const size_t row_bytes = (size_t) block->width * bytes_per_texel;
+    copy_rows(cpu->staging, src + (size_t) block->y * source->stride + (size_t) block->x * bytes_per_texel, source->stride, block->height, row_bytes);
+    source->data = cpu->staging;
+    source->x = block->x;
+    source->y = block->y;
+    source->stride = (int) row_bytes;
+    if (!planar)
+        return;
+
+    int box[4];
+    chroma_box(cpu, block, box);
+    const int step = source->chroma_step;
+    const size_t chroma_bytes = (size_t) (box[2] - box[0] + 1) * step;
+    const int chroma_rows = box[3] - box[1] + 1;
+    const size_t from = (size_t) box[1] * source->chroma_stride + (size_t) box[0] * step;
+    uint8_t *staged_u = cpu->staging + row_bytes * block->height;
+    copy_rows(staged_u, source->u + from, source->chroma_stride, chroma_rows, chroma_bytes);
+    if (step == 1) {
+        uint8_t *staged_v = staged_u + chroma_bytes * chroma_rows;
+        copy_rows(staged_v, source->v + from, source->chroma_stride, chroma_rows, chroma_bytes);
+        source->v = staged_v;
+    } else {
+        source->v = staged_u + 1;
+    }
+    source->u = staged_u;
+    source->chroma_x = box[0];
+    source->chroma_y = box[1];
+    source->chroma_stride = (int) chroma_bytes;
+}
+
+void remap_cpu_process(const remap_cpu_t *cpu, const uint8_t *src, uint8_t *dst) {
+    const int width = cpu->dst_width;
+    const int stride = cpu->dst_buffer_width;
+    uint8_t *dst_y = dst;
+    uint8_t *dst_u = dst_y + cpu->dst_buffer_width * cpu->dst_buffer_height;
+    uint8_t *dst_v = dst_u + cpu->dst_buffer_width * cpu->dst_buffer_height / 4;
+    const bool full_chroma = (cpu->color && (cpu->color->matrix_enabled || cpu->color->lut_size > 0))
+        || (cpu->rgb && !cpu->luma_only);
+    const remap_cpu_block_t *block = cpu->blocks;
+    float matrix[9], offset[3];
+
+    if (cpu->color)
+        color_matrix_for_unorm(cpu->color, matrix, offset);
+    if (cpu->pyramid)
+        pyramid_begin(cpu->pyramid);
+
+    for (int ty = 0; ty < cpu->dst_height; ty += MAP_STEP_HEIGHT) {
+        for (int tx = 0; tx < width; tx += REMAP_CPU_TILE_WIDTH) {
+            source_t source;
+            stage(cpu, block, src, &source);
+            if (block)
+                ++block;
+
+            for (int y = ty; y < ty + MAP_STEP_HEIGHT; ++y) {
+                const size_t row = map_index(0, y, width);
+                const int end = min_int(tx + REMAP_CPU_TILE_WIDTH, width);
+                uint8_t rgb_yuv[REMAP_CPU_TILE_WIDTH * 3];
+                for (int x = tx; x < end; ++x) {
+                    const size_t i = row + (size_t) (x / MAP_STEP_WIDTH) * MAP_STEP_WIDTH * MAP_STEP_HEIGHT + x % MAP_STEP_WIDTH;
+                    const bool chroma_site = !cpu->luma_only && ((x | y) & 1) == 0;
+                    int yuv[3];
+
+                    sample(cpu, &source, map_entry(cpu, x, y, i), full_chroma || chroma_site, yuv);
+
+                    if (cpu->blend_map && cpu->blend_weights[i] > 0) {
+                        const int w = cpu->blend_weights[i];
+                        int other[3];
+                        sample(cpu, &source, cpu->blend_map[i], full_chroma || chroma_site, other);
+                        for (int c = 0; c < 3; ++c) {
+                            yuv[c] += ((other[c] - yuv[c]) * w + BLEND_WEIGHT_ONE / 2) / BLEND_WEIGHT_ONE;
+                        }
+                    }
+                    if (cpu->gain_map) {
+                        yuv[0] = clamp_int((yuv[0] * cpu->gain_map[i] + GAIN_MAP_ONE / 2) / GAIN_MAP_ONE, 0, 255);
+                    }
+                    if (full_chroma) {
+                        apply_color(cpu, matrix, offset, yuv);
+                    }
+
+                    dst_y[y * stride + x] = (uint8_t) yuv[0];
+                    if (cpu->stats)
+                        luma_stats_add(cpu->stats, x, y, yuv[0]);
+                    if (cpu->rgb) {
+                        uint8_t *p = rgb_yuv + (x - tx) * 3;
+                        p[0] = (uint8_t) yuv[0];
+                        p[1] = cpu->luma_only ? 128 : (uint8_t) yuv[1];
+                        p[2] = cpu->luma_only ? 128 : (uint8_t) yuv[2];
+                    }
+                    if (chroma_site) {
+                        dst_u[(y / 2) * (stride / 2) + x / 2] = (uint8_t) yuv[1];
+                        dst_v[(y / 2) * (stride / 2) + x / 2] = (uint8_t) yuv[2];
+                    }
+                }
+                // converted per tile row, in a loop of the output format
+                if (cpu->rgb)
+                    rgb_output_put_row(cpu->rgb, tx, y, rgb_yuv, end - tx);
+            }
+        }
+        if (cpu->pyramid)
+            pyramid_update(cpu->pyramid, dst, stride, cpu->dst_buffer_height, ty + MAP_STEP_HEIGHT);
+    }
+}
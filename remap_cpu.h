@@ -0,0 +1,75 @@
+#ifndef REMAP_CPU_H
+#define REMAP_CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "color.h"
+#include "blend.h"
+#include "map_util.h"
+#include "delta_map.h"
+#include "luma_stats.h"
+#include "pyramid.h"
+#include "rgb_output.h"
+
+// Output tiles of REMAP_CPU_TILE_WIDTH x MAP_STEP_HEIGHT pixels gather from a
+// copy of their source bounding box as long as it fits in the staging buffer,
+// which is small enough to stay in the L1 cache.
+#define REMAP_CPU_TILE_WIDTH    64
+#define REMAP_CPU_STAGING_BYTES (16 * 1024)
+
+typedef struct {
+    int16_t x;              // even, so that the block starts with a full YUYV pair or chroma texel
+    int16_t y;
+    int16_t width;          // 0 if the tile gathers from the frame directly
+    int16_t height;
+} remap_cpu_block_t;
+
+typedef enum {
+    REMAP_CPU_YUYV,         // packed, 2 bytes per texel
+    REMAP_CPU_I420,         // Y, then U and V at half resolution
+    REMAP_CPU_NV12,         // Y, then interleaved U and V at half resolution
+} remap_cpu_format_t;
+
+// Reference implementation of the remap kernel on the ARM cores.  It samples
+// the YUYV source the way the TMU does (bilinear, clamp to edge) and writes
+// the same I420 output as the QPU kernel.  Planar sources are sampled per
+// plane, with chroma at its own half resolution.
+typedef struct {
+    int src_width;          // texture width (power of 2)
+    int src_height;
+    remap_cpu_format_t src_format;
+    int src_plane_height;   // rows of the luma plane of a planar source
+    int dst_width;          // map width
+    int dst_height;         // map height
+    int dst_buffer_width;
+    int dst_buffer_height;
+    const uint32_t *map;
+    const stereo_map_header_t *stereo; // the map only holds the left eye, NULL if disabled
+    const delta_map_t *delta; // decodes the entries instead of the map, NULL if disabled
+    const uint8_t *gain_map; // NULL if disabled
+    const uint32_t *blend_map; // second coordinates, NULL if disabled
+    const uint8_t *blend_weights;
+    const float *transform; // per-frame homography in texture coordinates (8 params), NULL if disabled
+    const color_t *color;
+    bool nearest;           // nearest instead of bilinear sampling
+    bool luma_only;         // leaves the chroma planes untouched
+    pyramid_t *pyramid;     // downsampled after every tile row, NULL if disabled
+    luma_stats_t *stats;    // accumulates the output luma, NULL if disabled
+    rgb_output_t *rgb;      // converted from full resolution chroma, NULL if disabled
+
+    float scale_s;
+    float offset_s;
+    float scale_t;
+    float offset_t;
+
+    remap_cpu_block_t *blocks; // source bounding box of every tile, NULL if disabled
+    uint8_t *staging;
+} remap_cpu_t;
+
+void remap_cpu_init(remap_cpu_t *cpu);
+bool remap_cpu_prepare(remap_cpu_t *cpu);
+void remap_cpu_destroy(remap_cpu_t *cpu);
+void remap_cpu_process(const remap_cpu_t *cpu, const uint8_t *src, uint8_t *dst);
+
+#endif
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <interface/vcsm/user-vcsm.h>
+
+#include "remap_qpu.h"
+#include "qpu_util.h"
+#include "mailbox.h"
+#include "motion.h"
+#include "map_util.h"
+
+// milliseconds that the mailbox waits for the kernel
+#define REMAP_QPU_TIMEOUT_MS 2000
+
+// the mip variants read the level table address from this uniform, followed
+// by texture config 0-3 of each smaller level
+#define MIP_UNIFORM 44
+// the kernel reads the table up to 2 steps past the last one
+#define MIP_TABLE_PADDING 8
+// the stereo variants read the stereo table address from this uniform
+#define STEREO_UNIFORM 53
+// words of the table before the per-step entries, and steps that the kernel
+// reads past the last one
+#define STEREO_TABLE_HEAD 2
+#define STEREO_TABLE_PADDING 6
+
+static unsigned int float_as_uint(float f) {
+    unsigned int u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+bool remap_qpu_init(remap_qpu_t *qpu, int mb, int num_qpus, const kernel_t *kernel) {
+    qpu->mb = mb;
+    return vcsm_util_program_create(&qpu->program, num_qpus, *kernel->code_len)
+        && vcsm_util_program_load_from_memory(&qpu->program, kernel->code, *kernel->code_len);
+}
+
+void remap_qpu_destroy(remap_qpu_t *qpu) {
+    if (qpu->program.mmap == NULL)
+        return;
+    vcsm_util_program_destroy(&qpu->program);
+    qpu->program.mmap = NULL;
+}
+
+unsigned int remap_qpu_code(const remap_qpu_t *qpu) {
+    return qpu->program.buffer.vc_mem_addr + offsetof(vcsm_util_program_mmap_t, code);
+}
+
+unsigned int remap_qpu_uniforms(const remap_qpu_t *qpu, int index) {
+    return qpu->program.buffer.vc_mem_addr + offsetof(vcsm_util_program_mmap_t, uniforms)
+        + index * MAX_NUM_UNIFORMS * sizeof(unsigned int);
+}
+
+// Fills the uniforms (see assemble_kernel.py) and the mailbox messages of
+// every QPU for one frame.
+void remap_qpu_write_uniforms(remap_qpu_t *qpu, unsigned int src, unsigned int dst, uint32_t sequence) {
+    vcsm_lock(qpu->program.buffer.handle);
+
+    float matrix[9], matrix_offset[3];
+    color_matrix_for_unorm(qpu->color, matrix, matrix_offset);
+
+    // 0: bilinear, 1: nearest
+    unsigned int filter = qpu->nearest ? 1 : 0;
+    unsigned int vc_code = remap_qpu_code(qpu);
+    unsigned int *uniforms = qpu->program.mmap->uniforms;
+
+    for (int i = 0; i < qpu->program.num_qpus; ++i) {
+        int offset = i * MAX_NUM_UNIFORMS;
+        unsigned int uniform_ptr = remap_qpu_uniforms(qpu, i);
+
+        uniforms[offset++] = uniform_ptr;
+        uniforms[offset++] = texture_config_0(src, 0, 17); // texture config 0
+        uniforms[offset++] = texture_config_1(qpu->src_height, qpu->src_width, filter, filter, 1, 1, 17); // texture config 1
+        uniforms[offset++] = 0; // texture config 2
+        uniforms[offset++] = 0; // texture config 3
+        uniforms[offset++] = (unsigned int) i; // qpu id
+        uniforms[offset++] = qpu->map;
+        uniforms[offset++] = dst; // pointer to frame buffer
+        uniforms[offset++] = vpm_write_y_config((unsigned int) i); // vpm write y config
+        uniforms[offset++] = vpm_write_uv_config((unsigned int) i); // vpm write uv config
+        uniforms[offset++] = qpu->dst_width / 128; // x tile count
+        uniforms[offset++] = qpu->dst_height / 12; // y tile count
+        uniforms[offset++] = qpu->dst_buffer_width; // frame buffer width
+        uniforms[offset++] = qpu->dst_buffer_height; // frame buffer height
+        uniforms[offset++] = dma_store_y_config((unsigned int) i); // dma store y config
+        uniforms[offset++] = dma_store_uv_config((unsigned int) i); // dma store uv config
+        uniforms[offset++] = dma_load_map_config(); // dma load map config
+        uniforms[offset++] = vpm_read_map_config((unsigned int) i); // vpm read map config
+        uniforms[offset++] = qpu->gain_map; // gain map base address
+        for (int j = 0; j < 9; ++j)
+            uniforms[offset++] = float_as_uint(matrix[j]); // color matrix
+        for (int j = 0; j < 3; ++j)
+            uniforms[offset++] = float_as_uint(matrix_offset[j]); // color offset
+        uniforms[offset++] = qpu->blend_map; // blend map base address
+        uniforms[offset++] = qpu->blend_weights; // blend weight base address
+        for (int j = 0; j < MOTION_NUM_PARAMS; ++j)
+            uniforms[offset++] = qpu->transform ? float_as_uint(qpu->transform[j]) : 0; // transform
+        uniforms[offset++] = qpu->doorbell; // doorbell address
+        uniforms[offset++] = sequence; // sequence number
+        uniforms[offset++] = qpu->done; // done flag address
+        if (qpu->mip_table) {
+            uniforms[offset++] = qpu->mip_table; // level table address
+            for (int level = 1; level <= MIP_MAX_LEVELS; ++level) {
+                uniforms[offset++] = texture_config_0(qpu->mip_levels[level - 1], 0, 17); // texture config 0
+                uniforms[offset++] = texture_config_1(qpu->src_height >> level, qpu->src_width >> level, filter, filter, 1, 1, 17); // texture config 1
+                uniforms[offset++] = 0; // texture config 2
+                uniforms[offset++] = 0; // texture config 3
+            }
+        }
+        if (qpu->stereo_table)
+            uniforms[i * MAX_NUM_UNIFORMS + STEREO_UNIFORM] = qpu->stereo_table; // stereo table address
+
+        qpu->program.mmap->msg[2*i] = uniform_ptr;
+        qpu->program.mmap->msg[2*i+1] = vc_code;
+    }
+
+    vcsm_unlock_ptr(qpu->program.buffer.usr_mem_ptr);
+}
+
+// Runs the kernel through the mailbox and waits for it.
+bool remap_qpu_execute(remap_qpu_t *qpu) {
+    if (execute_qpu(qpu->mb, qpu->program.num_qpus, qpu->program.vc_msg, 1, REMAP_QPU_TIMEOUT_MS) != 0) {
+        fprintf(stderr, "ERROR: failed to execute the kernel\n");
+        return false;
+    }
+    return true;
+}
+
+// Remaps one frame: src and dst have to be pointers to vcsm buffers (or
+// zero copy MMAL buffers).
+bool remap_qpu_process(remap_qpu_t *qpu, const uint8_t *src, uint8_t *dst) {
+    unsigned int vc_handle_input = vcsm_vc_hdl_from_ptr((void *) src);
+    unsigned int vc_handle_output = vcsm_vc_hdl_from_ptr(dst);
+    if (vc_handle_input == 0 || vc_handle_output == 0) {
+        fprintf(stderr, "ERROR: the qpu backend needs frames in GPU memory\n");
+        return false;
+    }
+    unsigned int frameptr_input = mem_lock(qpu->mb, vc_handle_input);
+    unsigned int frameptr_output = mem_lock(qpu->mb, vc_handle_output);
+
+    bool result = false;
+    if (qpu_enable(qpu->mb, 1)) {
+        fprintf(stderr, "ERROR: failed to enable QPU\n");
+        goto error;
+    }
+    remap_qpu_write_uniforms(qpu, frameptr_input, frameptr_output, 0);
+    result = remap_qpu_execute(qpu);
+    if (qpu_enable(qpu->mb, 0)) {
+        fprintf(stderr, "ERROR: failed to disable QPU\n");
+    }
+
+error:
+    mem_unlock(qpu->mb, vc_handle_input);
+    mem_unlock(qpu->mb, vc_handle_output);
+    return result;
+}
+
+bool remap_qpu_downsample_init(remap_qpu_downsample_t *ds, int mb, int num_qpus) {
+    const kernel_t *kernel = kernel_downsample();
+    ds->mb = mb;
+    return vcsm_util_program_create(&ds->program, num_qpus, *kernel->code_len)
+        && vcsm_util_program_load_from_memory(&ds->program, kernel->code, *kernel->code_len);
+}
+
+void remap_qpu_downsample_destroy(remap_qpu_downsample_t *ds) {
+    if (ds->program.mmap == NULL)
+        return;
+    vcsm_util_program_destroy(&ds->program);
+    ds->program.mmap = NULL;
+}
+
+// Runs the downsample kernel (see assemble_kernel.py) on a frame of the source
+// texture.  The QPUs take the rows of each level in turn, and a lookup at a
+// texel corner samples the 2x2 source texels around it: at 2x, 2x + 1 of the
+// half size level, and at 4x + 1, 4x + 3 of the quarter size level.
+bool remap_qpu_downsample(remap_qpu_downsample_t *ds, const mip_source_t *mip, unsigned int src) {
+    if (mip->num_used == 0)
+        return true;
+    vcsm_lock(ds->program.buffer.handle);
+
+    const int num_qpus = ds->program.num_qpus;
+    const float texel_s = 1.0f / mip->width;
+    const float texel_t = 1.0f / mip->height;
+    unsigned int code = ds->program.buffer.vc_mem_addr + offsetof(vcsm_util_program_mmap_t, code);
+    unsigned int *uniforms = ds->program.mmap->uniforms;
+
+    for (int i = 0; i < num_qpus; ++i) {
+        int offset = i * MAX_NUM_UNIFORMS;
+        unsigned int uniform_ptr = ds->program.buffer.vc_mem_addr + offsetof(vcsm_util_program_mmap_t, uniforms)
+            + offset * sizeof(unsigned int);
+
+        uniforms[offset++] = uniform_ptr;
+        uniforms[offset++] = texture_config_0(src, 0, 17); // texture config 0
+        uniforms[offset++] = texture_config_1(mip->height, mip->width, 0, 0, 1, 1, 17); // texture config 1 (bilinear)
+        uniforms[offset++] = 0; // texture config 2
+        uniforms[offset++] = 0; // texture config 3
+        uniforms[offset++] = (unsigned int) i; // qpu id
+        uniforms[offset++] = vpm_write_level_config((unsigned int) i); // vpm write level config
+        uniforms[offset++] = dma_store_level_config((unsigned int) i); // dma store level config
+        for (int level = 1; level <= MIP_MAX_LEVELS; ++level) {
+            const int scale = 1 << level; // source texels per level texel
+            const int height = mip->height >> level;
+            const unsigned int stride = (unsigned int) (mip->width >> level) * 2;
+            const int rows = level <= mip->num_used && i < height ? (height - i + num_qpus - 1) / num_qpus : 0;
+            uniforms[offset++] = float_as_uint(texel_s); // s coord of lane 0
+            uniforms[offset++] = float_as_uint(2 * scale * texel_s); // s increment (lane)
+            uniforms[offset++] = float_as_uint(scale * texel_s); // s offset of the second texel
+            uniforms[offset++] = float_as_uint(32 * scale * texel_s); // s increment (step)
+            uniforms[offset++] = float_as_uint(2 * texel_s); // s offset of the second tap
+            uniforms[offset++] = float_as_uint((scale * i + 1) * texel_t); // t coord of the first row
+            uniforms[offset++] = float_as_uint(scale * num_qpus * texel_t); // t increment (row)
+            uniforms[offset++] = float_as_uint(2 * texel_t); // t offset of the second tap
+            uniforms[offset++] = level <= mip->num_used ? mip->levels[level - 1].vc_mem_addr + stride * i : 0; // level address
+            uniforms[offset++] = stride * num_qpus; // level address increment (row)
+            uniforms[offset++] = (unsigned int) rows; // row count
+            uniforms[offset++] = (unsigned int) (mip->width >> level) / 32; // step count
+        }
+
+        ds->program.mmap->msg[2*i] = uniform_ptr;
+        ds->program.mmap->msg[2*i+1] = code;
+    }
+
+    vcsm_unlock_ptr(ds->program.buffer.usr_mem_ptr);
+
+    if (execute_qpu(ds->mb, num_qpus, ds->program.vc_msg, 1, REMAP_QPU_TIMEOUT_MS) != 0) {
+        fprintf(stderr, "ERROR: failed to execute the downsample kernel\n");
+        return false;
+    }
+    return true;
+}
+
+size_t remap_qpu_mip_table_size(int width, int height) {
+    return ((size_t) (width / MAP_STEP_WIDTH) * (height / MAP_STEP_HEIGHT) + MIP_TABLE_PADDING) * sizeof(uint32_t);
+}
+
+// Fills the level table in the order the kernel takes the steps, one word per
+// step that all QPUs share: the offset of the texture config of the step's
+// level from u1.  Returns the highest level that any step samples.
+int remap_qpu_build_mip_table(uint32_t *table, const uint32_t *map, int width, int height, int src_width, int src_height, int max_level) {
+    int used = 0;
+    int counts[MIP_MAX_LEVELS + 1] = {0};
+    for (int y = 0; y < height; y += MAP_STEP_HEIGHT) {
+        for (int x = 0; x < width; x += MAP_STEP_WIDTH) {
+            const int level = mip_step_level(map, x, y, width, height, src_width, src_height, max_level);
+            *table++ = level == 0 ? 0 : (MIP_UNIFORM + (level - 1) * 4) * sizeof(uint32_t);
+            counts[level]++;
+            if (level > used)
+                used = level;
+        }
+    }
+    memset(table, 0, MIP_TABLE_PADDING * sizeof(uint32_t));
+    fprintf(stderr, "mip: %d full, %d half, %d quarter size steps\n", counts[0], counts[1], counts[2]);
+    return used;
+}
+
+size_t remap_qpu_stereo_table_size(int width, int height) {
+    const size_t steps = (size_t) (width / MAP_STEP_WIDTH) * (height / MAP_STEP_HEIGHT);
+    return (STEREO_TABLE_HEAD + 3 * (steps + STEREO_TABLE_PADDING)) * sizeof(uint32_t);
+}
+
+// Returns the map offset of step m (in the order the kernel takes the steps)
+// and the offsets of its coordinates.  A compact stereo map holds the left eye
+// only, so the steps of the right eye point back into the left eye of the row.
+static uint32_t stereo_step(const stereo_map_header_t *stereo, int width, size_t m, size_t steps, float *offset_s, float *offset_t) {
+    const size_t step_size = MAP_STEP_WIDTH * MAP_STEP_HEIGHT * sizeof(uint32_t);
+    *offset_s = 0.0f;
+    *offset_t = 0.0f;
+    if (m >= steps)
+        return 0;
+    if (!stereo)
+        return (uint32_t) (m * step_size);
+    const size_t row_steps = (size_t) width / MAP_STEP_WIDTH;
+    const size_t eye_steps = row_steps / 2;
+    const size_t column = m % row_steps;
+    if (column >= eye_steps) {
+        *offset_s = (float) stereo->offset_s;
+        *offset_t = (float) stereo->offset_t;
+    }
+    return (uint32_t) (((m / row_steps) * eye_steps + column % eye_steps) * step_size);
+}
+
+// Fills the stereo table in the order the kernel reads it: the map offsets of
+// the first 2 steps, then for every step the map offset of the step 2 ahead
+// (loaded while the step is read) and the s and t offsets of the step, all
+// shared by the QPUs.  stereo is NULL for a map stored whole, which the table
+// walks in order.
+void remap_qpu_build_stereo_table(uint32_t *table, const stereo_map_header_t *stereo, int width, int height) {
+    const size_t steps = (size_t) (width / MAP_STEP_WIDTH) * (height / MAP_STEP_HEIGHT);
+    float offset_s, offset_t;
+    for (size_t m = 0; m < STEREO_TABLE_HEAD; ++m)
+        *table++ = stereo_step(stereo, width, m, steps, &offset_s, &offset_t);
+    for (size_t m = 0; m < steps + STEREO_TABLE_PADDING; ++m) {
+        float ahead_s, ahead_t;
+        *table++ = stereo_step(stereo, width, m + STEREO_TABLE_HEAD, steps, &ahead_s, &ahead_t);
+        stereo_step(stereo, width, m, steps, &offset_s, &offset_t);
+        *table++ = float_as_uint(offset_s);
+        *table++ = float_as_uint(offset_t);
+    }
+}
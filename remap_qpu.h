@@ -0,0 +1,67 @@
+#ifndef REMAP_QPU_H
+#define REMAP_QPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vcsm_util.h"
+#include "color.h"
+#include "kernels.h"
+#include "mip.h"
+#include "map_util.h"
+
+#define NUM_QPUS          12
+
+// the kernel streams the map up to 8 steps (768 bytes each) past the last tile
+#define MAP_PADDING       (8 * 64 * NUM_QPUS)
+#define GAIN_MAP_PADDING  (8 * 16 * NUM_QPUS)
+
+// Runs one of the kernel variants on the QPUs.  The source texture, the
+// output frame and the maps have to be in GPU memory, and are passed by bus
+// address.
+typedef struct {
+    int mb;
+    vcsm_util_program_t program;
+    int src_width;          // texture width (power of 2)
+    int src_height;
+    int dst_width;          // map width
+    int dst_height;         // map height
+    int dst_buffer_width;
+    int dst_buffer_height;
+    unsigned int map;
+    unsigned int gain_map;  // 0 if disabled
+    unsigned int blend_map; // 0 if disabled
+    unsigned int blend_weights;
+    const color_t *color;
+    const float *transform; // per-frame homography (8 params), NULL if disabled
+    bool nearest;           // nearest instead of bilinear sampling
+    unsigned int doorbell;  // persistent mode, 0 if the kernel ends after the frame
+    unsigned int done;
+    unsigned int mip_table; // level table of the mip variants, 0 if disabled
+    unsigned int mip_levels[MIP_MAX_LEVELS]; // half and quarter size source textures
+    unsigned int stereo_table; // step table of the stereo variants, 0 if disabled
+} remap_qpu_t;
+
+// Generates the used levels of a mip source from the source texture on the
+// QPUs, in a launch of the downsample kernel before the remap kernel.
+typedef struct {
+    int mb;
+    vcsm_util_program_t program;
+} remap_qpu_downsample_t;
+
+bool remap_qpu_init(remap_qpu_t *qpu, int mb, int num_qpus, const kernel_t *kernel);
+void remap_qpu_destroy(remap_qpu_t *qpu);
+unsigned int remap_qpu_code(const remap_qpu_t *qpu);
+unsigned int remap_qpu_uniforms(const remap_qpu_t *qpu, int index);
+void remap_qpu_write_uniforms(remap_qpu_t *qpu, unsigned int src, unsigned int dst, uint32_t sequence);
+bool remap_qpu_execute(remap_qpu_t *qpu);
+bool remap_qpu_process(remap_qpu_t *qpu, const uint8_t *src, uint8_t *dst);
+size_t remap_qpu_mip_table_size(int width, int height);
+bool remap_qpu_downsample_init(remap_qpu_downsample_t *ds, int mb, int num_qpus);
+void remap_qpu_downsample_destroy(remap_qpu_downsample_t *ds);
+bool remap_qpu_downsample(remap_qpu_downsample_t *ds, const mip_source_t *mip, unsigned int src);
+int remap_qpu_build_mip_table(uint32_t *table, const uint32_t *map, int width, int height, int src_width, int src_height, int max_level);
+size_t remap_qpu_stereo_table_size(int width, int height);
+void remap_qpu_build_stereo_table(uint32_t *table, const stereo_map_header_t *stereo, int width, int height);
+
+#endif
@@ -4,9 +4,8 @@
 
 #include "remapvid.h"
 #include "vcsm_util.h"
-#include "qpu_util.h"
 #include "mailbox.h"
-#include "kernel.h"
+#include "v3d_util.h"
 
 uint32_t next_pow2(uint32_t x) {
 	x--;
@@ -21,6 +20,182 @@ uint32_t next_pow2(uint32_t x) {
 
 volatile bool is_running = true;
 
+double startup_elapsed_ms(STARTUP_T *startup) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - startup->origin.tv_sec) * 1e3 + (now.tv_nsec - startup->origin.tv_nsec) / 1e6;
+}
+
+int startup_begin(STARTUP_T *startup, const char *name) {
+	if (startup->num_phases >= MAX_STARTUP_PHASES)
+		return -1;
+	STARTUP_PHASE_T *phase = &startup->phases[startup->num_phases];
+	phase->name = name;
+	phase->begin_ms = startup_elapsed_ms(startup);
+	phase->end_ms = 0;
+	return startup->num_phases++;
+}
+
+void startup_end(STARTUP_T *startup, int index) {
+	if (index >= 0)
+		startup->phases[index].end_ms = startup_elapsed_ms(startup);
+}
+
+void startup_print(STARTUP_T *startup, FILE *fp) {
+	fprintf(fp, "startup (ms from launch):\n");
+	for (int i = 0; i < startup->num_phases; ++i) {
+		STARTUP_PHASE_T *phase = &startup->phases[i];
+		fprintf(fp, "  %-8s %8.1f - %8.1f (%8.1f)\n", phase->name, phase->begin_ms, phase->end_ms, phase->end_ms - phase->begin_ms);
+	}
+	fprintf(fp, "  first encoded frame: %.1f\n", startup->first_frame_ms);
+	startup->printed = true;
+}
+
+// A stereo map whose right eye only adds an offset to the left eye.
+bool is_offset_stereo(const map_format_t *format) {
+	return format->is_stereo && !(format->stereo.flags & STEREO_MAP_MIRROR);
+}
+
+// Whether a map is kept as stored in the file.  The cpu backend derives the
+// right eye of a stereo map and decodes delta maps on the fly, the stereo
+// kernel variants read the left eye of an offset stereo map through the
+// stereo table.  Otherwise the kernel needs the whole map.
+bool is_compact_map(CONTEXT_T *context, const map_format_t *format) {
+	if (context->backend == BACKEND_CPU)
+		return true;
+	return (context->kernel_features & KERNEL_STEREO) && is_offset_stereo(format);
+}
+
+// Size of a map as it is kept in memory.
+size_t stored_map_size(CONTEXT_T *context, const map_format_t *format) {
+	return map_file_stored_size(format, context->video_width, context->video_height, is_compact_map(context, format));
+}
+
+// Bytes of a captured frame: YUYV, or luma plane rows aligned to 16 and the
+// chroma at half resolution.
+size_t camera_frame_size(CONTEXT_T *context) {
+	if (context->camera_format == REMAP_CPU_YUYV)
+		return (size_t) context->camera_buffer_width * context->camera_buffer_height * 2;
+	return (size_t) context->camera_buffer_width * context->camera_plane_height * 3 / 2;
+}
+
+// Buffers that only the ARM reads are cached on the ARM side.
+bool create_gpu_buffer(CONTEXT_T *context, vcsm_util_buffer_t *buffer, size_t size) {
+	if (context->backend == BACKEND_CPU)
+		return vcsm_util_buffer_create_cached(buffer, size);
+	return vcsm_util_buffer_create(buffer, size);
+}
+
+bool load_map_file(CONTEXT_T *context, vcsm_util_buffer_t *map, FILE *fp, map_format_t *format) {
+	return map_file_load(map, fp, format, context->video_width, context->video_height, is_compact_map(context, format));
+}
+
+// Fills the level table of --mip from a loaded map, and returns the highest
+// level that it refers to.
+int build_mip_table(CONTEXT_T *context, vcsm_util_buffer_t *table, vcsm_util_buffer_t *map) {
+	uint32_t *entries = (uint32_t *) vcsm_lock(map->handle);
+	uint32_t *words = (uint32_t *) vcsm_lock(table->handle);
+	int used = remap_qpu_build_mip_table(words, entries, context->video_width, context->video_height,
+		context->camera_buffer_width, context->camera_buffer_height, context->mip_levels);
+	vcsm_unlock_ptr(words);
+	vcsm_unlock_ptr(entries);
+	return used;
+}
+
+// Fills the stereo table of a map for the stereo kernel variants.  A map that
+// is kept whole gets a table that walks it in order.
+void build_stereo_table(CONTEXT_T *context, vcsm_util_buffer_t *table, const map_format_t *format) {
+	uint32_t *words = (uint32_t *) vcsm_lock(table->handle);
+	remap_qpu_build_stereo_table(words, is_compact_map(context, format) ? &format->stereo : NULL, context->video_width, context->video_height);
+	vcsm_unlock_ptr(words);
+}
+
+// Reads the map and the optional gain and blend maps into the buffers that
+// main() has already created.
+void *load_maps(void *arg) {
+	CONTEXT_T *context = (CONTEXT_T *)arg;
+	if (context->map_source.map_x) {
+		// OpenCV matrices, converted here instead of by convert_maps.py
+		uint32_t *entries = (uint32_t *) vcsm_lock(context->map.handle);
+		bool converted = map_loader_convert(&context->map_source, entries);
+		if (converted && context->map_cache_filename && map_loader_write(context->map_cache_filename, &context->map_source, entries))
+			fprintf(stderr, "map cached in %s\n", context->map_cache_filename);
+		vcsm_unlock_ptr(entries);
+		if (!converted)
+			goto error;
+	} else if (!load_map_file(context, &context->map, context->map_file, &context->map_format)) {
+		goto error;
+	}
+
+	if (context->fallback_map_file && !load_map_file(context, &context->fallback_map, context->fallback_map_file, &context->fallback_map_format))
+		goto error;
+
+	if (context->gain_map_file && !color_load_gain_map(&context->gain_map, context->gain_map_file, context->video_width, context->video_height))
+		goto error;
+
+	if (context->blend_map_file && !blend_load_map(&context->blend_map, &context->blend_weights, &context->map, context->blend_map_file, context->video_width, context->video_height))
+		goto error;
+
+	if (context->mip_levels > 0) {
+		// only the levels that a table refers to are generated for every frame
+		int used = build_mip_table(context, &context->mip_table, &context->map);
+		if (context->fallback_map_file) {
+			int fallback_used = build_mip_table(context, &context->fallback_mip_table, &context->fallback_map);
+			if (fallback_used > used)
+				used = fallback_used;
+		}
+		context->mip.num_used = used;
+	}
+
+	if (context->kernel_features & KERNEL_STEREO) {
+		build_stereo_table(context, &context->stereo_table, &context->map_format);
+		if (context->fallback_map_file)
+			build_stereo_table(context, &context->fallback_stereo_table, &context->fallback_map_format);
+	}
+
+	context->maps_loaded = true;
+
+error:
+	startup_end(&context->startup, context->map_phase);
+	return NULL;
+}
+
+// Lists every GPU memory allocation of the configuration, with the kernel
+// features it will have.  The encoder output buffers are in ARM memory, and
+// the working memory of the camera and the encoder firmware is not counted.
+void plan_gpu_memory(CONTEXT_T *context, gpu_budget_t *budget, unsigned int features) {
+	gpu_budget_reset(budget);
+	gpu_budget_add(budget, "map", 1, stored_map_size(context, &context->map_format) + MAP_PADDING);
+	if (context->fallback_map_file)
+		gpu_budget_add(budget, "fallback map", 1, stored_map_size(context, &context->fallback_map_format) + MAP_PADDING);
+	if (features & KERNEL_GAIN_MAP)
+		gpu_budget_add(budget, "gain map", 1, context->video_width * context->video_height + GAIN_MAP_PADDING);
+	if (features & KERNEL_BLEND) {
+		gpu_budget_add(budget, "blend map", 1, context->video_width * context->video_height * sizeof(unsigned int) + MAP_PADDING);
+		gpu_budget_add(budget, "blend weights", 1, context->video_width * context->video_height + GAIN_MAP_PADDING);
+	}
+	if (features & KERNEL_MIP) {
+		for (int i = 1; i <= context->mip_levels; ++i)
+			gpu_budget_add(budget, i == 1 ? "half size source" : "quarter size source", 1, mip_level_size(i, context->camera_buffer_width, context->camera_buffer_height));
+		gpu_budget_add(budget, "mip table", context->fallback_map_file ? 2 : 1, remap_qpu_mip_table_size(context->video_width, context->video_height));
+	}
+	if (features & KERNEL_STEREO)
+		gpu_budget_add(budget, "stereo table", context->fallback_map_file ? 2 : 1, remap_qpu_stereo_table_size(context->video_width, context->video_height));
+	if (context->backend == BACKEND_QPU) {
+		const kernel_t *kernel = kernel_find(features);
+		gpu_budget_add(budget, "program", 1, vcsm_util_program_size(kernel ? *kernel->code_len : 0));
+		if (features & KERNEL_MIP)
+			gpu_budget_add(budget, "downsample program", 1, vcsm_util_program_size(*kernel_downsample()->code_len));
+	}
+	if (context->persistent)
+		gpu_budget_add(budget, "doorbell", 1, DOORBELL_SIZE);
+	if (context->use_shm_input)
+		gpu_budget_add(budget, "input texture", 1, context->camera_buffer_width * context->camera_buffer_height * 2);
+	else
+		gpu_budget_add(budget, "camera buffers", context->num_pool_buffers, camera_frame_size(context));
+	gpu_budget_add(budget, "encoder input buffers", context->num_pool_buffers, context->video_buffer_width * context->video_buffer_height * 3 / 2);
+}
+
 void send_all_buffers_in_pool(MMAL_PORT_T *port, MMAL_POOL_T *pool) {
 	MMAL_BUFFER_HEADER_T *buffer;
 	MMAL_STATUS_T status;
@@ -147,11 +322,17 @@ bool setup_camera(CONTEXT_T *context) {
 	};
 	mmal_port_parameter_set(camera->control, &cam_config.hdr);
 
+	MMAL_FOURCC_T encoding = MMAL_ENCODING_YUYV;
+	if (context->camera_format == REMAP_CPU_I420)
+		encoding = MMAL_ENCODING_I420;
+	else if (context->camera_format == REMAP_CPU_NV12)
+		encoding = MMAL_ENCODING_NV12;
+
 	format = camera_video_port->format;
-	format->encoding = MMAL_ENCODING_YUYV;
-	format->encoding_variant = MMAL_ENCODING_YUYV;
+	format->encoding = encoding;
+	format->encoding_variant = encoding;
 	format->es->video.width = context->camera_buffer_width;
-	format->es->video.height = context->camera_buffer_height;
+	format->es->video.height = context->camera_format == REMAP_CPU_YUYV ? context->camera_buffer_height : context->camera_plane_height;
 	format->es->video.crop.x = 0;
 	format->es->video.crop.y = 0;
 	format->es->video.crop.width = context->camera_width;
@@ -159,8 +340,8 @@ bool setup_camera(CONTEXT_T *context) {
 	format->es->video.frame_rate.num = context->framerate;
 	format->es->video.frame_rate.den = 1;
 
-	camera_video_port->buffer_num = 3;
-	camera_video_port->buffer_size = (format->es->video.width * format->es->video.height * 2);
+	camera_video_port->buffer_num = context->num_pool_buffers;
+	camera_video_port->buffer_size = camera_frame_size(context);
 
 	status = mmal_port_parameter_set_boolean(camera_video_port,
             MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
@@ -177,6 +358,10 @@ bool setup_camera(CONTEXT_T *context) {
 
 	camera_video_pool = (MMAL_POOL_T *)mmal_port_pool_create(camera_video_port,
 		camera_video_port->buffer_num, camera_video_port->buffer_size);
+	if (!camera_video_pool) {
+		fprintf(stderr, "ERROR: failed to create camera buffer pool (%d x %d bytes)\n", camera_video_port->buffer_num, camera_video_port->buffer_size);
+		return false;
+	}
 	context->camera_video_pool = camera_video_pool;
 	camera_video_port->userdata = (struct MMAL_PORT_USERDATA_T *)context;
 
@@ -210,6 +395,9 @@ void encoder_output_port_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffe
 	CONTEXT_T *context = (CONTEXT_T *)(port->userdata);
 	mmal_buffer_header_mem_lock(buffer);
 
+	if (context->startup.first_frame_ms == 0 && buffer->length > 0 && !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG))
+		context->startup.first_frame_ms = startup_elapsed_ms(&context->startup);
+
 	if (context->output_file != (FILE *)NULL) {
 		fwrite(buffer->data, 1, buffer->length, context->output_file);
 		fflush(context->output_file);
@@ -221,6 +409,13 @@ void encoder_output_port_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffe
 	send_all_buffers_in_pool(port, context->encoder_output_pool);
 }
 
+void fill_chroma(CONTEXT_T *context, MMAL_BUFFER_HEADER_T *buffer) {
+	const size_t y_size = context->video_buffer_width * context->video_buffer_height;
+	mmal_buffer_header_mem_lock(buffer);
+	memset(buffer->data + y_size, 128, y_size / 2);
+	mmal_buffer_header_mem_unlock(buffer);
+}
+
 bool setup_encoder(CONTEXT_T *context) {
 	MMAL_STATUS_T status;
 	MMAL_COMPONENT_T *encoder = 0;
@@ -254,7 +449,7 @@ bool setup_encoder(CONTEXT_T *context) {
 	format->es->video.frame_rate.num = context->framerate;
 	format->es->video.frame_rate.den = 1;
 
-	encoder_input_port->buffer_num = 3;
+	encoder_input_port->buffer_num = context->num_pool_buffers;
 	encoder_input_port->buffer_size = encoder_input_port->buffer_size_recommended;
 
 	status = mmal_port_parameter_set_boolean(encoder_input_port,
@@ -319,7 +514,16 @@ bool setup_encoder(CONTEXT_T *context) {
 
 	encoder_input_port_pool = (MMAL_POOL_T *)mmal_port_pool_create(encoder_input_port,
 		encoder_input_port->buffer_num, encoder_input_port->buffer_size);
+	if (!encoder_input_port_pool) {
+		fprintf(stderr, "ERROR: failed to create encoder input buffer pool (%d x %d bytes)\n", encoder_input_port->buffer_num, encoder_input_port->buffer_size);
+		return false;
+	}
 	context->encoder_input_pool = encoder_input_port_pool;
+	if (context->kernel_features & KERNEL_LUMA_ONLY) {
+		// chroma is never written, so it is set to neutral once
+		for (uint32_t i = 0; i < encoder_input_port_pool->headers_num; ++i)
+			fill_chroma(context, encoder_input_port_pool->header[i]);
+	}
 	encoder_input_port->userdata = (struct MMAL_PORT_USERDATA_T *)context;
 
 	status = mmal_port_enable(encoder_input_port, encoder_input_port_callback);
@@ -342,86 +546,365 @@ bool setup_encoder(CONTEXT_T *context) {
 	return true;
 }
 
-void remap_buffer(CONTEXT_T *context, MMAL_BUFFER_HEADER_T *input_buffer, MMAL_BUFFER_HEADER_T *output_buffer) {
-	if (!is_running) {
-		return;
+vcsm_util_buffer_t *active_map(CONTEXT_T *context) {
+	if (context->governor.level >= GOVERNOR_FALLBACK_MAP && context->governor.has_fallback_map)
+		return &context->fallback_map;
+	return &context->map;
+}
+
+// Finds the source block of every tile of the cpu backend, from the map in use.
+void use_cpu_map(CONTEXT_T *context, const vcsm_util_buffer_t *map, const map_format_t *format) {
+	context->cpu.map = (const uint32_t *) map->usr_mem_ptr;
+	context->cpu.stereo = format->is_stereo ? &format->stereo : NULL;
+	context->cpu.delta = format->is_delta ? &format->delta : NULL;
+}
+
+bool prepare_cpu_blocks(CONTEXT_T *context) {
+	vcsm_util_buffer_t *map = active_map(context);
+	vcsm_lock(map->handle);
+	if (context->kernel_features & KERNEL_BLEND) {
+		vcsm_lock(context->blend_map.handle);
+		vcsm_lock(context->blend_weights.handle);
+	}
+	bool result = remap_cpu_prepare(&context->cpu);
+	if (context->kernel_features & KERNEL_BLEND) {
+		vcsm_unlock_ptr(context->blend_weights.usr_mem_ptr);
+		vcsm_unlock_ptr(context->blend_map.usr_mem_ptr);
 	}
+	vcsm_unlock_ptr(map->usr_mem_ptr);
+	return result;
+}
 
-	pthread_mutex_lock(&context->mutex);
+void apply_governor_level(CONTEXT_T *context, governor_level_t previous) {
+	governor_level_t level = context->governor.level;
+	fprintf(stderr, "governor: %s (remap %.1f ms, budget %.1f ms)\n", governor_level_name(level), context->governor.average_ms, context->governor.budget_ms);
+
+	// the bilinear source blocks also cover the nearest samples, which read
+	// no neighbour texel
+	context->cpu.nearest = level >= GOVERNOR_NEAREST;
+	const vcsm_util_buffer_t *map = active_map(context);
+	if (map->usr_mem_ptr != context->cpu.map) {
+		use_cpu_map(context, map, map == &context->fallback_map ? &context->fallback_map_format : &context->map_format);
+		if (context->backend == BACKEND_CPU)
+			prepare_cpu_blocks(context);
+	}
 
- 	output_buffer->length = context->video_buffer_width * context->video_buffer_height * 3 / 2;
-	output_buffer->offset = 0;
-	output_buffer->flags = input_buffer->flags;
-	output_buffer->pts = input_buffer->pts;
-	output_buffer->dts = input_buffer->dts;
-	*output_buffer->type = *input_buffer->type;
+	if ((previous >= GOVERNOR_HALF_RATE) != (level >= GOVERNOR_HALF_RATE)) {
+		MMAL_RATIONAL_T rate = {context->framerate, level >= GOVERNOR_HALF_RATE ? 2 : 1};
+		if (mmal_port_parameter_set_rational(context->encoder_output_port, MMAL_PARAMETER_VIDEO_FRAME_RATE, rate) != MMAL_SUCCESS) {
+			fprintf(stderr, "ERROR: failed to set encoder frame rate\n");
+		}
+	}
+}
 
-	vcsm_lock(context->map.handle);
-	mmal_buffer_header_mem_lock(output_buffer);
-	mmal_buffer_header_mem_lock(input_buffer);
+void ring_doorbell(CONTEXT_T *context, uint32_t sequence) {
+	volatile uint32_t *doorbell = context->doorbell_ptr;
+	__sync_synchronize();
+	for (int i = 0; i < DOORBELL_WORDS; ++i)
+		doorbell[i] = sequence;
+	__sync_synchronize();
+}
+
+// Starts the resident kernel with the first frame, or lets it go on with the
+// next one, and waits until the main thread has written the done flag.
+void run_persistent_kernel(CONTEXT_T *context, uint32_t sequence) {
+	volatile uint32_t *done = context->doorbell_ptr + DOORBELL_DONE_OFFSET / sizeof(uint32_t);
+
+	if (context->sequence == 0) {
+		unsigned int uniforms[MAX_NUM_QPUS];
+		for (int i = 0; i < context->qpu.program.num_qpus; ++i)
+			uniforms[i] = remap_qpu_uniforms(&context->qpu, i);
+		*done = 0;
+		ring_doorbell(context, sequence);
+		v3d_util_direct_launch(&context->direct, context->qpu.program.num_qpus, remap_qpu_code(&context->qpu), uniforms);
+	} else {
+		// the uniforms of this frame have to reach the QPUs before the doorbell
+		v3d_util_direct_clear_caches(&context->direct);
+		ring_doorbell(context, sequence);
+	}
+	context->sequence = sequence;
+
+	// a frame takes milliseconds, so the host sleeps between polls to leave
+	// the core to the camera and encoder threads
+	const struct timespec poll = {0, PERSISTENT_POLL_US * 1000};
+	struct timespec begin, now;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	while (*done != sequence) {
+		nanosleep(&poll, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000 > PERSISTENT_TIMEOUT_MS) {
+			fprintf(stderr, "ERROR: persistent kernel did not finish frame %u\n", sequence);
+			is_running = false;
+			break;
+		}
+	}
+}
+
+// Sends the resident kernel a zero doorbell address, so that it exits
+// instead of waiting for another frame.
+void stop_persistent_kernel(CONTEXT_T *context) {
+	if (context->sequence > 0) {
+		vcsm_util_program_t *program = &context->qpu.program;
+		vcsm_lock(program->buffer.handle);
+		for (int i = 0; i < program->num_qpus; ++i)
+			program->mmap->uniforms[i * MAX_NUM_UNIFORMS + PERSISTENT_UNIFORM] = 0;
+		vcsm_unlock_ptr(program->buffer.usr_mem_ptr);
+		v3d_util_direct_clear_caches(&context->direct);
+		ring_doorbell(context, context->sequence + 1);
+		if (!v3d_util_direct_wait(&context->direct, PERSISTENT_TIMEOUT_MS))
+			fprintf(stderr, "ERROR: persistent kernel did not exit\n");
+		if (qpu_enable(context->mb, 0)) {
+			fprintf(stderr, "ERROR: failed to disable QPU\n");
+		}
+		context->sequence = 0;
+	}
+	v3d_util_direct_close(&context->direct);
+	if (context->doorbell_ptr) {
+		vcsm_unlock_ptr((void *) context->doorbell_ptr);
+		context->doorbell_ptr = NULL;
+	}
+	if (context->doorbell.size > 0)
+		vcsm_util_buffer_destroy(&context->doorbell);
+}
 
-	unsigned int vc_handle_input = vcsm_vc_hdl_from_ptr(input_buffer->data);
+void remap_buffer_qpu(CONTEXT_T *context, uint8_t *input_data, MMAL_BUFFER_HEADER_T *output_buffer) {
+	unsigned int vc_handle_input = vcsm_vc_hdl_from_ptr(input_data);
 	unsigned int frameptr_input = mem_lock(context->mb, vc_handle_input);
 	unsigned int vc_handle_output = vcsm_vc_hdl_from_ptr(output_buffer->data);
 	unsigned int frameptr_output = mem_lock(context->mb, vc_handle_output);
 
-    if (qpu_enable(context->mb, 1)) {
-        fprintf(stderr, "ERROR: failed to enable QPU\n");
+    // the resident kernel keeps the QPUs enabled from its launch on
+    if (!context->persistent || context->sequence == 0) {
+        if (qpu_enable(context->mb, 1)) {
+            fprintf(stderr, "ERROR: failed to enable QPU\n");
+        }
     }
     
-    vcsm_lock(context->program.buffer.handle);
-
-    unsigned int ptr = context->program.buffer.vc_mem_addr;
-    unsigned vc_code = ptr + offsetof(vcsm_util_program_mmap_t, code);
-    unsigned vc_uniforms = ptr + offsetof(vcsm_util_program_mmap_t, uniforms);
-
-    for (int i = 0; i < context->program.num_qpus; ++i) {
-      int offset = i * MAX_NUM_UNIFORMS;
-	  unsigned int uniform_ptr = vc_uniforms + offset * sizeof(unsigned int);
-
-      context->program.mmap->uniforms[offset++] = uniform_ptr;
-      context->program.mmap->uniforms[offset++] = texture_config_0(frameptr_input, 0, 17); // texture config 0
-      context->program.mmap->uniforms[offset++] = texture_config_1(context->camera_buffer_height, context->camera_buffer_width, 0, 0, 1, 1, 17); // texture config 1
-      context->program.mmap->uniforms[offset++] = 0; // texture config 2
-      context->program.mmap->uniforms[offset++] = 0; // texture config 3
-      context->program.mmap->uniforms[offset++] = (unsigned int) i; // qpu id
-      context->program.mmap->uniforms[offset++] = context->map.vc_mem_addr;
-      context->program.mmap->uniforms[offset++] = frameptr_output; // pointer to frame buffer
-      context->program.mmap->uniforms[offset++] = vpm_write_y_config((unsigned int) i); // vpm write y config
-      context->program.mmap->uniforms[offset++] = vpm_write_uv_config((unsigned int) i); // vpm write uv config
-      context->program.mmap->uniforms[offset++] = context->video_width / 128; // x tile count
-      context->program.mmap->uniforms[offset++] = context->video_height / 12; // y tile count
-      context->program.mmap->uniforms[offset++] = context->video_buffer_width; // frame buffer width
-      context->program.mmap->uniforms[offset++] = context->video_buffer_height; // frame buffer height
-
-      context->program.mmap->msg[2*i] = uniform_ptr;
-      context->program.mmap->msg[2*i+1] = vc_code;
-    }
-
-    execute_qpu(context->mb, context->program.num_qpus, context->program.vc_msg, 1, 2000);
-    
-    vcsm_unlock_ptr(context->program.buffer.usr_mem_ptr);
-
-    if (qpu_enable(context->mb, 0)) {
+    const uint32_t sequence = context->sequence + 1;
+
+    context->qpu.nearest = context->governor.level >= GOVERNOR_NEAREST;
+    context->qpu.map = active_map(context)->vc_mem_addr;
+    if (context->mip_levels > 0)
+        context->qpu.mip_table = active_map(context) == &context->fallback_map ? context->fallback_mip_table.vc_mem_addr : context->mip_table.vc_mem_addr;
+    if (context->kernel_features & KERNEL_STEREO)
+        context->qpu.stereo_table = active_map(context) == &context->fallback_map ? context->fallback_stereo_table.vc_mem_addr : context->stereo_table.vc_mem_addr;
+    // the levels of this frame have to be finished before the remap samples them
+    if (context->mip_levels > 0)
+        remap_qpu_downsample(&context->downsample, &context->mip, frameptr_input);
+    remap_qpu_write_uniforms(&context->qpu, frameptr_input, frameptr_output, sequence);
+
+    if (context->perf.regs)
+        v3d_util_perf_begin(&context->perf);
+
+    if (context->persistent)
+        run_persistent_kernel(context, sequence);
+    else
+        remap_qpu_execute(&context->qpu);
+
+    if (context->perf.regs)
+        v3d_util_perf_end(&context->perf);
+
+    if (!context->persistent && qpu_enable(context->mb, 0)) {
         fprintf(stderr, "ERROR: failed to disable QPU\n");
     }
 
 	mem_unlock(context->mb, vc_handle_input);
 	mem_unlock(context->mb, vc_handle_output);
+}
+
+void close_pyramid(CONTEXT_T *context) {
+	for (int i = 0; i < context->pyramid.num_levels; ++i) {
+		if (context->pyramid.levels[i].sink != NULL)
+			fclose(context->pyramid.levels[i].sink);
+	}
+	pyramid_destroy(&context->pyramid);
+	context->pyramid.num_levels = 0;
+	context->cpu.pyramid = NULL;
+}
+
+void close_rgb_output(CONTEXT_T *context) {
+	if (context->rgb.sink != NULL)
+		fclose(context->rgb.sink);
+	context->rgb.sink = NULL;
+	rgb_output_destroy(&context->rgb);
+	context->cpu.rgb = NULL;
+}
+
+// Remaps a texture of camera_buffer_width x camera_buffer_height, which has
+// to be YUYV in GPU memory for the qpu backend.  The cpu backend also samples
+// planar camera frames.
+
+void remap_frame(CONTEXT_T *context, uint8_t *input_data, int64_t pts, MMAL_BUFFER_HEADER_T *output_buffer) {
+ 	output_buffer->length = context->video_buffer_width * context->video_buffer_height * 3 / 2;
+	output_buffer->offset = 0;
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	vcsm_util_buffer_t *map = active_map(context);
+	vcsm_lock(map->handle);
+	if (context->kernel_features & KERNEL_GAIN_MAP)
+		vcsm_lock(context->gain_map.handle);
+	if (context->kernel_features & KERNEL_BLEND) {
+		vcsm_lock(context->blend_map.handle);
+		vcsm_lock(context->blend_weights.handle);
+	}
+	mmal_buffer_header_mem_lock(output_buffer);
+
+	if (context->kernel_features & KERNEL_TRANSFORM)
+		motion_lookup(&context->motion, pts, context->transform);
+
+	if (context->stats_file)
+		luma_stats_reset(&context->stats);
+	if (context->backend == BACKEND_CPU) {
+		remap_cpu_process(&context->cpu, input_data, output_buffer->data);
+	} else {
+		remap_buffer_qpu(context, input_data, output_buffer);
+	}
 
-	mmal_buffer_header_mem_unlock(input_buffer);
 	mmal_buffer_header_mem_unlock(output_buffer);
 
-	vcsm_unlock_ptr(context->map.usr_mem_ptr);
+	if (context->kernel_features & KERNEL_BLEND) {
+		vcsm_unlock_ptr(context->blend_weights.usr_mem_ptr);
+		vcsm_unlock_ptr(context->blend_map.usr_mem_ptr);
+	}
+	if (context->kernel_features & KERNEL_GAIN_MAP)
+		vcsm_unlock_ptr(context->gain_map.usr_mem_ptr);
+	vcsm_unlock_ptr(map->usr_mem_ptr);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double remap_ms = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+	if (context->stats_file && !luma_stats_write(context->stats_file, pts, &context->stats)) {
+		fprintf(stderr, "ERROR: failed to write stats, disabling them\n");
+		fclose(context->stats_file);
+		context->stats_file = NULL;
+		context->cpu.stats = NULL;
+		luma_stats_destroy(&context->stats);
+	}
+	if (context->pyramid.num_levels > 0 && !pyramid_write(&context->pyramid)) {
+		fprintf(stderr, "ERROR: failed to write the downsampled frames, disabling them\n");
+		close_pyramid(context);
+	}
+	if (context->rgb.data && !rgb_output_write(&context->rgb)) {
+		fprintf(stderr, "ERROR: failed to write the rgb frames, disabling them\n");
+		close_rgb_output(context);
+	}
+	governor_level_t previous = context->governor.level;
+	if (governor_update(&context->governor, remap_ms))
+		apply_governor_level(context, previous);
+}
+
+void remap_buffer(CONTEXT_T *context, MMAL_BUFFER_HEADER_T *input_buffer, MMAL_BUFFER_HEADER_T *output_buffer) {
+	if (!is_running) {
+		return;
+	}
+
+	pthread_mutex_lock(&context->mutex);
+
+	output_buffer->flags = input_buffer->flags;
+	output_buffer->pts = input_buffer->pts;
+	output_buffer->dts = input_buffer->dts;
+	*output_buffer->type = *input_buffer->type;
+
+	mmal_buffer_header_mem_lock(input_buffer);
+	remap_frame(context, input_buffer->data, input_buffer->pts, output_buffer);
+	mmal_buffer_header_mem_unlock(input_buffer);
+
+	pthread_mutex_unlock(&context->mutex);
+}
+
+// Remaps a frame from the shared memory ring.  The slot is given back to the
+// producer as soon as it is no longer read.
+void remap_shm_slot(CONTEXT_T *context, int slot, MMAL_BUFFER_HEADER_T *output_buffer) {
+	if (!is_running) {
+		shm_input_release(&context->shm_input, slot);
+		return;
+	}
+
+	pthread_mutex_lock(&context->mutex);
+
+	const int64_t pts = context->shm_input.header->slots[slot].pts;
+	output_buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+	output_buffer->pts = pts;
+	output_buffer->dts = MMAL_TIME_UNKNOWN;
+
+	if (context->backend == BACKEND_CPU && (shm_input_is_texture(&context->shm_input, context->camera_buffer_width)
+		|| shm_input_is_planar_texture(&context->shm_input, context->camera_buffer_width))) {
+		// sampled in place
+		remap_frame(context, (uint8_t *) shm_input_frame(&context->shm_input, slot), pts, output_buffer);
+		shm_input_release(&context->shm_input, slot);
+	} else {
+		// the QPUs can only read GPU memory, and I420 has to become YUYV.  The
+		// texture stays locked while the cpu backend reads it.
+		uint8_t *texture = (uint8_t *) vcsm_lock(context->input_texture.handle);
+		shm_input_copy_to_texture(&context->shm_input, slot, texture, context->camera_buffer_width);
+		shm_input_release(&context->shm_input, slot);
+		remap_frame(context, texture, pts, output_buffer);
+		vcsm_unlock_ptr(texture);
+	}
 
 	pthread_mutex_unlock(&context->mutex);
 }
 
+// Main loop for --shm-input: frames come from the ring instead of the camera.
+bool process_shm_input(CONTEXT_T *context) {
+	unsigned int reported_drops = 0;
+
+	while (is_running) {
+		int slot = shm_input_acquire(&context->shm_input, 100);
+		if (slot < 0) {
+			if (context->shm_input.header->closed) {
+				fprintf(stderr, "shared memory input closed by the producer\n");
+				return true;
+			}
+			continue;
+		}
+		if (governor_skip_frame(&context->governor)) {
+			shm_input_release(&context->shm_input, slot);
+			continue;
+		}
+
+		MMAL_BUFFER_HEADER_T *enc_buffer;
+		while ((enc_buffer = mmal_queue_get(context->encoder_input_pool->queue)) == NULL && is_running) {
+			if (vcos_semaphore_wait_timeout(&context->semaphore, 2000) != VCOS_SUCCESS) {
+				fprintf(stderr, "ERROR: semaphore timed out\n");
+				shm_input_release(&context->shm_input, slot);
+				return false;
+			}
+		}
+		if (!enc_buffer) {
+			shm_input_release(&context->shm_input, slot);
+			break;
+		}
+
+		remap_shm_slot(context, slot, enc_buffer);
+		if (mmal_port_send_buffer(context->encoder_input_port, enc_buffer) != MMAL_SUCCESS) {
+			fprintf(stderr, "ERROR: mmal_port_send_buffer failed\n");
+			return false;
+		}
+
+		if (context->shm_input.dropped != reported_drops) {
+			fprintf(stderr, "shared memory input: %u frames dropped by the producer\n", context->shm_input.dropped);
+			reported_drops = context->shm_input.dropped;
+		}
+		if (context->startup.first_frame_ms > 0 && !context->startup.printed) {
+			startup_print(&context->startup, stderr);
+		}
+		if (context->perf.num_frames >= (unsigned int) context->framerate) {
+			v3d_util_perf_print(&context->perf, stderr);
+		}
+	}
+	return true;
+}
+
 void finalize(CONTEXT_T *context) {
 	fprintf(stderr, "started finalizing...\n");
 
 	is_running = false;
 
+	if (context->map_thread_running)
+		pthread_join(context->map_thread, NULL);
+
 	pthread_mutex_lock(&context->mutex);
 
 	if (context->output_file != NULL && context->output_file != stdout)
@@ -429,9 +912,58 @@ void finalize(CONTEXT_T *context) {
 
 	if (context->map_file != NULL)
 		fclose(context->map_file);
+	free(context->map_cache_filename);
+
+	if (context->fallback_map_file != NULL)
+		fclose(context->fallback_map_file);
+
+	if (context->gain_map_file != NULL)
+		fclose(context->gain_map_file);
+
+	if (context->blend_map_file != NULL)
+		fclose(context->blend_map_file);
+
+	if (context->stats_file != NULL) {
+		fclose(context->stats_file);
+		luma_stats_destroy(&context->stats);
+	}
+
+	close_pyramid(context);
+	close_rgb_output(context);
+
+	if (context->persistent)
+		stop_persistent_kernel(context);
+
+	v3d_util_perf_close(&context->perf);
 
 	vcsm_util_buffer_destroy(&context->map);
-	vcsm_util_program_destroy(&context->program);
+	if (context->governor.has_fallback_map)
+		vcsm_util_buffer_destroy(&context->fallback_map);
+	if (context->kernel_features & KERNEL_GAIN_MAP)
+		vcsm_util_buffer_destroy(&context->gain_map);
+	if (context->kernel_features & KERNEL_BLEND) {
+		vcsm_util_buffer_destroy(&context->blend_map);
+		vcsm_util_buffer_destroy(&context->blend_weights);
+	}
+	if (context->mip_levels > 0) {
+		mip_source_destroy(&context->mip);
+		vcsm_util_buffer_destroy(&context->mip_table);
+		vcsm_util_buffer_destroy(&context->fallback_mip_table);
+	}
+	if (context->kernel_features & KERNEL_STEREO) {
+		vcsm_util_buffer_destroy(&context->stereo_table);
+		vcsm_util_buffer_destroy(&context->fallback_stereo_table);
+	}
+	if (context->use_shm_input) {
+		shm_input_close(&context->shm_input);
+		vcsm_util_buffer_destroy(&context->input_texture);
+	}
+	remap_cpu_destroy(&context->cpu);
+	color_destroy(&context->color);
+	if (context->kernel_features & KERNEL_TRANSFORM)
+		motion_close(&context->motion);
+	remap_qpu_destroy(&context->qpu);
+	remap_qpu_downsample_destroy(&context->downsample);
 
 	vcsm_exit();
 
@@ -450,6 +982,14 @@ void print_usage() {
 	fprintf(stderr,
 	"Usage: remapvid\n"
 		"\t--map <string> : Map filename\n"
+		"\t[--map-x <string>] : OpenCV CV_32FC1 x map, or CV_16SC2 map without --map-y (raw or .npy), instead of --map\n"
+		"\t[--map-y <string>] : OpenCV CV_32FC1 y map (raw or .npy)\n"
+		"\t[--map-frac <string>] : OpenCV CV_16UC1 interpolation table indices of the CV_16SC2 map\n"
+		"\t[--map-width <integer>] : Width of raw OpenCV maps\n"
+		"\t[--map-height <integer>] : Height of raw OpenCV maps\n"
+		"\t[--image-width <integer>] : Width of the image to be remapped (default: map width)\n"
+		"\t[--image-height <integer>] : Height of the image to be remapped (default: map height)\n"
+		"\t[--cache-map] : Save the converted OpenCV maps next to them and reuse them while they are up to date\n"
 		"\t[--output <string>] : Video output destination (default: stdout)\n"
 		"\t[--camera <0|1>] : Camera ID for use (default: 0)\n"
 		"\t[--stereo] : Side-by-side stereo mode\n"
@@ -460,6 +1000,27 @@ void print_usage() {
 		"\t[--sps-timing] : Add SPS timing\n"
 		"\t[--hflip] : Horizontal flip\n"
 		"\t[--vflip] : Vertical flip\n"
+		"\t[--perf] : Print QPU/TMU/VPM stall counters every second\n"
+		"\t[--backend <qpu|cpu>] : Remap on the QPUs or on the ARM cores (default: qpu)\n"
+		"\t[--gain-map <string>] : Luma gain map filename (gain = value / 64)\n"
+		"\t[--color-matrix <m00,...,m22[,o0,o1,o2]>] : YUV color matrix and offsets\n"
+		"\t[--lut <string>] : YUV 3D LUT filename (.cube, cpu backend only)\n"
+		"\t[--blend-map <string>] : Second coordinates and blend weights of the overlap area\n"
+		"\t[--motion <string>] : Per-frame transform filename, or - to read from stdin\n"
+		"\t[--governor] : Lower the quality when remapping cannot keep up with the framerate\n"
+		"\t[--fallback-map <string>] : Cheaper map with the same size used by the governor\n"
+		"\t[--shm-input <string>] : Read YUYV or I420 frames from a shared memory ring instead of the camera\n"
+		"\t[--stats <string>] : Write the luma histogram and region means of every frame to this file\n"
+		"\t[--luma-only] : Remap luma only, chroma is neutral gray\n"
+		"\t[--half-output <string>] : Write the half size frames (raw I420) to this file\n"
+		"\t[--quarter-output <string>] : Write the quarter size frames (raw I420) to this file\n"
+		"\t[--persistent] : Keep the kernel resident on the QPUs between frames (needs root)\n"
+		"\t[--gpu-mem-budget <integer>] : GPU memory in MB to fit in, with fewer buffers if needed\n"
+		"\t[--camera-format <yuyv|i420|nv12>] : Capture format (default: yuyv, planar formats need the cpu backend)\n"
+		"\t[--rgb-output <string>] : Write the frames as raw RGB to this file\n"
+		"\t[--rgb-format <rgb24|rgba32|planar>] : Layout of the RGB frames (default: rgb24)\n"
+		"\t[--rgb-matrix <bt601|bt709>] : YUV to RGB conversion (default: bt601)\n"
+		"\t[--mip <1|2>] : Sample a half (and quarter) size source where the map shrinks it (qpu backend)\n"
 	);
 }
 
@@ -485,11 +1046,14 @@ int main(int argc, char *argv[]) {
 	signal(SIGPIPE, signal_handler);
 
 	CONTEXT_T context = {0};
+	clock_gettime(CLOCK_MONOTONIC, &context.startup.origin);
+	int init_phase = startup_begin(&context.startup, "init");
 	context.framerate = DEFAULT_FRAMERATE;
 	context.keyframe = DEFAULT_KEYFRAME;
 	context.output_file = stdout;
 	context.stereo_mode = MMAL_STEREOSCOPIC_MODE_NONE;
 	context.bitrate = DEFAULT_BITRATE;
+	context.num_pool_buffers = DEFAULT_POOL_BUFFERS;
 
 	pthread_mutex_init(&context.mutex, NULL);
 
@@ -503,8 +1067,7 @@ int main(int argc, char *argv[]) {
 
 	context.queue = mmal_queue_create();
 
-	vcsm_util_program_create(&context.program, NUM_QPUS);
-	vcsm_util_program_load_from_memory(&context.program, kernel_bin, kernel_bin_len);
+	startup_end(&context.startup, init_phase);
 
 	struct option long_options[] =
 	{
@@ -521,11 +1084,54 @@ int main(int argc, char *argv[]) {
 		{"sps-timing", no_argument, NULL, 'o'},
 		{"hflip", no_argument, NULL, 'p'},
 		{"vflip", no_argument, NULL, 'q'},
+		{"perf", no_argument, NULL, 'r'},
+		{"backend", required_argument, NULL, 's'},
+		{"gain-map", required_argument, NULL, 't'},
+		{"color-matrix", required_argument, NULL, 'u'},
+		{"lut", required_argument, NULL, 'v'},
+		{"blend-map", required_argument, NULL, 'w'},
+		{"motion", required_argument, NULL, 'x'},
+		{"governor", no_argument, NULL, 'y'},
+		{"fallback-map", required_argument, NULL, 'z'},
+		{"shm-input", required_argument, NULL, 'A'},
+		{"map-x", required_argument, NULL, 'B'},
+		{"map-y", required_argument, NULL, 'C'},
+		{"map-frac", required_argument, NULL, 'D'},
+		{"map-width", required_argument, NULL, 'E'},
+		{"map-height", required_argument, NULL, 'F'},
+		{"image-width", required_argument, NULL, 'G'},
+		{"image-height", required_argument, NULL, 'H'},
+		{"cache-map", no_argument, NULL, 'I'},
+		{"stats", required_argument, NULL, 'J'},
+		{"luma-only", no_argument, NULL, 'K'},
+		{"half-output", required_argument, NULL, 'L'},
+		{"quarter-output", required_argument, NULL, 'M'},
+		{"persistent", no_argument, NULL, 'N'},
+		{"gpu-mem-budget", required_argument, NULL, 'O'},
+		{"camera-format", required_argument, NULL, 'P'},
+		{"rgb-output", required_argument, NULL, 'Q'},
+		{"rgb-format", required_argument, NULL, 'R'},
+		{"rgb-matrix", required_argument, NULL, 'S'},
+		{"mip", required_argument, NULL, 'T'},
 		{NULL, 0, NULL, 0}
 	};
 
 	char *output_filename = NULL;
 	char *map_filename = NULL;
+	char *gain_map_filename = NULL;
+	char *blend_map_filename = NULL;
+	char *motion_filename = NULL;
+	char *fallback_map_filename = NULL;
+	char *shm_input_name = NULL;
+	char *stats_filename = NULL;
+	char *pyramid_filenames[PYRAMID_MAX_LEVELS] = {NULL};
+	map_source_t map_source = {0};
+	bool cache_map = false;
+	bool governor = false;
+	int gpu_mem_budget = 0;
+	char *rgb_filename = NULL;
+	rgb_output_format_t rgb_format = RGB_OUTPUT_RGB24;
+	rgb_output_matrix_t rgb_matrix = RGB_OUTPUT_BT601;
 	int ch, option_index;
 	while ((ch = getopt_long_only(argc, argv, "a:d:g:hij:k:l:m:nop:", long_options, &option_index)) != -1) {
 		switch (ch) {
@@ -583,6 +1189,155 @@ int main(int argc, char *argv[]) {
 		case 'q': // --vflip
 			context.vflip = 1;
 			break;
+		case 'r': // --perf
+			if (!v3d_util_perf_open(&context.perf)) {
+				goto error;
+			}
+			break;
+		case 's': // --backend
+			if (strcmp(optarg, "qpu") == 0) {
+				context.backend = BACKEND_QPU;
+			} else if (strcmp(optarg, "cpu") == 0) {
+				context.backend = BACKEND_CPU;
+			} else {
+				fprintf(stderr, "ERROR: invalid value for argument '--backend'\n");
+				goto error;
+			}
+			break;
+		case 't': // --gain-map
+			gain_map_filename = optarg;
+			break;
+		case 'u': // --color-matrix
+			if (!color_parse_matrix(&context.color, optarg)) {
+				fprintf(stderr, "ERROR: invalid value for argument '--color-matrix'\n");
+				goto error;
+			}
+			context.kernel_features |= KERNEL_COLOR_MATRIX;
+			break;
+		case 'v': // --lut
+			if (!color_load_lut(&context.color, optarg)) {
+				goto error;
+			}
+			break;
+		case 'w': // --blend-map
+			blend_map_filename = optarg;
+			break;
+		case 'x': // --motion
+			motion_filename = optarg;
+			break;
+		case 'y': // --governor
+			governor = true;
+			break;
+		case 'z': // --fallback-map
+			fallback_map_filename = optarg;
+			break;
+		case 'A': // --shm-input
+			shm_input_name = optarg;
+			break;
+		case 'B': // --map-x
+			map_source.map_x = optarg;
+			break;
+		case 'C': // --map-y
+			map_source.map_y = optarg;
+			break;
+		case 'D': // --map-frac
+			map_source.map_frac = optarg;
+			break;
+		case 'E': // --map-width
+			if (!parse_arg_as_int(optarg, &map_source.width)) {
+				fprintf(stderr, "ERROR: invalid value for argument '--map-width'\n");
+				goto error;
+			}
+			break;
+		case 'F': // --map-height
+			if (!parse_arg_as_int(optarg, &map_source.height)) {
+				fprintf(stderr, "ERROR: invalid value for argument '--map-height'\n");
+				goto error;
+			}
+			break;
+		case 'G': // --image-width
+			if (!parse_arg_as_int(optarg, &map_source.image_width)) {
+				fprintf(stderr, "ERROR: invalid value for argument '--image-width'\n");
+				goto error;
+			}
+			break;
+		case 'H': // --image-height
+			if (!parse_arg_as_int(optarg, &map_source.image_height)) {
+				fprintf(stderr, "ERROR: invalid value for argument '--image-height'\n");
+				goto error;
+			}
+			break;
+		case 'I': // --cache-map
+			cache_map = true;
+			break;
+		case 'J': // --stats
+			stats_filename = optarg;
+			break;
+		case 'K': // --luma-only
+			context.kernel_features |= KERNEL_LUMA_ONLY;
+			break;
+		case 'L': // --half-output
+			pyramid_filenames[0] = optarg;
+			break;
+		case 'M': // --quarter-output
+			pyramid_filenames[1] = optarg;
+			break;
+		case 'N': // --persistent
+			if (!v3d_util_direct_open(&context.direct)) {
+				goto error;
+			}
+			context.persistent = true;
+			break;
+		case 'O': // --gpu-mem-budget
+			if (!parse_arg_as_int(optarg, &gpu_mem_budget) || gpu_mem_budget <= 0) {
+				fprintf(stderr, "ERROR: invalid value for argument '--gpu-mem-budget'\n");
+				goto error;
+			}
+			break;
+		case 'P': // --camera-format
+			if (strcmp(optarg, "yuyv") == 0) {
+				context.camera_format = REMAP_CPU_YUYV;
+			} else if (strcmp(optarg, "i420") == 0) {
+				context.camera_format = REMAP_CPU_I420;
+			} else if (strcmp(optarg, "nv12") == 0) {
+				context.camera_format = REMAP_CPU_NV12;
+			} else {
+				fprintf(stderr, "ERROR: invalid value for argument '--camera-format'\n");
+				goto error;
+			}
+			break;
+		case 'Q': // --rgb-output
+			rgb_filename = optarg;
+			break;
+		case 'R': // --rgb-format
+			if (strcmp(optarg, "rgb24") == 0) {
+				rgb_format = RGB_OUTPUT_RGB24;
+			} else if (strcmp(optarg, "rgba32") == 0) {
+				rgb_format = RGB_OUTPUT_RGBA32;
+			} else if (strcmp(optarg, "planar") == 0) {
+				rgb_format = RGB_OUTPUT_PLANAR;
+			} else {
+				fprintf(stderr, "ERROR: invalid value for argument '--rgb-format'\n");
+				goto error;
+			}
+			break;
+		case 'S': // --rgb-matrix
+			if (strcmp(optarg, "bt601") == 0) {
+				rgb_matrix = RGB_OUTPUT_BT601;
+			} else if (strcmp(optarg, "bt709") == 0) {
+				rgb_matrix = RGB_OUTPUT_BT709;
+			} else {
+				fprintf(stderr, "ERROR: invalid value for argument '--rgb-matrix'\n");
+				goto error;
+			}
+			break;
+		case 'T': // --mip
+			if (!parse_arg_as_int(optarg, &context.mip_levels) || context.mip_levels < 1 || context.mip_levels > MIP_MAX_LEVELS) {
+				fprintf(stderr, "ERROR: invalid value for argument '--mip'\n");
+				goto error;
+			}
+			context.kernel_features |= KERNEL_MIP;
+			break;
 		default:
 			print_usage();
 			goto error;
@@ -598,20 +1353,61 @@ int main(int argc, char *argv[]) {
 		goto error;
 	}
 
-	if (!map_filename) {
+	if (map_source.map_x) {
+		if (map_filename) {
+			fprintf(stderr, "ERROR: either --map or --map-x can be given\n");
+			goto error;
+		}
+		if (!map_loader_probe(&map_source)) {
+			goto error;
+		}
+		if (cache_map) {
+			context.map_cache_filename = (char *) malloc(strlen(map_source.map_x) + sizeof(".map"));
+			sprintf(context.map_cache_filename, "%s.map", map_source.map_x);
+			if (map_loader_cache_is_fresh(context.map_cache_filename, &map_source)) {
+				map_filename = context.map_cache_filename;
+			}
+		}
+		if (!map_filename) {
+			context.map_source = map_source;
+			context.video_width = map_source.width;
+			context.video_height = map_source.height;
+			context.camera_width = map_source.image_width;
+			context.camera_height = map_source.image_height;
+		}
+	}
+
+	if (!map_filename && !context.map_source.map_x) {
 		fprintf(stderr, "ERROR: map filename is not specified\n");
 		goto error;
 	}
 
-    context.map_file = fopen(map_filename, "rb");
-    if (!context.map_file) {
-        fprintf(stderr, "ERROR: failed to open file %s\n", map_filename);
-        goto error;
-    }
-    fread(&context.video_width, 1, sizeof(int), context.map_file);
-    fread(&context.video_height, 1, sizeof(int), context.map_file);
-    fread(&context.camera_width, 1, sizeof(int), context.map_file);
-    fread(&context.camera_height, 1, sizeof(int), context.map_file);
+	if (map_filename) {
+		context.map_file = fopen(map_filename, "rb");
+		if (!context.map_file) {
+			fprintf(stderr, "ERROR: failed to open file %s\n", map_filename);
+			goto error;
+		}
+		int header[4];
+		if (!map_file_read_header(context.map_file, header, &context.map_format)) {
+			fprintf(stderr, "ERROR: failed to read map file\n");
+			goto error;
+		}
+		context.video_width = header[0];
+		context.video_height = header[1];
+		context.camera_width = header[2];
+		context.camera_height = header[3];
+		if (context.map_format.is_stereo) {
+			const stereo_map_header_t *stereo = &context.map_format.stereo;
+			fprintf(stderr, "stereo map: right eye %s, offset %d, %d\n", (stereo->flags & STEREO_MAP_MIRROR) ? "mirrored" : "identical",
+				stereo->offset_s, stereo->offset_t);
+		}
+		if (context.map_format.is_delta) {
+			const delta_map_header_t *delta = &context.map_format.delta.header;
+			fprintf(stderr, "delta map: %zu bytes, %.0f%% of the full map\n", delta_map_data_size(delta),
+				100.0 * delta_map_data_size(delta) / ((size_t) delta->width * delta->height * sizeof(uint32_t)));
+		}
+	}
 
 	fprintf(stderr, "map width: %d, height: %d\n", context.video_width, context.video_height);
 	fprintf(stderr, "capture width: %d, height: %d\n", context.camera_width, context.camera_height);
@@ -628,6 +1424,7 @@ int main(int argc, char *argv[]) {
 
 	context.camera_buffer_width = next_pow2(context.camera_width);
 	context.camera_buffer_height = context.camera_height;
+	context.camera_plane_height = VCOS_ALIGN_UP(context.camera_height, 16);
 	context.video_buffer_width = context.video_width;
 	context.video_buffer_height = VCOS_ALIGN_UP(context.video_height, 16);
 
@@ -639,23 +1436,358 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	const size_t map_size = context.video_width * context.video_height * sizeof(unsigned int);
-	vcsm_util_buffer_create(&context.map, map_size);
-	if (!vcsm_util_buffer_load_from_file(&context.map, context.map_file, map_size)) {
+	// the kernel does not gather them, and scanning the finished frame on the
+	// ARM would cost a pass over it
+	if (stats_filename && context.backend != BACKEND_CPU) {
+		fprintf(stderr, "ERROR: --stats needs the cpu backend\n");
 		goto error;
 	}
 
-	if (!setup_camera(&context)) {
+	if (stats_filename) {
+		context.stats_file = fopen(stats_filename, "w");
+		if (!context.stats_file) {
+			fprintf(stderr, "ERROR: failed to open stats file: %s\n", stats_filename);
+			goto error;
+		}
+		if (!luma_stats_init(&context.stats, context.video_width, context.video_height))
+			goto error;
+	}
+
+	// the kernel writes the full size frame only, and downsampling the finished
+	// frame on the ARM would cost a full pass over it
+	if ((pyramid_filenames[0] || pyramid_filenames[1]) && context.backend != BACKEND_CPU) {
+		fprintf(stderr, "ERROR: --half-output and --quarter-output need the cpu backend\n");
 		goto error;
 	}
 
+	// the quarter size level is downsampled from the half size one
+	int pyramid_levels = pyramid_filenames[1] ? 2 : (pyramid_filenames[0] ? 1 : 0);
+	if (pyramid_levels > 0) {
+		if (!pyramid_init(&context.pyramid, pyramid_levels, context.video_width, context.video_height))
+			goto error;
+		for (int i = 0; i < pyramid_levels; ++i) {
+			if (!pyramid_filenames[i])
+				continue;
+			context.pyramid.levels[i].sink = fopen(pyramid_filenames[i], "wb");
+			if (!context.pyramid.levels[i].sink) {
+				fprintf(stderr, "ERROR: failed to open output file: %s\n", pyramid_filenames[i]);
+				goto error;
+			}
+			fprintf(stderr, "%s output: %dx%d\n", i == 0 ? "half" : "quarter", context.pyramid.levels[i].width, context.pyramid.levels[i].height);
+		}
+	}
+
+	// the kernel writes I420 only, and converting the finished frame on the ARM
+	// would cost a full pass over it
+	if (rgb_filename && context.backend != BACKEND_CPU) {
+		fprintf(stderr, "ERROR: --rgb-output needs the cpu backend\n");
+		goto error;
+	}
+
+	if (context.persistent && context.backend != BACKEND_QPU) {
+		fprintf(stderr, "ERROR: --persistent needs the qpu backend\n");
+		goto error;
+	}
+
+	if (context.mip_levels > 0) {
+		// only the kernel reads level tables
+		if (context.backend != BACKEND_QPU) {
+			fprintf(stderr, "ERROR: --mip needs the qpu backend\n");
+			goto error;
+		}
+		// the levels are chosen from the map, a per-frame homography changes the footprints
+		if (motion_filename) {
+			fprintf(stderr, "ERROR: --mip cannot be combined with --motion\n");
+			goto error;
+		}
+		// the downsample kernel cannot run while the resident kernel holds the QPUs
+		if (context.persistent) {
+			fprintf(stderr, "ERROR: --mip cannot be combined with --persistent\n");
+			goto error;
+		}
+	}
+
+	if (rgb_filename) {
+		if (!rgb_output_init(&context.rgb, rgb_format, rgb_matrix, context.video_width, context.video_height))
+			goto error;
+		context.rgb.sink = fopen(rgb_filename, "wb");
+		if (!context.rgb.sink) {
+			fprintf(stderr, "ERROR: failed to open output file: %s\n", rgb_filename);
+			goto error;
+		}
+	}
+
+	if (context.camera_format != REMAP_CPU_YUYV && context.backend != BACKEND_CPU) {
+		// the TMU reads raster textures only as RGBA32 or YUYV, not as 8-bit planes
+		fprintf(stderr, "ERROR: planar camera formats need the cpu backend\n");
+		goto error;
+	}
+
+	if (context.backend == BACKEND_QPU && context.color.lut_size > 0) {
+		fprintf(stderr, "ERROR: 3D LUT is only supported by the cpu backend\n");
+		goto error;
+	}
+
+	if (shm_input_name) {
+		if (context.camera_format != REMAP_CPU_YUYV) {
+			fprintf(stderr, "ERROR: --camera-format cannot be combined with --shm-input\n");
+			goto error;
+		}
+		if (!shm_input_open(&context.shm_input, shm_input_name)) {
+			goto error;
+		}
+		context.use_shm_input = true;
+		const shm_input_header_t *header = context.shm_input.header;
+		if ((int) header->width != context.camera_width || (int) header->height != context.camera_height) {
+			fprintf(stderr, "ERROR: shared memory frames are %ux%u, the map expects %dx%d\n", header->width, header->height, context.camera_width, context.camera_height);
+			goto error;
+		}
+		fprintf(stderr, "shared memory input: %s, %d slots\n", header->format == SHM_INPUT_I420 ? "i420" : "yuyv", header->num_slots);
+		if (context.backend == BACKEND_CPU && shm_input_is_planar_texture(&context.shm_input, context.camera_buffer_width)) {
+			// the cpu backend samples the I420 slots in place, the chroma planes follow the frame rows
+			context.camera_format = REMAP_CPU_I420;
+			context.camera_plane_height = context.camera_height;
+		}
+	}
+
+	if (fallback_map_filename) {
+		context.fallback_map_file = fopen(fallback_map_filename, "rb");
+		if (!context.fallback_map_file) {
+			fprintf(stderr, "ERROR: failed to open file %s\n", fallback_map_filename);
+			goto error;
+		}
+		int header[4];
+		if (!map_file_read_header(context.fallback_map_file, header, &context.fallback_map_format)
+			|| header[0] != context.video_width || header[1] != context.video_height
+			|| header[2] != context.camera_width || header[3] != context.camera_height) {
+			fprintf(stderr, "ERROR: fallback map size does not match the map\n");
+			goto error;
+		}
+	}
+
+	if (blend_map_filename && (context.map_format.is_stereo || context.map_format.is_delta)) {
+		fprintf(stderr, "ERROR: --blend-map cannot be combined with a stereo or delta map\n");
+		goto error;
+	}
+
+	// the kernel would stream the expanded map, which defeats the delta map
+	if (context.backend == BACKEND_QPU && (context.map_format.is_delta || (context.fallback_map_file && context.fallback_map_format.is_delta))) {
+		fprintf(stderr, "ERROR: delta maps need the cpu backend\n");
+		goto error;
+	}
+
+	// the kernel reads the left eye of an offset stereo map with the offsets of
+	// each step, a mirrored map is expanded.  The step table is walked in map
+	// order, which neither a homography nor the mip levels keep.
+	if (context.backend == BACKEND_QPU && is_offset_stereo(&context.map_format) && context.mip_levels == 0 && !motion_filename)
+		context.kernel_features |= KERNEL_STEREO;
+
+	// everything below is allocated as planned here
+	unsigned int planned_features = context.kernel_features;
+	if (gain_map_filename)
+		planned_features |= KERNEL_GAIN_MAP;
+	if (blend_map_filename)
+		planned_features |= KERNEL_BLEND;
+	if (motion_filename)
+		planned_features |= KERNEL_TRANSFORM;
+	const size_t budget_limit = (size_t) gpu_mem_budget << 20;
+	gpu_budget_t budget;
+	plan_gpu_memory(&context, &budget, planned_features);
+	if (budget_limit > 0 && gpu_budget_total(&budget) > budget_limit) {
+		// reduced footprint: double instead of triple buffering, then no fallback map
+		context.num_pool_buffers = REDUCED_POOL_BUFFERS;
+		plan_gpu_memory(&context, &budget, planned_features);
+		if (gpu_budget_total(&budget) > budget_limit && context.fallback_map_file) {
+			fprintf(stderr, "dropping the fallback map to fit the GPU memory budget\n");
+			fclose(context.fallback_map_file);
+			context.fallback_map_file = NULL;
+			plan_gpu_memory(&context, &budget, planned_features);
+		}
+	}
+	gpu_budget_print(stderr, &budget, budget_limit);
+	if (budget_limit > 0 && gpu_budget_total(&budget) > budget_limit) {
+		fprintf(stderr, "ERROR: the configuration needs more GPU memory than --gpu-mem-budget\n");
+		goto error;
+	}
+
+	if (context.persistent) {
+		if (!vcsm_util_buffer_create(&context.doorbell, DOORBELL_SIZE))
+			goto error;
+		// the host reads the done flag while the kernel runs, so it stays locked
+		context.doorbell_ptr = (volatile uint32_t *) vcsm_lock(context.doorbell.handle);
+		if (!context.doorbell_ptr) {
+			fprintf(stderr, "ERROR: failed to lock doorbell\n");
+			goto error;
+		}
+	}
+
+	if (context.use_shm_input && !create_gpu_buffer(&context, &context.input_texture, context.camera_buffer_width * context.camera_buffer_height * 2)) {
+		goto error;
+	}
+
+	if (!create_gpu_buffer(&context, &context.map, stored_map_size(&context, &context.map_format) + MAP_PADDING)) {
+		goto error;
+	}
+
+	if (context.fallback_map_file) {
+		if (!create_gpu_buffer(&context, &context.fallback_map, stored_map_size(&context, &context.fallback_map_format) + MAP_PADDING)) {
+			goto error;
+		}
+		context.governor.has_fallback_map = true;
+	}
+
+	if (gain_map_filename) {
+		context.gain_map_file = fopen(gain_map_filename, "rb");
+		if (!context.gain_map_file) {
+			fprintf(stderr, "ERROR: failed to open file %s\n", gain_map_filename);
+			goto error;
+		}
+		if (!create_gpu_buffer(&context, &context.gain_map, context.video_width * context.video_height + GAIN_MAP_PADDING)) {
+			goto error;
+		}
+		context.kernel_features |= KERNEL_GAIN_MAP;
+	}
+
+	if (blend_map_filename) {
+		context.blend_map_file = fopen(blend_map_filename, "rb");
+		if (!context.blend_map_file) {
+			fprintf(stderr, "ERROR: failed to open file %s\n", blend_map_filename);
+			goto error;
+		}
+		const size_t map_size = context.video_width * context.video_height * sizeof(unsigned int);
+		if (!create_gpu_buffer(&context, &context.blend_map, map_size + MAP_PADDING)
+			|| !create_gpu_buffer(&context, &context.blend_weights, context.video_width * context.video_height + GAIN_MAP_PADDING)) {
+			goto error;
+		}
+		context.kernel_features |= KERNEL_BLEND;
+	}
+
+	if (context.mip_levels > 0) {
+		const size_t table_size = remap_qpu_mip_table_size(context.video_width, context.video_height);
+		if (!mip_source_init(&context.mip, context.mip_levels, context.camera_buffer_width, context.camera_buffer_height)
+			|| !vcsm_util_buffer_create(&context.mip_table, table_size)
+			|| (context.fallback_map_file && !vcsm_util_buffer_create(&context.fallback_mip_table, table_size))) {
+			goto error;
+		}
+	}
+
+	if (context.kernel_features & KERNEL_STEREO) {
+		const size_t table_size = remap_qpu_stereo_table_size(context.video_width, context.video_height);
+		if (!vcsm_util_buffer_create(&context.stereo_table, table_size)
+			|| (context.fallback_map_file && !vcsm_util_buffer_create(&context.fallback_stereo_table, table_size))) {
+			goto error;
+		}
+	}
+
+	// the maps are read while the camera and the encoder are being set up
+	context.map_phase = startup_begin(&context.startup, "maps");
+	if (pthread_create(&context.map_thread, NULL, load_maps, &context) != 0) {
+		fprintf(stderr, "ERROR: failed to create map loader thread\n");
+		goto error;
+	}
+	context.map_thread_running = true;
+
+	int phase = startup_begin(&context.startup, "kernel");
+	if (motion_filename) {
+		if (!motion_open(&context.motion, motion_filename, context.camera_width, context.camera_height, context.camera_buffer_width, context.camera_buffer_height)) {
+			goto error;
+		}
+		context.kernel_features |= KERNEL_TRANSFORM;
+	}
+
+	if (context.backend == BACKEND_CPU) {
+		context.cpu.src_width = context.camera_buffer_width;
+		context.cpu.src_height = context.camera_buffer_height;
+		context.cpu.src_format = context.camera_format;
+		context.cpu.src_plane_height = context.camera_plane_height;
+		context.cpu.dst_width = context.video_width;
+		context.cpu.dst_height = context.video_height;
+		context.cpu.dst_buffer_width = context.video_buffer_width;
+		context.cpu.dst_buffer_height = context.video_buffer_height;
+		use_cpu_map(&context, &context.map, &context.map_format);
+		context.cpu.gain_map = (context.kernel_features & KERNEL_GAIN_MAP) ? (const uint8_t *) context.gain_map.usr_mem_ptr : NULL;
+		if (context.kernel_features & KERNEL_BLEND) {
+			context.cpu.blend_map = (const uint32_t *) context.blend_map.usr_mem_ptr;
+			context.cpu.blend_weights = (const uint8_t *) context.blend_weights.usr_mem_ptr;
+		}
+		if (context.kernel_features & KERNEL_TRANSFORM)
+			context.cpu.transform = context.transform;
+		context.cpu.color = &context.color;
+		context.cpu.stats = context.stats_file ? &context.stats : NULL;
+		context.cpu.luma_only = (context.kernel_features & KERNEL_LUMA_ONLY) != 0;
+		context.cpu.pyramid = context.pyramid.num_levels > 0 ? &context.pyramid : NULL;
+		context.cpu.rgb = context.rgb.data ? &context.rgb : NULL;
+		remap_cpu_init(&context.cpu);
+	} else {
+		const kernel_t *kernel = kernel_find(context.kernel_features);
+		if (!kernel) {
+			fprintf(stderr, "ERROR: the qpu backend cannot combine --gain-map and --blend-map, or --luma-only with --color-matrix and --blend-map\n");
+			goto error;
+		}
+		context.qpu.src_width = context.camera_buffer_width;
+		context.qpu.src_height = context.camera_buffer_height;
+		context.qpu.dst_width = context.video_width;
+		context.qpu.dst_height = context.video_height;
+		context.qpu.dst_buffer_width = context.video_buffer_width;
+		context.qpu.dst_buffer_height = context.video_buffer_height;
+		context.qpu.gain_map = context.gain_map.vc_mem_addr;
+		context.qpu.blend_map = context.blend_map.vc_mem_addr;
+		context.qpu.blend_weights = context.blend_weights.vc_mem_addr;
+		context.qpu.color = &context.color;
+		if (context.kernel_features & KERNEL_TRANSFORM)
+			context.qpu.transform = context.transform;
+		if (context.persistent)
+			context.qpu.doorbell = context.doorbell.vc_mem_addr;
+		context.qpu.done = context.doorbell.vc_mem_addr + DOORBELL_DONE_OFFSET;
+		for (int i = 0; i < context.mip_levels; ++i)
+			context.qpu.mip_levels[i] = context.mip.levels[i].vc_mem_addr;
+		if (context.mip_levels > 0)
+			context.qpu.mip_table = context.mip_table.vc_mem_addr;
+		if (context.kernel_features & KERNEL_STEREO)
+			context.qpu.stereo_table = context.stereo_table.vc_mem_addr;
+		if (!remap_qpu_init(&context.qpu, context.mb, NUM_QPUS, kernel))
+			goto error;
+		if (context.mip_levels > 0 && !remap_qpu_downsample_init(&context.downsample, context.mb, NUM_QPUS))
+			goto error;
+	}
+	startup_end(&context.startup, phase);
+
+	if (!context.use_shm_input) {
+		phase = startup_begin(&context.startup, "camera");
+		if (!setup_camera(&context)) {
+			goto error;
+		}
+		startup_end(&context.startup, phase);
+	}
+
+	phase = startup_begin(&context.startup, "encoder");
 	if (!setup_encoder(&context)) {
 		goto error;
 	}
+	startup_end(&context.startup, phase);
+
+	pthread_join(context.map_thread, NULL);
+	context.map_thread_running = false;
+	if (!context.maps_loaded) {
+		goto error;
+	}
+
+	if (context.backend == BACKEND_CPU && !prepare_cpu_blocks(&context)) {
+		goto error;
+	}
+
+	if (governor)
+		governor_init(&context.governor, context.framerate, context.governor.has_fallback_map);
 
 	send_all_buffers_in_pool(context.encoder_output_port, context.encoder_output_pool);
 
-	while (is_running) {
+	if (context.use_shm_input) {
+		if (!process_shm_input(&context)) {
+			goto error;
+		}
+	}
+
+	while (is_running && !context.use_shm_input) {
 		MMAL_BUFFER_HEADER_T *buffer;
 		VCOS_STATUS_T vcos_status;
 		MMAL_STATUS_T status = MMAL_EINVAL;
@@ -667,6 +1799,10 @@ int main(int argc, char *argv[]) {
 		}
 
 		while ((buffer = mmal_queue_get(context.queue)) != NULL) {
+			if (governor_skip_frame(&context.governor)) {
+				mmal_buffer_header_release(buffer);
+				continue;
+			}
 			MMAL_BUFFER_HEADER_T *enc_buffer = mmal_queue_get(context.encoder_input_pool->queue);
 			if (enc_buffer) {
 				remap_buffer(&context, buffer, enc_buffer);
@@ -678,6 +1814,12 @@ int main(int argc, char *argv[]) {
 			}
 			mmal_buffer_header_release(buffer);
 		}
+		if (context.startup.first_frame_ms > 0 && !context.startup.printed) {
+			startup_print(&context.startup, stderr);
+		}
+		if (context.perf.num_frames >= (unsigned int) context.framerate) {
+			v3d_util_perf_print(&context.perf, stderr);
+		}
 		send_all_buffers_in_pool(context.camera_video_port, context.camera_video_pool);
 	}
 
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <memory.h>
 #include <pthread.h>
 #include <bcm_host.h>
@@ -15,12 +16,63 @@
 #include <interface/mmal/mmal_parameters_camera.h>
 
 #include "vcsm_util.h"
+#include "v3d_util.h"
+#include "color.h"
+#include "remap_cpu.h"
+#include "remap_qpu.h"
+#include "blend.h"
+#include "motion.h"
+#include "governor.h"
+#include "shm_input.h"
+#include "map_loader.h"
+#include "map_util.h"
+#include "delta_map.h"
+#include "map_file.h"
+#include "luma_stats.h"
+#include "pyramid.h"
+#include "gpu_budget.h"
+#include "rgb_output.h"
+#include "kernels.h"
+#include "mip.h"
 
 #define	DEFAULT_BITRATE   10000000
 #define DEFAULT_FRAMERATE 30
 #define	DEFAULT_KEYFRAME  60
 
-#define NUM_QPUS          12
+// camera and encoder input buffers, double buffered to fit a --gpu-mem-budget
+#define DEFAULT_POOL_BUFFERS 3
+#define REDUCED_POOL_BUFFERS 2
+
+typedef enum {
+	BACKEND_QPU,
+	BACKEND_CPU,
+} BACKEND_T;
+
+// persistent mode: the host rings the doorbell (64 bytes, every word the
+// sequence number of the next frame) and the kernel writes the done line
+#define PERSISTENT_UNIFORM    41
+#define PERSISTENT_TIMEOUT_MS 2000
+#define PERSISTENT_POLL_US    150
+#define DOORBELL_WORDS        16
+#define DOORBELL_DONE_OFFSET  64
+#define DOORBELL_SIZE         128
+
+#define MAX_STARTUP_PHASES 8
+
+typedef struct {
+	const char *name;
+	double begin_ms;
+	double end_ms;
+} STARTUP_PHASE_T;
+
+// startup timing, in ms from the launch of the process
+typedef struct {
+	struct timespec origin;
+	STARTUP_PHASE_T phases[MAX_STARTUP_PHASES];
+	int num_phases;
+	volatile double first_frame_ms;
+	bool printed;
+} STARTUP_T;
 
 typedef	struct {
 	int camera_id;
@@ -28,6 +80,8 @@ typedef	struct {
 	int camera_height;
 	int camera_buffer_width;
 	int camera_buffer_height;
+	remap_cpu_format_t camera_format;
+	int camera_plane_height;	// luma rows of a planar camera buffer
 	int video_width;
 	int video_height;
 	int video_buffer_width;
@@ -41,6 +95,7 @@ typedef	struct {
 	int sps_timing;
 	int hflip;
 	int vflip;
+	int num_pool_buffers;
 
 	MMAL_COMPONENT_T *camera;
 	MMAL_PORT_T *camera_video_port;
@@ -51,9 +106,51 @@ typedef	struct {
 	MMAL_PORT_T *encoder_output_port;
 	MMAL_POOL_T *encoder_output_pool;
 
+	bool use_shm_input;
+	shm_input_t shm_input;
+	vcsm_util_buffer_t input_texture;
+
+	BACKEND_T backend;
+	unsigned int kernel_features;
+	remap_cpu_t cpu;
+
 	int mb;
-	vcsm_util_program_t program;
+	remap_qpu_t qpu;
+	remap_qpu_downsample_t downsample;	// generates the levels of --mip
 	vcsm_util_buffer_t map;
+	map_source_t map_source;
+	char *map_cache_filename;
+	vcsm_util_buffer_t fallback_map;
+	map_format_t map_format;
+	map_format_t fallback_map_format;
+	vcsm_util_buffer_t gain_map;
+	vcsm_util_buffer_t blend_map;
+	vcsm_util_buffer_t blend_weights;
+	color_t color;
+	motion_t motion;
+	float transform[MOTION_NUM_PARAMS];
+	governor_t governor;
+	luma_stats_t stats;
+	pyramid_t pyramid;
+	rgb_output_t rgb;	// enabled if it has data
+	int mip_levels;	// smaller source levels of --mip, 0 if disabled
+	mip_source_t mip;
+	vcsm_util_buffer_t mip_table;
+	vcsm_util_buffer_t fallback_mip_table;
+	vcsm_util_buffer_t stereo_table;	// step table of the stereo kernel variants
+	vcsm_util_buffer_t fallback_stereo_table;
+	v3d_util_perf_t perf;
+	bool persistent;
+	v3d_util_direct_t direct;
+	vcsm_util_buffer_t doorbell;
+	volatile uint32_t *doorbell_ptr;	// locked for the lifetime of the resident kernel
+	uint32_t sequence;	// of the last frame given to the resident kernel
+
+	STARTUP_T startup;
+	pthread_t map_thread;
+	bool map_thread_running;
+	int map_phase;
+	volatile bool maps_loaded;
 
 	pthread_mutex_t mutex;
 	VCOS_SEMAPHORE_T semaphore;
@@ -61,4 +158,8 @@ typedef	struct {
 
 	FILE *output_file;
 	FILE *map_file;
+	FILE *fallback_map_file;
+	FILE *gain_map_file;
+	FILE *blend_map_file;
+	FILE *stats_file;
 } CONTEXT_T;
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rgb_output.h"
+
+static int32_t fixed(double v) {
+    return (int32_t) (v * (1 << RGB_OUTPUT_SHIFT) + 0.5);
+}
+
+bool rgb_output_init(rgb_output_t *rgb, rgb_output_format_t format, rgb_output_matrix_t matrix, int width, int height) {
+    memset(rgb, 0, sizeof(*rgb));
+    rgb->format = format;
+    rgb->width = width;
+    rgb->height = height;
+
+    // video range: Y in 16..235, U and V in 16..240
+    const double kr = matrix == RGB_OUTPUT_BT709 ? 0.2126 : 0.299;
+    const double kb = matrix == RGB_OUTPUT_BT709 ? 0.0722 : 0.114;
+    const double kg = 1.0 - kr - kb;
+    const double chroma = 255.0 / 224.0;
+    rgb->luma = fixed(255.0 / 219.0);
+    rgb->r_v = fixed(2.0 * (1.0 - kr) * chroma);
+    rgb->g_u = fixed(2.0 * (1.0 - kb) * kb / kg * chroma);
+    rgb->g_v = fixed(2.0 * (1.0 - kr) * kr / kg * chroma);
+    rgb->b_u = fixed(2.0 * (1.0 - kb) * chroma);
+
+    rgb->data = (uint8_t *) malloc(rgb_output_frame_size(rgb));
+    if (!rgb->data) {
+        fprintf(stderr, "ERROR: failed to allocate the rgb output frame\n");
+        return false;
+    }
+    return true;
+}
+
+void rgb_output_destroy(rgb_output_t *rgb) {
+    free(rgb->data);
+    rgb->data = NULL;
+}
+
+size_t rgb_output_frame_size(const rgb_output_t *rgb) {
+    return (size_t) rgb->width * rgb->height * (rgb->format == RGB_OUTPUT_RGBA32 ? 4 : 3);
+}
+
+static inline uint8_t clamp(int32_t v) {
+    v = (v + (1 << (RGB_OUTPUT_SHIFT - 1))) >> RGB_OUTPUT_SHIFT;
+    return (uint8_t) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static inline void convert(const rgb_output_t *rgb, const uint8_t *yuv, uint8_t *r, uint8_t *g, uint8_t *b) {
+    const int32_t l = (yuv[0] - 16) * rgb->luma;
+    const int u = yuv[1] - 128;
+    const int v = yuv[2] - 128;
+    *r = clamp(l + v * rgb->r_v);
+    *g = clamp(l - u * rgb->g_u - v * rgb->g_v);
+    *b = clamp(l + u * rgb->b_u);
+}
+
+static void put_rgb24(rgb_output_t *rgb, size_t i, const uint8_t *yuv, int count) {
+    uint8_t *p = rgb->data + i * 3;
+    for (int x = 0; x < count; ++x, p += 3, yuv += 3)
+        convert(rgb, yuv, &p[0], &p[1], &p[2]);
+}
+
+static void put_rgba32(rgb_output_t *rgb, size_t i, const uint8_t *yuv, int count) {
+    uint8_t *p = rgb->data + i * 4;
+    for (int x = 0; x < count; ++x, p += 4, yuv += 3) {
+        convert(rgb, yuv, &p[0], &p[1], &p[2]);
+        p[3] = 255;
+    }
+}
+
+static void put_planar(rgb_output_t *rgb, size_t i, const uint8_t *yuv, int count) {
+    const size_t plane = (size_t) rgb->width * rgb->height;
+    uint8_t *r = rgb->data + i;
+    uint8_t *g = r + plane;
+    uint8_t *b = g + plane;
+    for (int x = 0; x < count; ++x, yuv += 3)
+        convert(rgb, yuv, &r[x], &g[x], &b[x]);
+}
+
+// Converts count pixels of row y from column x on, given as Y, U, V triples.
+// The format is chosen once per call, so every loop handles a single layout.
+void rgb_output_put_row(rgb_output_t *rgb, int x, int y, const uint8_t *yuv, int count) {
+    const size_t i = (size_t) y * rgb->width + x;
+    switch (rgb->format) {
+    case RGB_OUTPUT_RGBA32:
+        put_rgba32(rgb, i, yuv, count);
+        break;
+    case RGB_OUTPUT_PLANAR:
+        put_planar(rgb, i, yuv, count);
+        break;
+    default:
+        put_rgb24(rgb, i, yuv, count);
+        break;
+    }
+}
+
+bool rgb_output_write(const rgb_output_t *rgb) {
+    const size_t size = rgb_output_frame_size(rgb);
+    return fwrite(rgb->data, 1, size, rgb->sink) == size && fflush(rgb->sink) == 0;
+}
@@ -0,0 +1,44 @@
+#ifndef RGB_OUTPUT_H
+#define RGB_OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    RGB_OUTPUT_RGB24,       // packed R, G, B
+    RGB_OUTPUT_RGBA32,      // packed R, G, B, 255
+    RGB_OUTPUT_PLANAR,      // all R, then all G, then all B
+} rgb_output_format_t;
+
+typedef enum {
+    RGB_OUTPUT_BT601,
+    RGB_OUTPUT_BT709,
+} rgb_output_matrix_t;
+
+// fixed point coefficients of the conversion, in 1/2^RGB_OUTPUT_SHIFT
+#define RGB_OUTPUT_SHIFT 16
+
+// Full range RGB frames converted from the video range YUV output.  The cpu
+// backend converts every pixel while remapping, from the full resolution
+// chroma it samples anyway.
+typedef struct {
+    rgb_output_format_t format;
+    int width;
+    int height;
+    int32_t luma;           // Y scale
+    int32_t r_v;
+    int32_t g_u;
+    int32_t g_v;
+    int32_t b_u;
+    uint8_t *data;
+    FILE *sink;
+} rgb_output_t;
+
+bool rgb_output_init(rgb_output_t *rgb, rgb_output_format_t format, rgb_output_matrix_t matrix, int width, int height);
+void rgb_output_destroy(rgb_output_t *rgb);
+size_t rgb_output_frame_size(const rgb_output_t *rgb);
+void rgb_output_put_row(rgb_output_t *rgb, int x, int y, const uint8_t *yuv, int count);
+bool rgb_output_write(const rgb_output_t *rgb);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_input.h"
+
+#define PAGE_ALIGN(x) (((x) + 4095) & ~(size_t) 4095)
+
+static size_t frame_size(shm_input_format_t format, int stride, int height) {
+    return format == SHM_INPUT_I420 ? (size_t) stride * height * 3 / 2 : (size_t) stride * height;
+}
+
+// "/name" is a POSIX shared memory object, any other path (e.g. a memfd
+// under /proc) is opened as a file.
+static int open_shm(const char *name, int flags) {
+    if (name[0] == '/' && strchr(name + 1, '/') == NULL)
+        return shm_open(name, flags, 0600);
+    return open(name, flags, 0600);
+}
+
+static void deadline(struct timespec *ts, int timeout_ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+bool shm_input_open(shm_input_t *input, const char *name) {
+    shm_input_header_t header;
+
+    memset(input, 0, sizeof(*input));
+    input->fd = open_shm(name, O_RDWR);
+    if (input->fd < 0) {
+        fprintf(stderr, "ERROR: failed to open shared memory %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    if (pread(input->fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SHM_INPUT_MAGIC || header.version != SHM_INPUT_VERSION) {
+        fprintf(stderr, "ERROR: %s is not a frame ring\n", name);
+        goto error;
+    }
+    if (header.format > SHM_INPUT_I420 || header.num_slots == 0 || header.num_slots > SHM_INPUT_MAX_SLOTS
+        || header.slot_size < frame_size(header.format, header.stride, header.height)
+        || header.stride < header.width * (header.format == SHM_INPUT_YUYV ? 2 : 1)) {
+        fprintf(stderr, "ERROR: invalid frame ring layout in %s\n", name);
+        goto error;
+    }
+
+    input->size = header.data_offset + (size_t) header.num_slots * header.slot_size;
+    void *ptr = mmap(NULL, input->size, PROT_READ | PROT_WRITE, MAP_SHARED, input->fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "ERROR: failed to map shared memory %s: %s\n", name, strerror(errno));
+        goto error;
+    }
+    input->header = (shm_input_header_t *) ptr;
+    input->data = (uint8_t *) ptr + header.data_offset;
+    return true;
+
+error:
+    close(input->fd);
+    input->fd = -1;
+    return false;
+}
+
+// Returns the oldest ready slot, or -1 on timeout or when the producer has
+// stopped.
+int shm_input_acquire(shm_input_t *input, int timeout_ms) {
+    shm_input_header_t *header = input->header;
+    struct timespec ts;
+
+    deadline(&ts, timeout_ms);
+    while (sem_timedwait(&header->ready_slots, &ts) != 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < (int) header->num_slots; ++i) {
+        if (header->slots[i].state == SHM_INPUT_SLOT_READY && (slot < 0 || header->slots[i].sequence < header->slots[slot].sequence))
+            slot = i;
+    }
+    if (slot < 0)
+        return -1;
+
+    uint64_t sequence = header->slots[slot].sequence;
+    if (sequence > input->next_sequence)
+        input->dropped += (unsigned int) (sequence - input->next_sequence);
+    input->next_sequence = sequence + 1;
+    header->slots[slot].state = SHM_INPUT_SLOT_BUSY;
+    return slot;
+}
+
+const uint8_t *shm_input_frame(const shm_input_t *input, int slot) {
+    return input->data + (size_t) slot * input->header->slot_size;
+}
+
+// The slot can be sampled in place if it already has the layout of the
+// texture: YUYV with a power of 2 row length.
+bool shm_input_is_texture(const shm_input_t *input, int texture_width) {
+    return input->header->format == SHM_INPUT_YUYV && input->header->stride == (uint32_t) texture_width * 2;
+}
+
+// The slot can be sampled in place by the planar path of the cpu backend:
+// I420 with a power of 2 luma row length.
+bool shm_input_is_planar_texture(const shm_input_t *input, int texture_width) {
+    return input->header->format == SHM_INPUT_I420 && input->header->stride == (uint32_t) texture_width;
+}
+
+void shm_input_copy_to_texture(const shm_input_t *input, int slot, uint8_t *dst, int texture_width) {
+    const shm_input_header_t *header = input->header;
+    const uint8_t *src = shm_input_frame(input, slot);
+    const int width = header->width;
+    const int height = header->height;
+    const size_t dst_stride = (size_t) texture_width * 2;
+
+    if (header->format == SHM_INPUT_YUYV) {
+        for (int y = 0; y < height; ++y)
+            memcpy(dst + y * dst_stride, src + (size_t) y * header->stride, width * 2);
+        return;
+    }
+
+    const uint8_t *src_u = src + (size_t) header->stride * height;
+    const uint8_t *src_v = src_u + (size_t) (header->stride / 2) * (height / 2);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *row_y = src + (size_t) y * header->stride;
+        const uint8_t *row_u = src_u + (size_t) (y / 2) * (header->stride / 2);
+        const uint8_t *row_v = src_v + (size_t) (y / 2) * (header->stride / 2);
+        uint8_t *d = dst + y * dst_stride;
+        for (int x = 0; x < width; x += 2) {
+            d[0] = row_y[x];
+            d[1] = row_u[x / 2];
+            d[2] = row_y[x + 1];
+            d[3] = row_v[x / 2];
+            d += 4;
+        }
+    }
+}
+
+void shm_input_release(shm_input_t *input, int slot) {
+    input->header->slots[slot].state = SHM_INPUT_SLOT_FREE;
+    sem_post(&input->header->free_slots);
+}
+
+void shm_input_close(shm_input_t *input) {
+    if (input->header)
+        munmap(input->header, input->size);
+    if (input->fd >= 0)
+        close(input->fd);
+    input->header = NULL;
+    input->fd = -1;
+}
+
+bool shm_input_create(shm_input_t *input, const char *name, shm_input_format_t format, int width, int height, int stride, int num_slots) {
+    memset(input, 0, sizeof(*input));
+    if (num_slots < 1 || num_slots > SHM_INPUT_MAX_SLOTS) {
+        fprintf(stderr, "ERROR: number of slots must be between 1 and %d\n", SHM_INPUT_MAX_SLOTS);
+        return false;
+    }
+    input->fd = open_shm(name, O_RDWR | O_CREAT | O_TRUNC);
+    if (input->fd < 0) {
+        fprintf(stderr, "ERROR: failed to create shared memory %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    const size_t data_offset = PAGE_ALIGN(sizeof(shm_input_header_t));
+    const size_t slot_size = PAGE_ALIGN(frame_size(format, stride, height));
+    input->size = data_offset + slot_size * num_slots;
+    if (ftruncate(input->fd, input->size) != 0) {
+        fprintf(stderr, "ERROR: failed to resize shared memory %s: %s\n", name, strerror(errno));
+        goto error;
+    }
+    void *ptr = mmap(NULL, input->size, PROT_READ | PROT_WRITE, MAP_SHARED, input->fd, 0);
+    if (ptr == MAP_FAILED) {
+        fprintf(stderr, "ERROR: failed to map shared memory %s: %s\n", name, strerror(errno));
+        goto error;
+    }
+
+    shm_input_header_t *header = (shm_input_header_t *) ptr;
+    memset(header, 0, sizeof(*header));
+    header->format = format;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->num_slots = num_slots;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    sem_init(&header->free_slots, 1, num_slots);
+    sem_init(&header->ready_slots, 1, 0);
+    header->version = SHM_INPUT_VERSION;
+    // written last so that a consumer never sees a half-initialized header
+    __atomic_store_n(&header->magic, SHM_INPUT_MAGIC, __ATOMIC_RELEASE);
+
+    input->header = header;
+    input->data = (uint8_t *) ptr + data_offset;
+    return true;
+
+error:
+    close(input->fd);
+    input->fd = -1;
+    return false;
+}
+
+// Returns a free slot to write the next frame to, or -1 if the consumer has
+// not given one back within the timeout.
+int shm_input_begin_write(shm_input_t *input, int timeout_ms) {
+    shm_input_header_t *header = input->header;
+    struct timespec ts;
+
+    deadline(&ts, timeout_ms);
+    while (sem_timedwait(&header->free_slots, &ts) != 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    for (int i = 0; i < (int) header->num_slots; ++i) {
+        if (header->slots[i].state == SHM_INPUT_SLOT_FREE) {
+            header->slots[i].state = SHM_INPUT_SLOT_BUSY;
+            return i;
+        }
+    }
+    sem_post(&header->free_slots);
+    return -1;
+}
+
+uint8_t *shm_input_slot_data(shm_input_t *input, int slot) {
+    return input->data + (size_t) slot * input->header->slot_size;
+}
+
+void shm_input_publish(shm_input_t *input, int slot, int64_t pts) {
+    shm_input_slot_t *s = &input->header->slots[slot];
+    s->sequence = input->next_sequence++;
+    s->pts = pts;
+    s->state = SHM_INPUT_SLOT_READY;
+    sem_post(&input->header->ready_slots);
+}
+
+void shm_input_destroy(shm_input_t *input, const char *name) {
+    if (input->header) {
+        input->header->closed = 1;
+        // wake up the consumer so that it sees the flag
+        sem_post(&input->header->ready_slots);
+    }
+    shm_input_close(input);
+    if (name[0] == '/' && strchr(name + 1, '/') == NULL)
+        shm_unlink(name);
+}
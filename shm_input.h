@@ -0,0 +1,78 @@
+#ifndef SHM_INPUT_H
+#define SHM_INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+// A ring of frames in shared memory (shm_open name or a path such as
+// /proc/<pid>/fd/<memfd>) written by another process.  The producer creates
+// it, waits on free_slots, fills a FREE slot, sets its sequence and pts, marks
+// it READY and posts ready_slots.  The consumer takes the READY slot with the
+// lowest sequence and gives it back by marking it FREE and posting free_slots.
+#define SHM_INPUT_MAGIC     0x53564d52 // "RMVS"
+#define SHM_INPUT_VERSION   1
+#define SHM_INPUT_MAX_SLOTS 8
+
+typedef enum {
+    SHM_INPUT_YUYV = 0,     // packed, stride bytes per row
+    SHM_INPUT_I420 = 1,     // Y with stride bytes per row, then U and V with stride / 2
+} shm_input_format_t;
+
+typedef enum {
+    SHM_INPUT_SLOT_FREE = 0,
+    SHM_INPUT_SLOT_READY = 1,
+    SHM_INPUT_SLOT_BUSY = 2,
+} shm_input_slot_state_t;
+
+typedef struct {
+    volatile uint32_t state;
+    uint32_t reserved;
+    volatile uint64_t sequence;
+    volatile int64_t pts;    // in microseconds
+} shm_input_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint32_t data_offset;    // of the first slot, page aligned
+    volatile uint32_t closed; // set by the producer when it stops
+    sem_t free_slots;
+    sem_t ready_slots;
+    shm_input_slot_t slots[SHM_INPUT_MAX_SLOTS];
+} shm_input_header_t;
+
+typedef struct {
+    int fd;
+    size_t size;
+    shm_input_header_t *header;
+    uint8_t *data;
+    uint64_t next_sequence;
+    unsigned int dropped;    // frames lost between the producer and us
+} shm_input_t;
+
+// consumer
+bool shm_input_open(shm_input_t *input, const char *name);
+int shm_input_acquire(shm_input_t *input, int timeout_ms);
+const uint8_t *shm_input_frame(const shm_input_t *input, int slot);
+bool shm_input_is_texture(const shm_input_t *input, int texture_width);
+bool shm_input_is_planar_texture(const shm_input_t *input, int texture_width);
+void shm_input_copy_to_texture(const shm_input_t *input, int slot, uint8_t *dst, int texture_width);
+void shm_input_release(shm_input_t *input, int slot);
+void shm_input_close(shm_input_t *input);
+
+// producer
+bool shm_input_create(shm_input_t *input, const char *name, shm_input_format_t format, int width, int height, int stride, int num_slots);
+int shm_input_begin_write(shm_input_t *input, int timeout_ms);
+uint8_t *shm_input_slot_data(shm_input_t *input, int slot);
+void shm_input_publish(shm_input_t *input, int slot, int64_t pts);
+void shm_input_destroy(shm_input_t *input, const char *name);
+
+#endif
@@ -0,0 +1,78 @@
+// Converts OpenCV remap matrices into a map file on all cores, the fast
+// counterpart of convert_maps.py.
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "map_loader.h"
+
+static void print_usage() {
+    fprintf(stderr,
+        "Usage: convert_map\n"
+        "\t--map-x <string> : CV_32FC1 x map, or CV_16SC2 map without --map-y (raw or .npy)\n"
+        "\t[--map-y <string>] : CV_32FC1 y map (raw or .npy)\n"
+        "\t[--map-frac <string>] : CV_16UC1 interpolation table indices of the CV_16SC2 map\n"
+        "\t--output <string> : Map filename\n"
+        "\t[--map-width <integer>] : Width of raw maps\n"
+        "\t[--map-height <integer>] : Height of raw maps\n"
+        "\t[--image-width <integer>] : Width of the image to be remapped (default: map width)\n"
+        "\t[--image-height <integer>] : Height of the image to be remapped (default: map height)\n"
+    );
+}
+
+int main(int argc, char *argv[]) {
+    map_source_t source = {0};
+    const char *output = NULL;
+
+    struct option long_options[] = {
+        {"map-x", required_argument, NULL, 'x'},
+        {"map-y", required_argument, NULL, 'y'},
+        {"map-frac", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"map-width", required_argument, NULL, 'w'},
+        {"map-height", required_argument, NULL, 'h'},
+        {"image-width", required_argument, NULL, 'W'},
+        {"image-height", required_argument, NULL, 'H'},
+        {NULL, 0, NULL, 0}
+    };
+    int ch, option_index;
+    while ((ch = getopt_long_only(argc, argv, "", long_options, &option_index)) != -1) {
+        switch (ch) {
+        case 'x': source.map_x = optarg; break;
+        case 'y': source.map_y = optarg; break;
+        case 'f': source.map_frac = optarg; break;
+        case 'o': output = optarg; break;
+        case 'w': source.width = atoi(optarg); break;
+        case 'h': source.height = atoi(optarg); break;
+        case 'W': source.image_width = atoi(optarg); break;
+        case 'H': source.image_height = atoi(optarg); break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!source.map_x || !output) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    if (!map_loader_probe(&source))
+        return EXIT_FAILURE;
+    uint32_t *entries = (uint32_t *) malloc((size_t) source.width * source.height * sizeof(uint32_t));
+    if (!entries) {
+        fprintf(stderr, "ERROR: failed to allocate the map\n");
+        return EXIT_FAILURE;
+    }
+    bool result = map_loader_convert(&source, entries) && map_loader_write(output, &source, entries);
+    free(entries);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (result)
+        fprintf(stderr, "%dx%d map converted in %.1f ms\n", source.width, source.height,
+            (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6);
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
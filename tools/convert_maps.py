@@ -1,6 +1,4 @@
-import sys
 import numpy as np
-from struct import unpack
 import argparse
 
 num_elements = 16
@@ -18,6 +16,10 @@ if __name__ == '__main__':
     parser.add_argument("-x", "--map-x", type=str, help="input filename of x-coord map", required=True)
     parser.add_argument("-y", "--map-y", type=str, help="input filename of y-coord map", required=True)
     parser.add_argument("-o", "--output", type=str, help="output filename", required=True)
+    parser.add_argument("--blend-x", type=str, help="input filename of x-coord map of the second sample")
+    parser.add_argument("--blend-y", type=str, help="input filename of y-coord map of the second sample")
+    parser.add_argument("--blend-weight", type=str, help="input filename of blend weight map (0.0: first, 1.0: second)")
+    parser.add_argument("--blend-output", type=str, help="output filename of blend map")
     args = parser.parse_args()
 
     map_width = args.map_width
@@ -28,24 +30,41 @@ if __name__ == '__main__':
     src_x = src_x.astype('int16').reshape((map_height, map_width))
     src_y = (np.fromfile(args.map_y, dtype='float32') / (image_height - 1) - 0.5) * 65535
     src_y = src_y.astype('int16').reshape((map_height, map_width))
-    dst = np.empty(map_height * map_width, dtype='uint32')
+    blend = [args.blend_x, args.blend_y, args.blend_weight, args.blend_output]
+    if any(blend) and not all(blend):
+        parser.error("--blend-x, --blend-y, --blend-weight and --blend-output must be given together")
     nx = map_width // num_elements
     ny = map_height // num_threads
 
-    i = 0
-    for ty in range(ny):
-        sys.stdout.write(f'\r{ty+1}/{ny}')
-        sys.stdout.flush()
-        for tx in range(nx):
-            x = tx * 16
-            for th in range(num_threads):
-                y = ty * num_threads + th
-                su16 = np.array(unpack('16H', src_x[y, x:x+num_elements]), dtype='uint32')
-                sv16 = np.array(unpack('16H', src_y[y, x:x+num_elements]), dtype='uint32')
-                dst[i:i+num_elements] = (sv16<<16) | su16
-                i += num_elements
-    print("")
+    # tile order: for every row of num_threads rows, for every step of
+    # num_elements pixels, the num_elements entries of each of the rows
+    su = src_x.view('uint16').astype('uint32')
+    sv = src_y.view('uint16').astype('uint32')
+    dst = ((sv << 16) | su).reshape((ny, num_threads, nx, num_elements)).transpose((0, 2, 1, 3)).ravel()
     header = np.array([map_width, map_height, image_width, image_height], dtype=np.int32)
     with open(args.output, 'wb') as f:
         header.tofile(f)
         dst.tofile(f)
+
+    if args.blend_output:
+        blend_x = (np.fromfile(args.blend_x, dtype='float32') / (next_pow2(image_width) - 1) - 0.5) * 65535
+        blend_x = blend_x.astype('int16').reshape((map_height, map_width)).view('uint16').astype('uint32')
+        blend_y = (np.fromfile(args.blend_y, dtype='float32') / (image_height - 1) - 0.5) * 65535
+        blend_y = blend_y.astype('int16').reshape((map_height, map_width)).view('uint16').astype('uint32')
+        weight = np.fromfile(args.blend_weight, dtype='float32').reshape((map_height, map_width))
+        weight = np.clip(np.rint(weight * 255), 0, 255).astype('uint8')
+
+        # only the blocks of num_elements pixels in the overlap area are stored
+        block = np.dtype([('x', '<i4'), ('y', '<i4'), ('coord', '<u4', num_elements), ('weight', 'u1', num_elements)])
+        blocks = []
+        for y in range(map_height):
+            for x in range(0, map_width, num_elements):
+                w = weight[y, x:x+num_elements]
+                if w.any():
+                    coord = (blend_y[y, x:x+num_elements] << 16) | blend_x[y, x:x+num_elements]
+                    blocks.append((x, y, coord, w))
+        print(f'blend blocks: {len(blocks)}')
+        header = np.array([map_width, map_height, len(blocks)], dtype=np.int32)
+        with open(args.blend_output, 'wb') as f:
+            header.tofile(f)
+            np.array(blocks, dtype=block).tofile(f)
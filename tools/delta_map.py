@@ -0,0 +1,108 @@
+import sys
+import numpy as np
+import argparse
+
+num_elements = 16
+num_threads = 12
+block_size = num_elements * num_threads
+
+DELTA_MAP_MAGIC = 0x41544c44
+DELTA_MAP_FULL = 1
+STEREO_MAP_MAGIC = 0x4f455453
+
+block_dtype = np.dtype([('base_s', '<i2'), ('base_t', '<i2'), ('shift', 'u1'), ('flags', 'u1'), ('reserved', '<u2'), ('offset', '<u4')])
+
+def next_pow2(x):
+    return 1<<(x-1).bit_length()
+
+def untile(entries, width, height):
+    return entries.reshape((height // num_threads, width // num_elements, num_threads, num_elements)).transpose((0, 2, 1, 3)).reshape((height, width))
+
+def split(entries):
+    s = (entries & 0xffff).astype(np.uint16).view(np.int16).astype(np.int32)
+    t = (entries >> 16).astype(np.uint16).view(np.int16).astype(np.int32)
+    return s, t
+
+def blocks(a):
+    # (height, width) to (number of blocks, block_size) in map order
+    height, width = a.shape
+    return a.reshape((height // num_threads, num_threads, width // num_elements, num_elements)).transpose((0, 2, 1, 3)).reshape((-1, block_size))
+
+def identity(size, image_size, texture_size):
+    # map units of the source position of every output column or row, as if the map only scaled
+    position = (np.arange(size) + 0.5) * image_size / size - 0.5
+    return np.clip(np.round((position / (texture_size - 1) - 0.5) * 65535), -32768, 32767).astype(np.int32)
+
+def encode(residual, max_error):
+    # base and smallest shift per block so that the displacements fit into int8
+    low, high = residual.min(axis=1), residual.max(axis=1)
+    base = np.clip((low + high) // 2, -32768, 32767)
+    d = residual - base[:, None]
+    extent = np.abs(d).max(axis=1)
+    shift = np.zeros(len(d), dtype=np.int32)
+    for k in range(16):
+        shift[(shift == k) & (extent >> k > 127)] += 1
+    q = (d + ((1 << shift) >> 1)[:, None]) >> shift[:, None]
+    # rounding up may still overflow by one step
+    over = q.max(axis=1) > 127
+    shift[over] += 1
+    q[over] = (d[over] + ((1 << shift[over]) >> 1)[:, None]) >> shift[over][:, None]
+    error = np.abs(d - (q << shift[:, None])).max(axis=1)
+    return base, shift, q, error <= max_error
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Store a map as 8-bit displacements from the identity mapping, with full entries for the blocks that do not fit.")
+    parser.add_argument("input", type=str, help="map file")
+    parser.add_argument("output", type=str, help="output filename of the delta map")
+    parser.add_argument("--max-error", type=float, default=0.125, help="largest error of a displacement in source pixels")
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        map_width, map_height, image_width, image_height = (int(v) for v in np.fromfile(f, dtype=np.int32, count=4))
+        if map_width in (STEREO_MAP_MAGIC, DELTA_MAP_MAGIC):
+            sys.exit(f'ERROR: {args.input} is not a plain map')
+        entries = np.fromfile(f, dtype=np.uint32, count=map_width * map_height)
+
+    s, t = split(untile(entries, map_width, map_height))
+    identity_s = identity(map_width, image_width, next_pow2(image_width))
+    identity_t = identity(map_height, image_height, image_height)
+
+    # map units per source pixel
+    unit_s = 65535 / (next_pow2(image_width) - 1)
+    unit_t = 65535 / (image_height - 1)
+    base_s, shift_s, ds, fit_s = encode(blocks(s - identity_s[None, :]), args.max_error * unit_s)
+    base_t, shift_t, dt, fit_t = encode(blocks(t - identity_t[:, None]), args.max_error * unit_t)
+    fit = fit_s & fit_t
+
+    # same as delta_map_entry() in delta_map.h
+    decoded_s = np.clip(blocks(np.broadcast_to(identity_s[None, :], s.shape)) + base_s[:, None] + (ds << shift_s[:, None]), -32768, 32767)
+    decoded_t = np.clip(blocks(np.broadcast_to(identity_t[:, None], t.shape)) + base_t[:, None] + (dt << shift_t[:, None]), -32768, 32767)
+    fit &= (np.abs(decoded_s - blocks(s)).max(axis=1) <= args.max_error * unit_s) & (np.abs(decoded_t - blocks(t)).max(axis=1) <= args.max_error * unit_t)
+
+    table = np.zeros(len(fit), dtype=block_dtype)
+    table['base_s'] = np.where(fit, base_s, 0)
+    table['base_t'] = np.where(fit, base_t, 0)
+    table['shift'] = np.where(fit, shift_s | (shift_t << 4), 0)
+    table['flags'] = np.where(fit, 0, DELTA_MAP_FULL)
+    sizes = np.where(fit, block_size * 2, block_size * 4)
+    table['offset'] = np.concatenate(([0], np.cumsum(sizes)[:-1]))
+
+    full = blocks(untile(entries, map_width, map_height))
+    payload = bytearray()
+    for i in range(len(fit)):
+        if fit[i]:
+            payload += np.stack((ds[i], dt[i]), axis=1).astype(np.int8).tobytes()
+        else:
+            payload += full[i].astype('<u4').tobytes()
+
+    header = np.array([DELTA_MAP_MAGIC, map_width, map_height, image_width, image_height, len(fit), len(payload)], dtype=np.uint32)
+    with open(args.output, 'wb') as f:
+        header.tofile(f)
+        identity_s.astype('<i2').tofile(f)
+        identity_t.astype('<i2').tofile(f)
+        table.tofile(f)
+        f.write(payload)
+
+    size = 4 * 7 + 2 * (map_width + map_height) + table.nbytes + len(payload)
+    print(f'wrote {args.output}: {np.count_nonzero(fit)} of {len(fit)} blocks as displacements, '
+        f'{size} bytes ({100 * size / (16 + 4 * map_width * map_height):.0f}% of the map)')
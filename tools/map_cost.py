@@ -0,0 +1,208 @@
+import sys
+import numpy as np
+import argparse
+
+num_elements = 16
+num_threads = 12
+tile_width = 128
+
+# TMU cache line: 64 bytes of one source row, i.e. 32 YUYV texels
+line_bytes = 64
+line_texels = line_bytes // 2
+
+STEREO_MAP_MAGIC = 0x4f455453
+STEREO_MAP_MIRROR = 1
+DELTA_MAP_MAGIC = 0x41544c44
+DELTA_MAP_FULL = 1
+
+# V3D core clock and stock SDRAM clocks (normal, and turbo where it differs)
+# in MHz of the supported boards
+boards = {
+    'pi1': {'core': 250, 'sdram': {'normal': 400}},
+    'pi2': {'core': 250, 'sdram': {'normal': 450}},
+    'pi3': {'core': 300, 'sdram': {'normal': 450}},
+    'zero': {'core': 400, 'sdram': {'normal': 450, 'turbo': 550}},
+    'zero2': {'core': 400, 'sdram': {'normal': 450, 'turbo': 600}},
+}
+
+def next_pow2(x):
+    return 1<<(x-1).bit_length()
+
+def untile(entries, width, height):
+    # undo the tile order of tools/convert_maps.py
+    entries = entries.reshape((height // num_threads, width // num_elements, num_threads, num_elements))
+    return entries.transpose((0, 2, 1, 3)).reshape((height, width))
+
+def read_delta_map(f):
+    # decoded as delta_map_entry() in delta_map.h does, in map order
+    map_width, map_height, image_width, image_height, num_blocks, payload_size = (int(v) for v in np.fromfile(f, dtype=np.uint32, count=6))
+    identity_s = np.fromfile(f, dtype='<i2', count=map_width).astype(np.int32)
+    identity_t = np.fromfile(f, dtype='<i2', count=map_height).astype(np.int32)
+    blocks = np.fromfile(f, dtype=[('base_s', '<i2'), ('base_t', '<i2'), ('shift', 'u1'), ('flags', 'u1'), ('reserved', '<u2'), ('offset', '<u4')], count=num_blocks)
+    payload = np.frombuffer(f.read(payload_size), dtype=np.uint8)
+    if len(payload) != payload_size:
+        sys.exit('ERROR: the delta map is truncated')
+    size = num_elements * num_threads
+    ids = np.tile(identity_s, map_height).reshape((map_height, map_width))
+    idt = np.repeat(identity_t, map_width).reshape((map_height, map_width))
+    tiled = lambda a: a.reshape((map_height // num_threads, num_threads, map_width // num_elements, num_elements)).transpose((0, 2, 1, 3)).reshape((-1, size))
+    ids, idt = tiled(ids), tiled(idt)
+    entries = np.zeros((num_blocks, size), dtype=np.uint32)
+    for i, block in enumerate(blocks):
+        offset = int(block['offset'])
+        if block['flags'] & DELTA_MAP_FULL:
+            entries[i] = payload[offset:offset + size * 4].view('<u4')
+        else:
+            d = payload[offset:offset + size * 2].view(np.int8).astype(np.int32).reshape((size, 2))
+            s = np.clip(ids[i] + int(block['base_s']) + (d[:, 0] << (int(block['shift']) & 0xf)), -32768, 32767)
+            t = np.clip(idt[i] + int(block['base_t']) + (d[:, 1] << (int(block['shift']) >> 4)), -32768, 32767)
+            entries[i] = (t.astype(np.uint32) << 16) | (s.astype(np.uint32) & 0xffff)
+    return np.array([map_width, map_height, image_width, image_height]), entries.ravel()
+
+def load_map(filename):
+    with open(filename, 'rb') as f:
+        header = np.fromfile(f, dtype=np.int32, count=4)
+        delta = header[0] == DELTA_MAP_MAGIC
+        if delta:
+            f.seek(4)
+            header, entries = read_delta_map(f)
+        stereo = header[0] == STEREO_MAP_MAGIC
+        if stereo:
+            header = np.concatenate([header[1:], np.fromfile(f, dtype=np.int32, count=4)])
+        map_width, map_height, image_width, image_height = (int(v) for v in header[:4])
+        stored_width = map_width // 2 if stereo else map_width
+        if not delta:
+            entries = np.fromfile(f, dtype=np.uint32, count=stored_width * map_height)
+    if len(entries) != stored_width * map_height:
+        sys.exit(f'ERROR: {filename} is truncated')
+    entries = untile(entries, stored_width, map_height)
+    s = (entries & 0xffff).astype(np.uint16).view(np.int16).astype(np.int32)
+    t = (entries >> 16).astype(np.uint16).view(np.int16).astype(np.int32)
+    if stereo:
+        # the right eye as stereo_map_right_entry() in map_util.h derives it
+        flags, offset_s, offset_t = (int(v) for v in header[4:])
+        mirror = flags & STEREO_MAP_MIRROR
+        rs = offset_s - s[:, ::-1] if mirror else offset_s + s
+        rt = offset_t + (t[:, ::-1] if mirror else t)
+        s = np.concatenate([s, np.clip(rs, -32768, 32767)], axis=1)
+        t = np.concatenate([t, np.clip(rt, -32768, 32767)], axis=1)
+    s = s / 65535 + 0.5
+    t = t / 65535 + 0.5
+    # source position in texels of the texture (its width is a power of 2)
+    x = s * (next_pow2(image_width) - 1)
+    y = t * (image_height - 1)
+    return map_width, map_height, image_width, image_height, x, y
+
+def footprint(x, y, image_width, image_height):
+    # the 2x2 texels of the bilinear lookup, clamped to edge
+    x0 = np.clip(np.floor(x).astype(np.int64), 0, image_width - 1)
+    y0 = np.clip(np.floor(y).astype(np.int64), 0, image_height - 1)
+    x1 = np.minimum(x0 + 1, image_width - 1)
+    y1 = np.minimum(y0 + 1, image_height - 1)
+    return x0, y0, x1, y1
+
+def coverage(x0, y0, x1, y1, image_width, image_height):
+    used = np.zeros((image_height, image_width), dtype=bool)
+    for xi, yi in ((x0, y0), (x1, y0), (x0, y1), (x1, y1)):
+        used[yi, xi] = True
+    return used.mean()
+
+def scale_factors(x, y):
+    # source area covered by one output pixel (> 1: minification, < 1: magnification)
+    dxdv, dxdu = np.gradient(x)
+    dydv, dydu = np.gradient(y)
+    return np.abs(dxdu * dydv - dxdv * dydu)
+
+def reuse(x0, y0):
+    # neighbours whose bilinear footprints share at least one texel
+    h = (np.abs(np.diff(x0, axis=1)) <= 1) & (np.abs(np.diff(y0, axis=1)) <= 1)
+    v = (np.abs(np.diff(x0, axis=0)) <= 1) & (np.abs(np.diff(y0, axis=0)) <= 1)
+    return h.mean(), v.mean()
+
+def tile_misses(x0, y0, x1, y1, map_width, map_height, image_height):
+    # Every cache line is fetched once per tile: lines are assumed to stay in
+    # the TMU cache within a tile and to be evicted before the next one.
+    tiles_x = map_width // tile_width
+    ty, tx = np.indices((map_height, map_width))
+    tile = (ty // num_threads) * tiles_x + np.minimum(tx // tile_width, tiles_x - 1)
+    lines_per_row = np.int64(1) << 32
+    keys = []
+    for xi in (x0, x1):
+        for yi in (y0, y1):
+            keys.append((tile * image_height + yi) * lines_per_row + xi // line_texels)
+    keys = np.unique(np.concatenate([k.ravel() for k in keys]))
+    tiles_y = map_height // num_threads
+    misses = np.bincount(keys // (image_height * lines_per_row), minlength=tiles_x * tiles_y)
+    return misses[:tiles_x * tiles_y].reshape((tiles_y, tiles_x))
+
+def write_heatmap(filename, cost):
+    # one pixel per 4x4 output pixels, brighter is more expensive
+    image = np.repeat(np.repeat(cost, num_threads, axis=0), tile_width, axis=1)[::4, ::4]
+    image = (image * 255 / max(image.max(), 1)).astype(np.uint8)
+    with open(filename, 'wb') as f:
+        f.write(b'P5\n%d %d\n255\n' % (image.shape[1], image.shape[0]))
+        f.write(image.tobytes())
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Estimate the cost of a remap map file and the framerate it can sustain.")
+    parser.add_argument("map", type=str, help="map file (see convert_maps.py)")
+    parser.add_argument("--heatmap", type=str, help="output filename of the per-tile cost image (PGM)")
+    parser.add_argument("--qpu-cycles-per-pixel", type=float, default=10.0, help="QPU cycles per output pixel and QPU")
+    parser.add_argument("--stream-efficiency", type=float, default=0.25, help="fraction of the SDRAM peak reached by sequential access")
+    parser.add_argument("--texture-efficiency", type=float, default=0.15, help="fraction of the SDRAM peak reached by texture fetches")
+    parser.add_argument("--camera-width", type=int, help="width of the camera frame (default: image width of the map)")
+    parser.add_argument("--camera-height", type=int, help="height of the camera frame (default: image height of the map)")
+    parser.add_argument("--sdram-freq", type=int, action="append", default=[], help="also predict every board at this SDRAM clock in MHz (sdram_freq of config.txt), can be repeated")
+    args = parser.parse_args()
+
+    map_width, map_height, image_width, image_height, x, y = load_map(args.map)
+    camera_width = args.camera_width if args.camera_width is not None else image_width
+    camera_height = args.camera_height if args.camera_height is not None else image_height
+    pixels = map_width * map_height
+    x0, y0, x1, y1 = footprint(x, y, image_width, image_height)
+
+    print(f'map: {map_width}x{map_height}, source: {image_width}x{image_height}')
+    print(f'source coverage: {coverage(x0, y0, x1, y1, image_width, image_height) * 100:.1f}%')
+
+    scale = scale_factors(x, y)
+    print('source area per output pixel:')
+    edges = [0, 0.25, 0.5, 1, 2, 4, np.inf]
+    counts, _ = np.histogram(scale, bins=edges)
+    for lo, hi, count in zip(edges[:-1], edges[1:], counts):
+        kind = 'magnified' if hi <= 1 else 'minified'
+        print(f'  {lo:5.2f} - {hi:5.2f} ({kind:9}) {count * 100 / pixels:5.1f}%')
+
+    reuse_h, reuse_v = reuse(x0, y0)
+    print(f'texel reuse with neighbours: horizontal {reuse_h * 100:.1f}%, vertical {reuse_v * 100:.1f}%')
+
+    misses = tile_misses(x0, y0, x1, y1, map_width, map_height, image_height)
+    print(f'TMU cache misses per tile: mean {misses.mean():.0f}, max {misses.max()}, total {misses.sum()}')
+
+    # bytes moved through SDRAM per frame
+    map_bytes = pixels * 4
+    texture_bytes = int(misses.sum()) * line_bytes
+    destination_bytes = pixels * 3 // 2
+    # the camera writes its frame, the encoder reads the output and its reference frame and writes a new one
+    other_bytes = camera_width * camera_height * 2 + destination_bytes * 3
+    print('bytes per frame:')
+    print(f'  map          {map_bytes / 1e6:7.2f} MB')
+    print(f'  source       {texture_bytes / 1e6:7.2f} MB')
+    print(f'  destination  {destination_bytes / 1e6:7.2f} MB')
+    print(f'  camera/enc.  {other_bytes / 1e6:7.2f} MB')
+
+    if args.heatmap:
+        write_heatmap(args.heatmap, misses)
+
+    # The frame takes the longer of the QPU time and the SDRAM time.  The
+    # efficiencies are rough and best tuned against measured framerates.
+    print('predicted framerate:')
+    stream_bytes = map_bytes + destination_bytes + other_bytes
+    for name, board in boards.items():
+        qpu_ms = pixels * args.qpu_cycles_per_pixel / num_threads / (board['core'] * 1e3)
+        clocks = list(board['sdram'].items()) + [('custom', freq) for freq in args.sdram_freq]
+        for cond, sdram in clocks:
+            peak = sdram * 1e6 * 2 * 4 / 1e3  # bytes per ms, 32-bit DDR
+            memory_ms = (stream_bytes / args.stream_efficiency + texture_bytes / args.texture_efficiency) / peak
+            frame_ms = max(qpu_ms, memory_ms)
+            bound = 'qpu' if qpu_ms > memory_ms else 'sdram'
+            print(f'  {name:6} {cond:6} ({sdram} MHz): {1000 / frame_ms:5.1f} fps ({bound} bound, {frame_ms:.1f} ms)')
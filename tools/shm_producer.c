@@ -0,0 +1,178 @@
+// Feeds raw frames from a file (or stdin) into a shared memory frame ring at a
+// fixed rate, e.g. to load-test remapvid --shm-input without a camera.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "shm_input.h"
+
+static volatile bool is_running = true;
+
+static void signal_handler(int signal_number) {
+    is_running = false;
+}
+
+static void print_usage() {
+    fprintf(stderr,
+        "Usage: shm_producer\n"
+        "\t--name <string> : Shared memory name (/name) or file path\n"
+        "\t--width <integer> : Frame width\n"
+        "\t--height <integer> : Frame height\n"
+        "\t[--input <string>] : Raw frame file (default: stdin)\n"
+        "\t[--format <yuyv|i420>] : Frame format (default: yuyv)\n"
+        "\t[--stride <integer>] : Bytes per row (default: power of 2 width, so that remapvid can sample in place)\n"
+        "\t[--rate <float>] : Frames per second (default: 30)\n"
+        "\t[--slots <integer>] : Number of slots (default: 3)\n"
+        "\t[--loop] : Start over at the end of the input file\n"
+    );
+}
+
+static int next_pow2(int x) {
+    int p = 1;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Returns 1 if a frame was read, 0 at the end of the input and -1 on error.
+static int read_frame(FILE *fp, uint8_t *dst, shm_input_format_t format, int width, int height, int stride, bool loop) {
+    const int planes = format == SHM_INPUT_I420 ? 3 : 1;
+    bool rewound = false;
+    for (int p = 0; p < planes; ++p) {
+        const int w = format == SHM_INPUT_YUYV ? width * 2 : (p == 0 ? width : width / 2);
+        const int h = p == 0 ? height : height / 2;
+        const int s = p == 0 ? stride : stride / 2;
+        for (int y = 0; y < h; ++y) {
+            if (fread(dst + (size_t) y * s, 1, w, fp) != (size_t) w) {
+                if (!loop || p != 0 || y != 0)
+                    return 0;
+                // nothing to loop over if the input is still empty after the rewind
+                if (rewound) {
+                    fprintf(stderr, "ERROR: the input has no frame to loop\n");
+                    return -1;
+                }
+                if (fseek(fp, 0, SEEK_SET) != 0)
+                    return 0;
+                rewound = true;
+                --y;
+            }
+        }
+        dst += (size_t) s * h;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int exit_code = EXIT_FAILURE;
+    const char *name = NULL;
+    const char *input_filename = NULL;
+    shm_input_format_t format = SHM_INPUT_YUYV;
+    int width = 0, height = 0, stride = 0, num_slots = 3;
+    double rate = 30;
+    bool loop = false;
+    FILE *fp = stdin;
+    shm_input_t ring = {.fd = -1};
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    struct option long_options[] = {
+        {"name", required_argument, NULL, 'a'},
+        {"width", required_argument, NULL, 'b'},
+        {"height", required_argument, NULL, 'c'},
+        {"input", required_argument, NULL, 'd'},
+        {"format", required_argument, NULL, 'e'},
+        {"stride", required_argument, NULL, 'f'},
+        {"rate", required_argument, NULL, 'g'},
+        {"slots", required_argument, NULL, 'i'},
+        {"loop", no_argument, NULL, 'j'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int ch, option_index;
+    while ((ch = getopt_long_only(argc, argv, "", long_options, &option_index)) != -1) {
+        switch (ch) {
+        case 'a': name = optarg; break;
+        case 'b': width = atoi(optarg); break;
+        case 'c': height = atoi(optarg); break;
+        case 'd': input_filename = optarg; break;
+        case 'e':
+            if (strcmp(optarg, "yuyv") == 0) {
+                format = SHM_INPUT_YUYV;
+            } else if (strcmp(optarg, "i420") == 0) {
+                format = SHM_INPUT_I420;
+            } else {
+                fprintf(stderr, "ERROR: invalid value for argument '--format'\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f': stride = atoi(optarg); break;
+        case 'g': rate = atof(optarg); break;
+        case 'i': num_slots = atoi(optarg); break;
+        case 'j': loop = true; break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!name || width <= 0 || height <= 0 || rate <= 0) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (stride == 0)
+        stride = format == SHM_INPUT_YUYV ? next_pow2(width) * 2 : width;
+
+    if (input_filename) {
+        fp = fopen(input_filename, "rb");
+        if (!fp) {
+            fprintf(stderr, "ERROR: failed to open file %s\n", input_filename);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!shm_input_create(&ring, name, format, width, height, stride, num_slots))
+        goto error;
+
+    const int64_t interval_us = (int64_t) (1e6 / rate);
+    const int64_t start_us = now_us();
+    unsigned int frames = 0, waits = 0;
+    while (is_running) {
+        int slot = shm_input_begin_write(&ring, 100);
+        if (slot < 0) {
+            // the consumer is behind or not attached yet
+            ++waits;
+            continue;
+        }
+        const int result = read_frame(fp, shm_input_slot_data(&ring, slot), format, width, height, stride, loop && fp != stdin);
+        if (result < 0)
+            goto error;
+        if (result == 0)
+            break;
+
+        const int64_t due_us = start_us + frames * interval_us;
+        int64_t wait_us = due_us - now_us();
+        if (wait_us > 0) {
+            struct timespec ts = {wait_us / 1000000, (wait_us % 1000000) * 1000};
+            nanosleep(&ts, NULL);
+        }
+        shm_input_publish(&ring, slot, due_us - start_us);
+        ++frames;
+    }
+    fprintf(stderr, "%u frames, %u waits for a free slot\n", frames, waits);
+    exit_code = EXIT_SUCCESS;
+
+error:
+    shm_input_destroy(&ring, name);
+    if (fp != stdin)
+        fclose(fp);
+    return exit_code;
+}
@@ -0,0 +1,81 @@
+import sys
+import numpy as np
+import argparse
+
+num_elements = 16
+num_threads = 12
+
+STEREO_MAP_MAGIC = 0x4f455453
+STEREO_MAP_MIRROR = 1
+
+def next_pow2(x):
+    return 1<<(x-1).bit_length()
+
+def untile(entries, width, height):
+    return entries.reshape((height // num_threads, width // num_elements, num_threads, num_elements)).transpose((0, 2, 1, 3)).reshape((height, width))
+
+def tile(entries):
+    height, width = entries.shape
+    return entries.reshape((height // num_threads, num_threads, width // num_elements, num_elements)).transpose((0, 2, 1, 3)).ravel()
+
+def split(entries):
+    s = (entries & 0xffff).astype(np.uint16).view(np.int16).astype(np.int32)
+    t = (entries >> 16).astype(np.uint16).view(np.int16).astype(np.int32)
+    return s, t
+
+def derive(left, mirror, offset_s, offset_t):
+    # same as stereo_map_right_entry() in map_util.h
+    s, t = split(left[:, ::-1] if mirror else left)
+    s = offset_s - s if mirror else offset_s + s
+    return np.clip(s, -32768, 32767), np.clip(t + offset_t, -32768, 32767)
+
+def fit(left, right, mirror):
+    ls, lt = split(left[:, ::-1] if mirror else left)
+    rs, rt = split(right)
+    offset_s = int(np.median(rs + ls if mirror else rs - ls))
+    offset_t = int(np.median(rt - lt))
+    s, t = derive(left, mirror, offset_s, offset_t)
+    return offset_s, offset_t, np.abs(s - rs).max(), np.abs(t - rt).max()
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Store a side-by-side stereo map as the left eye map plus a transform of the right eye.")
+    parser.add_argument("input", type=str, help="map file of both eyes")
+    parser.add_argument("output", type=str, help="output filename of the stereo map")
+    parser.add_argument("--mode", choices=['auto', 'identical', 'mirror'], default='auto', help="how the right eye is derived from the left one")
+    parser.add_argument("--max-error", type=float, default=0.25, help="largest error of the derived right eye in source pixels")
+    parser.add_argument("--force", action="store_true", help="write the stereo map even if the error is larger")
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        map_width, map_height, image_width, image_height = (int(v) for v in np.fromfile(f, dtype=np.int32, count=4))
+        if map_width == STEREO_MAP_MAGIC:
+            sys.exit(f'ERROR: {args.input} is already a stereo map')
+        entries = np.fromfile(f, dtype=np.uint32, count=map_width * map_height)
+    if (map_width // 2) % num_elements != 0:
+        sys.exit(f'ERROR: the width of each eye must be a multiple of {num_elements}')
+
+    entries = untile(entries, map_width, map_height)
+    half = map_width // 2
+    left, right = entries[:, :half], entries[:, half:]
+
+    # map units per source pixel
+    unit_s = 65535 / (next_pow2(image_width) - 1)
+    unit_t = 65535 / (image_height - 1)
+    best = None
+    for mirror in ([False, True] if args.mode == 'auto' else [args.mode == 'mirror']):
+        offset_s, offset_t, error_s, error_t = fit(left, right, mirror)
+        error = max(error_s / unit_s, error_t / unit_t)
+        print(f'{"mirror" if mirror else "identical"}: offset ({offset_s}, {offset_t}), max error {error:.3f} px')
+        if best is None or error < best[0]:
+            best = (error, mirror, offset_s, offset_t)
+
+    error, mirror, offset_s, offset_t = best
+    if error > args.max_error and not args.force:
+        sys.exit(f'ERROR: the right eye differs from the derived one by {error:.3f} px (use --force to write it anyway)')
+
+    header = np.array([STEREO_MAP_MAGIC, map_width, map_height, image_width, image_height,
+        STEREO_MAP_MIRROR if mirror else 0, offset_s, offset_t], dtype=np.int32)
+    with open(args.output, 'wb') as f:
+        header.tofile(f)
+        tile(np.ascontiguousarray(left)).tofile(f)
+    print(f'wrote {args.output} ({"mirror" if mirror else "identical"})')
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <bcm_host.h>
+
+#include "v3d_util.h"
+#include "mailbox.h"
+
+#define V3D_OFFSET      0xc00000
+#define V3D_SIZE        0x1000
+
+#define V3D_PCTRC       (0x670 / 4)
+#define V3D_PCTRE       (0x674 / 4)
+#define V3D_PCTR(n)     ((0x680 + 8 * (n)) / 4)
+#define V3D_PCTRS(n)    ((0x684 + 8 * (n)) / 4)
+
+#define V3D_PCTRE_EN    (1u << 31)
+
+#define V3D_L2CACTL     (0x020 / 4)
+#define V3D_SLCACTL     (0x024 / 4)
+#define V3D_SRQPC       (0x430 / 4)
+#define V3D_SRQUA       (0x434 / 4)
+#define V3D_SRQCS       (0x43c / 4)
+#define V3D_DBCFG       (0xe00 / 4)
+#define V3D_DBQITE      (0xe2c / 4)
+#define V3D_DBQITC      (0xe30 / 4)
+
+#define V3D_L2CACTL_L2CCLR  (1u << 2)
+#define V3D_SRQCS_RESET     ((1u << 7) | (1u << 8) | (1u << 16)) // clears the queue, the error flag and the completed count
+
+// Counter sources, see "Performance Counters" in the VideoCore IV 3D Architecture Reference Guide.
+// The counters are global to V3D, so other GPU clients are counted as well.
+static const struct {
+    unsigned int source;
+    const char *name;
+} perf_counters[V3D_UTIL_NUM_PERF_COUNTERS] = {
+    {16, "qpu exec"},
+    {13, "qpu idle"},
+    {17, "tmu stall"},
+    {18, "scoreboard stall"},
+    {26, "vdw stall"},
+    {27, "vcd stall"},
+    {25, "tmu cache miss"},
+    {29, "l2 cache miss"},
+};
+
+bool v3d_util_perf_open(v3d_util_perf_t *perf) {
+    memset(perf, 0x0, sizeof(v3d_util_perf_t));
+
+    if (access("/dev/mem", R_OK | W_OK) != 0) {
+        fprintf(stderr, "ERROR: performance counters need access to /dev/mem\n");
+        return false;
+    }
+
+    perf->regs = (volatile uint32_t *) mapmem(bcm_host_get_peripheral_address() + V3D_OFFSET, V3D_SIZE);
+
+    uint32_t enable = V3D_PCTRE_EN;
+    for (int i = 0; i < V3D_UTIL_NUM_PERF_COUNTERS; ++i) {
+        perf->regs[V3D_PCTRS(i)] = perf_counters[i].source;
+        enable |= 1u << i;
+    }
+    perf->regs[V3D_PCTRE] = enable;
+    return true;
+}
+
+void v3d_util_perf_close(v3d_util_perf_t *perf) {
+    if (perf->regs == NULL)
+        return;
+    perf->regs[V3D_PCTRE] = 0;
+    unmapmem((void *) perf->regs, V3D_SIZE);
+    perf->regs = NULL;
+}
+
+void v3d_util_perf_begin(v3d_util_perf_t *perf) {
+    perf->regs[V3D_PCTRC] = (1u << V3D_UTIL_NUM_PERF_COUNTERS) - 1;
+}
+
+void v3d_util_perf_end(v3d_util_perf_t *perf) {
+    for (int i = 0; i < V3D_UTIL_NUM_PERF_COUNTERS; ++i) {
+        perf->values[i] += perf->regs[V3D_PCTR(i)];
+    }
+    perf->num_frames++;
+}
+
+void v3d_util_perf_print(v3d_util_perf_t *perf, FILE *fp) {
+    if (perf->num_frames == 0)
+        return;
+    fprintf(fp, "perf (per frame):");
+    for (int i = 0; i < V3D_UTIL_NUM_PERF_COUNTERS; ++i) {
+        fprintf(fp, " %s=%llu", perf_counters[i].name, (unsigned long long) (perf->values[i] / perf->num_frames));
+        perf->values[i] = 0;
+    }
+    fprintf(fp, "\n");
+    perf->num_frames = 0;
+}
+
+bool v3d_util_direct_open(v3d_util_direct_t *direct) {
+    memset(direct, 0x0, sizeof(v3d_util_direct_t));
+
+    if (access("/dev/mem", R_OK | W_OK) != 0) {
+        fprintf(stderr, "ERROR: launching programs directly needs access to /dev/mem\n");
+        return false;
+    }
+
+    direct->regs = (volatile uint32_t *) mapmem(bcm_host_get_peripheral_address() + V3D_OFFSET, V3D_SIZE);
+    return true;
+}
+
+void v3d_util_direct_close(v3d_util_direct_t *direct) {
+    if (direct->regs == NULL)
+        return;
+    if (direct->num_qpus > 0)
+        direct->regs[V3D_DBQITE] = direct->saved_dbqite;
+    unmapmem((void *) direct->regs, V3D_SIZE);
+    direct->regs = NULL;
+}
+
+// Clears the L2, TMU, uniform and instruction caches, e.g. after the host
+// has rewritten uniforms that a resident program is about to read.
+void v3d_util_direct_clear_caches(v3d_util_direct_t *direct) {
+    direct->regs[V3D_L2CACTL] = V3D_L2CACTL_L2CCLR;
+    direct->regs[V3D_SLCACTL] = 0xffffffff;
+}
+
+// Starts the program on num_qpus QPUs with the uniforms of each.  The host
+// interrupts of the QPUs are disabled while programs run this way.
+void v3d_util_direct_launch(v3d_util_direct_t *direct, int num_qpus, uint32_t code, const uint32_t *uniforms) {
+    direct->saved_dbqite = direct->regs[V3D_DBQITE];
+    direct->num_qpus = num_qpus;
+    direct->regs[V3D_DBCFG] = 0;
+    direct->regs[V3D_DBQITE] = 0;
+    direct->regs[V3D_DBQITC] = 0xffffffff;
+    v3d_util_direct_clear_caches(direct);
+    direct->regs[V3D_SRQCS] = V3D_SRQCS_RESET;
+    for (int i = 0; i < num_qpus; ++i) {
+        direct->regs[V3D_SRQUA] = uniforms[i];
+        direct->regs[V3D_SRQPC] = code;
+    }
+}
+
+// Waits until every launched program has ended.
+bool v3d_util_direct_wait(v3d_util_direct_t *direct, int timeout_ms) {
+    struct timespec begin, now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while ((int) ((direct->regs[V3D_SRQCS] >> 16) & 0xff) != direct->num_qpus) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000 > timeout_ms)
+            return false;
+    }
+    return true;
+}
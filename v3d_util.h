@@ -0,0 +1,36 @@
+#ifndef V3D_UTIL_H
+#define V3D_UTIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define V3D_UTIL_NUM_PERF_COUNTERS 8
+
+typedef struct {
+    volatile uint32_t *regs;
+    uint64_t values[V3D_UTIL_NUM_PERF_COUNTERS];
+    unsigned int num_frames;
+} v3d_util_perf_t;
+
+// Runs programs through the user program request queue of V3D instead of
+// the mailbox, so that a program may stay resident across frames.
+typedef struct {
+    volatile uint32_t *regs;
+    uint32_t saved_dbqite;
+    int num_qpus;
+} v3d_util_direct_t;
+
+bool v3d_util_perf_open(v3d_util_perf_t *perf);
+void v3d_util_perf_close(v3d_util_perf_t *perf);
+void v3d_util_perf_begin(v3d_util_perf_t *perf);
+void v3d_util_perf_end(v3d_util_perf_t *perf);
+void v3d_util_perf_print(v3d_util_perf_t *perf, FILE *fp);
+
+bool v3d_util_direct_open(v3d_util_direct_t *direct);
+void v3d_util_direct_close(v3d_util_direct_t *direct);
+void v3d_util_direct_clear_caches(v3d_util_direct_t *direct);
+void v3d_util_direct_launch(v3d_util_direct_t *direct, int num_qpus, uint32_t code, const uint32_t *uniforms);
+bool v3d_util_direct_wait(v3d_util_direct_t *direct, int timeout_ms);
+
+#endif
@@ -8,16 +8,35 @@
 #include "vcsm_util.h"
 #include "mailbox.h"
 
-void vcsm_util_buffer_create(vcsm_util_buffer_t *buffer, size_t size) {
+static bool buffer_map(vcsm_util_buffer_t *buffer, size_t size) {
+    if (buffer->handle == 0) {
+        fprintf(stderr, "ERROR: failed to allocate %zu bytes of GPU memory, gpu_mem is too small for this configuration\n", size);
+        buffer->size = 0;
+        return false;
+    }
     buffer->size = size;
-    buffer->handle = vcsm_malloc(size, "vcsm_util_buffer_create");
     buffer->usr_mem_ptr = vcsm_lock(buffer->handle);
     vcsm_unlock_ptr(buffer->usr_mem_ptr);
     buffer->vc_mem_addr = vcsm_vc_addr_from_hdl(buffer->handle);
+    return true;
+}
+
+bool vcsm_util_buffer_create(vcsm_util_buffer_t *buffer, size_t size) {
+    buffer->handle = vcsm_malloc(size, "vcsm_util_buffer_create");
+    return buffer_map(buffer, size);
+}
+
+// Cached on the ARM side, for buffers that are only read by the CPU.
+bool vcsm_util_buffer_create_cached(vcsm_util_buffer_t *buffer, size_t size) {
+    buffer->handle = vcsm_malloc_cache(size, VCSM_CACHE_TYPE_HOST, "vcsm_util_buffer_create_cached");
+    return buffer_map(buffer, size);
 }
 
 void vcsm_util_buffer_destroy(vcsm_util_buffer_t *buffer) {
+    if (buffer->handle == 0)
+        return;
     vcsm_free(buffer->handle);
+    buffer->handle = 0;
 }
 
 bool vcsm_util_buffer_load_from_file(vcsm_util_buffer_t *buffer, FILE *fp, size_t size) {
@@ -35,18 +54,24 @@ error:
     return result;
 }
 
-void vcsm_util_program_create(vcsm_util_program_t *program, int num_qpus) {
+size_t vcsm_util_program_size(size_t code_size) {
+    return sizeof(vcsm_util_program_mmap_t) + code_size;
+}
+
+bool vcsm_util_program_create(vcsm_util_program_t *program, int num_qpus, size_t code_size) {
     program->num_qpus = num_qpus;
+    program->code_size = code_size;
     
     vcsm_util_buffer_t *buffer = &program->buffer;
     
-    unsigned int size = sizeof(vcsm_util_program_mmap_t);
-    vcsm_util_buffer_create(buffer, size);
+    size_t size = vcsm_util_program_size(code_size);
+    if (!vcsm_util_buffer_create(buffer, size))
+        return false;
     
     vcsm_lock(buffer->handle);
 
     vcsm_util_program_mmap_t *mmap = (vcsm_util_program_mmap_t *) buffer->usr_mem_ptr;
-    memset(mmap, 0x0, sizeof(vcsm_util_program_mmap_t));
+    memset(mmap, 0x0, size);
     program->mmap = mmap;
 
     unsigned int ptr = buffer->vc_mem_addr;
@@ -54,12 +79,18 @@ void vcsm_util_program_create(vcsm_util_program_t *program, int num_qpus) {
     program->vc_msg = vc_msg;
     
     vcsm_unlock_ptr(buffer->usr_mem_ptr);
+    return true;
 }
 
-void vcsm_util_program_load_from_memory(vcsm_util_program_t *program, void *ptr, size_t size) {
+bool vcsm_util_program_load_from_memory(vcsm_util_program_t *program, void *ptr, size_t size) {
+    if (size > program->code_size) {
+        fprintf(stderr, "ERROR: kernel of %zu bytes does not fit the program buffer\n", size);
+        return false;
+    }
     vcsm_lock(program->buffer.handle);
     memcpy(program->mmap->code, ptr, size);
     vcsm_unlock_ptr(program->buffer.usr_mem_ptr);
+    return true;
 }
 
 void vcsm_util_program_destroy(vcsm_util_program_t *program) {
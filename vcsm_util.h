@@ -3,8 +3,7 @@
 
 #include <stdbool.h>
 
-#define MAX_NUM_CODE_WORDS  (8192*16)
-#define MAX_NUM_UNIFORMS    16
+#define MAX_NUM_UNIFORMS    64
 #define MAX_NUM_QPUS        12
 
 typedef struct {
@@ -14,25 +13,30 @@ typedef struct {
     void *usr_mem_ptr;
 } vcsm_util_buffer_t;
 
-void vcsm_util_buffer_create(vcsm_util_buffer_t *buffer, size_t size);
+bool vcsm_util_buffer_create(vcsm_util_buffer_t *buffer, size_t size);
+bool vcsm_util_buffer_create_cached(vcsm_util_buffer_t *buffer, size_t size);
 void vcsm_util_buffer_destroy(vcsm_util_buffer_t *buffer);
 bool vcsm_util_buffer_load_from_file(vcsm_util_buffer_t *buffer, FILE *fp, size_t size);
 
+// The code follows the uniforms and the messages, so that the buffer is only
+// as large as the kernel that is loaded into it.
 typedef struct {
-    unsigned int code[MAX_NUM_CODE_WORDS];
     unsigned int uniforms[MAX_NUM_UNIFORMS * MAX_NUM_QPUS];
     unsigned int msg[2 * MAX_NUM_QPUS];
+    unsigned int code[];
 } vcsm_util_program_mmap_t;
 
 typedef struct {
     int num_qpus;
+    size_t code_size;
     vcsm_util_buffer_t buffer;
     vcsm_util_program_mmap_t *mmap;
     unsigned int vc_msg;
 } vcsm_util_program_t;
 
-void vcsm_util_program_create(vcsm_util_program_t *program, int num_qpus);
-void vcsm_util_program_load_from_memory(vcsm_util_program_t *program, void *ptr, size_t size);
+size_t vcsm_util_program_size(size_t code_size);
+bool vcsm_util_program_create(vcsm_util_program_t *program, int num_qpus, size_t code_size);
+bool vcsm_util_program_load_from_memory(vcsm_util_program_t *program, void *ptr, size_t size);
 void vcsm_util_program_destroy(vcsm_util_program_t *program);
 
 #endif